@@ -0,0 +1,96 @@
+#!/bin/sh
+# -------------------------------------------------------------------------------------
+#
+# This script benchmarks the serial and parallel Topology sorting programs.
+# It sweeps Graph sizes, densities and Threads counts, runs each configuration
+# and records the wall-clock time of the parse, build, sort and write phases,
+# along with the peak resident memory, as CSV and JSON.
+# Random DAGs are generated by graph_generator in the RandomGraph text format,
+# with edges i -> j for i < j, each one present with the requested density.
+#
+# Configuration(environment variables):
+#      BENCH_NODES:     Graph nodes counts to sweep.
+#      BENCH_DENSITIES: Graph edge densities to sweep.
+#      BENCH_THREADS:   Threads counts to sweep for the parallel engines.
+#      BENCH_ENGINES:   Parallel engines to sweep.
+#      BENCH_REPEAT:    Runs per configuration.
+#      BENCH_OUTPUT:    Results files prefix, .csv and .json are appended.
+#
+# Author: Angelos Stamatiou, March 2020
+#
+# -------------------------------------------------------------------------------------
+
+BENCH_NODES=${BENCH_NODES:-"10000 100000"}
+BENCH_DENSITIES=${BENCH_DENSITIES:-"0.0001 0.001"}
+BENCH_THREADS=${BENCH_THREADS:-"1 2 4"}
+BENCH_ENGINES=${BENCH_ENGINES:-"level steal"}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench_results}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+CSV="$BENCH_OUTPUT.csv"
+JSON="$BENCH_OUTPUT.json"
+
+# Generates a random DAG in RandomGraph text format.
+# Arguments: nodes count, edge density, seed, output file.
+generate_graph()
+{
+    ./graph_generator "nodes=$1,density=$2,seed=$3" "$4" > "$WORK_DIR/log" || cat "$WORK_DIR/log"
+}
+
+# Extracts a reported value from a program output.
+# Arguments: output file, reported value label.
+extract()
+{
+    sed -n "s/^$2: \([0-9.]*\).*/\1/p" "$1"
+}
+
+# Runs a program configuration and appends its results.
+# Arguments: program name, engine, Threads count, nodes count, density, edges count, run, command...
+run_benchmark()
+{
+    name=$1; engine=$2; threads=$3; nodes=$4; density=$5; edges=$6; run=$7
+    shift 7
+    if ! "$@" > "$WORK_DIR/log" 2>&1; then
+        echo "Benchmark failed: $*"
+        cat "$WORK_DIR/log"
+        return
+    fi
+    parse=$(extract "$WORK_DIR/log" "Parse time")
+    build=$(extract "$WORK_DIR/log" "Build time")
+    sort=$(extract "$WORK_DIR/log" "Sort time")
+    write=$(extract "$WORK_DIR/log" "Write time")
+    memory=$(extract "$WORK_DIR/log" "Peak memory")
+    total=$(echo "$parse $build $sort $write" | awk '{ printf "%f", $1 + $2 + $3 + $4 }')
+    echo "$name,$engine,$threads,$nodes,$density,$edges,$run,$parse,$build,$sort,$write,$total,$memory" >> "$CSV"
+    [ -s "$JSON.tmp" ] && echo "," >> "$JSON.tmp"
+    printf '  {"program": "%s", "engine": "%s", "threads": %s, "nodes": %s, "density": %s, "edges": %s, "run": %s, "parse_secs": %s, "build_secs": %s, "sort_secs": %s, "write_secs": %s, "total_secs": %s, "peak_rss_kb": %s}' \
+        "$name" "$engine" "$threads" "$nodes" "$density" "$edges" "$run" "$parse" "$build" "$sort" "$write" "$total" "$memory" >> "$JSON.tmp"
+    printf "%-28s %-6s threads=%-3s nodes=%-9s density=%-8s run=%s sort=%ss total=%ss rss=%sKB\n" \
+        "$name" "$engine" "$threads" "$nodes" "$density" "$run" "$sort" "$total" "$memory"
+}
+
+echo "program,engine,threads,nodes,density,edges,run,parse_secs,build_secs,sort_secs,write_secs,total_secs,peak_rss_kb" > "$CSV"
+: > "$JSON.tmp"
+for nodes in $BENCH_NODES; do
+    for density in $BENCH_DENSITIES; do
+        graph="$WORK_DIR/graph_${nodes}_${density}"
+        generate_graph "$nodes" "$density" 1 "$graph"
+        edges=$(($(wc -l < "$graph") - 1))
+        for run in $(seq "$BENCH_REPEAT"); do
+            run_benchmark topology_shorting serial 1 "$nodes" "$density" "$edges" "$run" \
+                ./topology_shorting "$graph" "$WORK_DIR/output"
+            for engine in $BENCH_ENGINES; do
+                for threads in $BENCH_THREADS; do
+                    run_benchmark topology_shorting_parallel "$engine" "$threads" "$nodes" "$density" "$edges" "$run" \
+                        ./topology_shorting_parallel "$threads" "$graph" "$WORK_DIR/output" "--engine=$engine"
+                done
+            done
+        done
+        rm -f "$graph"
+    done
+done
+{ echo "["; cat "$JSON.tmp"; echo; echo "]"; } > "$JSON"
+rm -f "$JSON.tmp"
+echo "Results written to $CSV and $JSON."
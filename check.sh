@@ -0,0 +1,118 @@
+#!/bin/sh
+# -------------------------------------------------------------------------------------
+#
+# This script checks the serial and parallel Topology sorting programs for regressions.
+# Small DAGs of every generator shape are sorted with every engine and adjacency layout,
+# in text and binary format, and each Topology matrix is validated against the Graph:
+# every node appears once and every edge leads forward. The canonical Topology matrices
+# of the deterministic modes must also be identical for every Threads count, and equal
+# to the serial ones.
+#
+# Configuration(environment variables):
+#      CHECK_NODES:   Graph nodes count.
+#      CHECK_THREADS: Threads counts to check the parallel engines with.
+#
+# Author: Angelos Stamatiou, March 2020
+#
+# -------------------------------------------------------------------------------------
+
+CHECK_NODES=${CHECK_NODES:-3000}
+CHECK_THREADS=${CHECK_THREADS:-"1 2 4"}
+SPECS="density=0.002,shape=random density=0.01,shape=layered density=0.001,shape=chain density=0.001,shape=fanout,fanout=4"
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+checks=0
+failures=0
+
+# Validates a Topology matrix against a text Graph.
+# Arguments: Graph file, Topology matrix file.
+validate_order()
+{
+    awk 'NR == FNR {
+            if (FNR == 1) { count = $1; next }
+            if ($1 == -1) { next }
+            if ($1 in position || $1 < 0 || $1 >= count) { exit 1 }
+            position[$1] = FNR
+            sorted++
+            next
+        }
+        FNR == 1 { if ($1 != count || sorted != count) { exit 1 } next }
+        $1 != -1 && position[$1] >= position[$2] { exit 1 }' "$2" "$1"
+}
+
+# Runs a sort and validates its Topology matrix.
+# Arguments: description, Graph text file, command...
+check_sort()
+{
+    description=$1; graph=$2
+    shift 2
+    checks=$((checks + 1))
+    if ! "$@" > "$WORK_DIR/log" 2>&1; then
+        echo "FAILED: $description"
+        cat "$WORK_DIR/log"
+        failures=$((failures + 1))
+    elif ! validate_order "$graph" "$WORK_DIR/output"; then
+        echo "INVALID ORDER: $description"
+        failures=$((failures + 1))
+    fi
+}
+
+# Compares a Topology matrix with the reference one.
+# Arguments: description, reference Topology matrix file.
+check_same()
+{
+    checks=$((checks + 1))
+    if ! cmp -s "$WORK_DIR/output" "$2"; then
+        echo "DIFFERENT ORDER: $1"
+        failures=$((failures + 1))
+    fi
+}
+
+for spec in $SPECS; do
+    graph="$WORK_DIR/graph"
+    if ! ./graph_generator "nodes=$CHECK_NODES,$spec" "$graph" > "$WORK_DIR/log" \
+        || ! ./graph_converter "$graph" "$graph.bin" > "$WORK_DIR/log"; then
+        cat "$WORK_DIR/log"
+        exit 1
+    fi
+
+    for input in "$graph" "$graph.bin"; do
+        for layout in csr bitset compressed; do
+            check_sort "serial $spec $input --layout=$layout" "$graph" \
+                ./topology_shorting "$input" "$WORK_DIR/output" "--layout=$layout"
+            for engine in level steal hybrid; do
+                # The hybrid engine requires the csr layout.
+                [ "$engine" = hybrid ] && [ "$layout" != csr ] && continue
+                for threads in $CHECK_THREADS; do
+                    check_sort "parallel $threads $spec $input --engine=$engine --layout=$layout" "$graph" \
+                        ./topology_shorting_parallel "$threads" "$input" "$WORK_DIR/output" "--engine=$engine" "--layout=$layout"
+                done
+            done
+        done
+    done
+    check_sort "serial $spec --mem-limit=256K" "$graph" \
+        ./topology_shorting "$graph" "$WORK_DIR/output" --mem-limit=256K
+    for relabel in bfs rcm degree; do
+        check_sort "parallel 2 $spec --relabel=$relabel" "$graph" \
+            ./topology_shorting_parallel 2 "$graph" "$WORK_DIR/output" "--relabel=$relabel"
+    done
+
+    # Canonical Topology matrices must not depend on the engine or the Threads count.
+    for order in level lex; do
+        check_sort "serial $spec --deterministic=$order" "$graph" \
+            ./topology_shorting "$graph" "$WORK_DIR/output" "--deterministic=$order"
+        cp "$WORK_DIR/output" "$WORK_DIR/reference"
+        for engine in level steal hybrid; do
+            for threads in $CHECK_THREADS; do
+                description="parallel $threads $spec --engine=$engine --deterministic=$order"
+                check_sort "$description" "$graph" \
+                    ./topology_shorting_parallel "$threads" "$graph" "$WORK_DIR/output" "--engine=$engine" "--deterministic=$order"
+                check_same "$description" "$WORK_DIR/reference"
+            done
+        done
+    done
+done
+
+echo "$checks checks, $failures failed."
+[ "$failures" -eq 0 ]
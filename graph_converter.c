@@ -0,0 +1,136 @@
+// -------------------------------------------------------------------------------------
+//
+// This program converts a Directed Acyclic Graph(DAG) text file, created by RandomGraph
+// generator by S.Pettie and V.Ramachandran, to the binary Graph format that the
+// Topology sorting programs memory map directly, without any parsing. The Graph is
+// loaded and saved by libtoposort, so version 1 binary Graphs are converted too.
+//
+// Binary Graph format(little endian):
+//      header     : magic "TOPOGRPH", uint32 version, uint32 flags,
+//                   uint64 nodes count, uint64 edges count.
+//      offsets    : int64[nodes count + 1], node i out-edges are targets[offsets[i]..offsets[i + 1]).
+//      targets    : int32[edges count], each node out-edges targets.
+//      in-degrees : int32[nodes count], each node dependencies count.
+//      weights    : double[edges count], aligned to 8 bytes, present if the weights flag is set.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "toposort.h"
+
+FILE *fout;                     // Output file.
+char *input_filename;           // Input file name.
+int with_weights;               // Write the edges weights.
+
+// Auxiliary function that displays a message in case of wrong input parameters.
+// Inputs:
+//      char *compiled_name: Programs compiled name.
+void syntax_message(char *compiled_name)
+{
+    printf("Correct syntax:\n");
+    printf("%s <input-file> <output-file> [--weights]\n", compiled_name);
+    printf("where: \n");
+    printf("<input-file> is the file containing a generated directed Graph by RandomGraph.\n");
+    printf("<output-file> is the file binary Graph will be written.\n");
+    printf("--weights also stores the edges weights in the binary Graph.\n");
+}
+
+// This function checks run-time parameters validity and
+// retrieves input and output file names.
+// Inputs:
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
+// Output:
+//      1 --> Parameters read successfully.
+//      0 --> Something went wrong.
+int read_parameters(int argc, char **argv)
+{
+    input_filename = argv[1];
+    if (input_filename == NULL) {
+        printf("Input file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    char *output_filename = argv[2];
+    if (output_filename == NULL) {
+        printf("Output file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    with_weights = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--weights") == 0) {
+            with_weights = 1;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            syntax_message(argv[0]);
+            return 0;
+        }
+    }
+
+    fout = fopen(output_filename, "wb");
+    if (fout == NULL) {
+        printf("Cannot open output file %s.\n", output_filename);
+        return 0;
+    }
+
+    printf("Converting Graph to binary format.\n");
+    printf("Graph will be retrieved from input file: %s\n", input_filename);
+    printf("Binary Graph will be written in output file: %s\n", output_filename);
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    toposort_context *ctx;
+    toposort_stats stats;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Run-time parameters check.
+    if (!read_parameters(argc, argv)) {
+        printf("Program terminates.\n");
+        return -1;
+    }
+
+    // Parse the text Graph and build its CSR arrays with libtoposort.
+    ctx = toposort_create(processors > 0 ? (int)processors : 1);
+    if (ctx == NULL) {
+        printf("Failed to allocate memory for the sort context.\n");
+        printf("Program terminates.\n");
+        return -1;
+    }
+    toposort_set_layout(ctx, TOPOSORT_LAYOUT_CSR);
+    toposort_set_schedule(ctx, with_weights);
+    if (!toposort_load_file(ctx, input_filename)) {
+        printf("%s\n", toposort_error(ctx));
+        printf("Program terminates.\n");
+        return -1;
+    }
+    toposort_get_stats(ctx, &stats);
+    printf("Nodes count: %d\n", stats.nodes_count);
+    printf("Edges count: %ld\n", stats.edges_count);
+
+    // Write the binary Graph to the output file.
+    if (!toposort_save_graph(ctx, fout, with_weights)) {
+        printf("%s\n", toposort_error(ctx));
+        printf("Failed to write binary Graph.\n");
+        return -1;
+    }
+    if (fclose(fout) != 0) {
+        printf("Failed to write binary Graph.\n");
+        return -1;
+    }
+
+    toposort_destroy(ctx);
+    printf("Program terminates.\n");
+
+    return 0;
+}
@@ -0,0 +1,408 @@
+// -------------------------------------------------------------------------------------
+//
+// This program generates synthetic Directed Acyclic Graphs(DAG), streaming them to a file
+// in the RandomGraph text format or in the binary Graph format of the Topology sorting
+// programs. Graphs are described by a generator specification and are reproducible:
+// each node draws its edges from its own random stream, so the same specification
+// always produces the same Graph, regardless of the Threads count. The rows are generated
+// by libtoposort, which also builds and saves the binary Graphs.
+//
+// Generator specification(comma separated, optionally prefixed by "gen:"):
+//      nodes=<N>       : Graph nodes count.
+//      density=<p>     : Probability of linking a node to each of its candidate nodes.
+//      shape=<shape>   : random  --> each node links to any later node.
+//                        layered --> nodes are split in layers, linking to the next layer.
+//                        chain   --> nodes form a chain, plus random links.
+//                        fanout  --> nodes form a tree of the given fan-out, plus random links.
+//      layers=<L>      : Layers count of the layered shape, square root of N by default.
+//      fanout=<F>      : Children count of each node of the fanout shape, 16 by default.
+//      seed=<S>        : Random streams seed.
+//      weights=<a>:<b> : Edges weights range, 0:1 by default.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "toposort.h"
+
+#define FORMAT_TEXT 0           // Write the Graph in RandomGraph text format.
+#define FORMAT_BINARY 1         // Write the Graph in binary format.
+#define GENERATOR_BLOCK 4096    // Nodes generated by a Thread at a time.
+
+// Text output buffer structure.
+typedef struct text_buffer {
+    char *data;                 // Formatted edge lines.
+    size_t size;                // Formatted edge lines size.
+    size_t capacity;            // Allocated buffer size.
+    long edges;                 // Formatted edge lines count.
+    int failed;                 // Buffer allocation failed.
+} text_buffer;
+
+FILE *fout;                     // Output file.
+toposort_context *ctx;          // Sort context, generating the Graph.
+char *spec;                     // Generator specification.
+int nodes_count;                // Graph nodes count.
+int threads_count;              // Threads count.
+int output_format;              // Output file format.
+int with_weights;               // Write the edges weights in binary format.
+long edges_count;               // Graph edges count.
+int write_failed;               // Writing the text output failed.
+text_buffer *buffers;           // Threads text output buffers.
+pthread_t *tid;                 // Threads.
+pthread_barrier_t barrier;      // Barrier for Threads synchronization.
+
+// This function appends a non-negative integer to a text buffer.
+// Inputs:
+//      char *p: Current buffer position.
+//      long value: The integer.
+// Output:
+//      Position after the integer.
+static inline char *format_long(char *p, long value)
+{
+    char digits[20];
+    int length = 0;
+    do {
+        digits[length++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (length > 0) {
+        *p++ = digits[--length];
+    }
+
+    return p;
+}
+
+// This function appends an edge line "<src> <dst> <weight>" to a text buffer,
+// with the weight printed with 6 decimal digits.
+// Inputs:
+//      text_buffer *buffer: The text buffer.
+//      int i: Edge source.
+//      int j: Edge target.
+//      double w: Edge weight.
+void append_edge_line(text_buffer *buffer, int i, int j, double w)
+{
+    long scaled = lround(w * 1e6);
+    char *p;
+    int k;
+    if (buffer->size + 64 > buffer->capacity) {
+        size_t capacity = buffer->capacity * 2 + 4096;
+        char *data = (char*)realloc(buffer->data, capacity);
+        if (data == NULL) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    p = buffer->data + buffer->size;
+    p = format_long(p, i);
+    *p++ = ' ';
+    p = format_long(p, j);
+    *p++ = ' ';
+    if (scaled < 0) {
+        *p++ = '-';
+        scaled = -scaled;
+    }
+    p = format_long(p, scaled / 1000000);
+    *p++ = '.';
+    for (k = 5, scaled %= 1000000; k >= 0; k--) {
+        p[k] = (char)('0' + scaled % 10);
+        scaled /= 10;
+    }
+    p += 6;
+    *p++ = '\n';
+    buffer->size = p - buffer->data;
+    buffer->edges++;
+}
+
+// This function grows the row buffers of a Thread to hold a row of the given length.
+// Inputs:
+//      int **row_targets: The edges targets buffer.
+//      double **row_weights: The edges weights buffer.
+//      int *capacity: The edges the buffers hold.
+//      int count: The row length.
+// Output:
+//      1 --> Grown successfully.
+//      0 --> Something went wrong.
+int grow_row_buffers(int **row_targets, double **row_weights, int *capacity, int count)
+{
+    int grown = count > 2 * *capacity ? count : 2 * *capacity;
+    int *targets = (int*)realloc(*row_targets, sizeof(int) * grown);
+    double *weights;
+    if (targets == NULL) {
+        return 0;
+    }
+    *row_targets = targets;
+    weights = (double*)realloc(*row_weights, sizeof(double) * grown);
+    if (weights == NULL) {
+        return 0;
+    }
+    *row_weights = weights;
+    *capacity = grown;
+
+    return 1;
+}
+
+// This Thread function streams the Graph in text format. In each round every Thread
+// formats the edge lines of its own block of nodes, then the first Thread writes
+// the blocks in nodes order. The row buffers start empty and grow to the longest row,
+// a row longer than them being generated again once they are grown.
+// Inputs:
+//      void *arg: Thread index.
+void *thread_write_text(void *arg)
+{
+    int thread = (int)(long)arg;
+    int *row_targets = NULL, capacity = 0;
+    double *row_weights = NULL;
+    text_buffer *buffer = &buffers[thread];
+    long round_start;
+    int i, k, count, first, last;
+
+    for (round_start = 0; round_start < nodes_count; round_start += (long)threads_count * GENERATOR_BLOCK) {
+        first = (int)(round_start + (long)thread * GENERATOR_BLOCK < nodes_count ? round_start + (long)thread * GENERATOR_BLOCK : nodes_count);
+        last = first + GENERATOR_BLOCK < nodes_count ? first + GENERATOR_BLOCK : nodes_count;
+        buffer->size = 0;
+        buffer->edges = 0;
+        for (i = first; i < last && !buffer->failed; i++) {
+            count = toposort_generate_row(ctx, i, row_targets, row_weights, capacity);
+            if (count > capacity) {
+                if (!grow_row_buffers(&row_targets, &row_weights, &capacity, count)) {
+                    buffer->failed = 1;
+                    break;
+                }
+                toposort_generate_row(ctx, i, row_targets, row_weights, capacity);
+            }
+            for (k = 0; k < count; k++) {
+                append_edge_line(buffer, i, row_targets[k], row_weights[k]);
+            }
+        }
+
+        // Write the blocks in nodes order.
+        pthread_barrier_wait(&barrier);
+        if (thread == 0) {
+            for (k = 0; k < threads_count; k++) {
+                // Threads without rows in the block have nothing to write, and may have no buffer yet.
+                if (buffers[k].failed || (buffers[k].size > 0 && fwrite(buffers[k].data, 1, buffers[k].size, fout) != buffers[k].size)) {
+                    write_failed = 1;
+                }
+                edges_count += buffers[k].edges;
+            }
+        }
+        pthread_barrier_wait(&barrier);
+        if (write_failed) {
+            break;
+        }
+    }
+
+    free(row_targets);
+    free(row_weights);
+    return NULL;
+}
+
+// This function runs the Threads streaming the Graph.
+// Output:
+//      1 --> Threads completed successfully.
+//      0 --> Something went wrong.
+int run_threads()
+{
+    long i;
+    for (i = 0; i < threads_count; i++) {
+        if (pthread_create(&tid[i], NULL, thread_write_text, (void*)i) != 0) {
+            printf("Failed to create Thread.\n");
+            return 0;
+        }
+    }
+    for (i = 0; i < threads_count; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    return 1;
+}
+
+// This function generates the Graph in memory with libtoposort, then writes it to the
+// output file in binary format.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int write_graph()
+{
+    toposort_stats stats;
+    size_t length = strlen(spec) + 5;
+    char *filename = (char*)malloc(length);
+    int written;
+    if (filename == NULL) {
+        printf("Failed to allocate memory for the Graph.\n");
+        return 0;
+    }
+
+    // The gen: prefix makes the library generate the Graph instead of reading a file.
+    snprintf(filename, length, "%s%s", strncmp(spec, "gen:", 4) == 0 ? "" : "gen:", spec);
+    toposort_set_layout(ctx, TOPOSORT_LAYOUT_CSR);
+    toposort_set_schedule(ctx, with_weights);
+    written = toposort_load_file(ctx, filename) && toposort_save_graph(ctx, fout, with_weights);
+    free(filename);
+    if (!written) {
+        printf("%s\n", toposort_error(ctx));
+        return 0;
+    }
+    toposort_get_stats(ctx, &stats);
+    edges_count = stats.edges_count;
+
+    return 1;
+}
+
+// This function streams the Graph to the output file in text format.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int write_text_graph()
+{
+    int i;
+    buffers = (text_buffer*)calloc(threads_count, sizeof(text_buffer));
+    if (buffers == NULL) {
+        printf("Failed to allocate memory for the output buffers.\n");
+        return 0;
+    }
+
+    fprintf(fout, "%d\n", nodes_count);
+    pthread_barrier_init(&barrier, NULL, threads_count);
+    if (!run_threads()) {
+        return 0;
+    }
+    pthread_barrier_destroy(&barrier);
+    fprintf(fout, "-1");
+
+    for (i = 0; i < threads_count; i++) {
+        free(buffers[i].data);
+    }
+    free(buffers);
+    return !write_failed && !ferror(fout);
+}
+
+// Auxiliary function that displays a message in case of wrong input parameters.
+// Inputs:
+//      char *compiled_name: Programs compiled name.
+void syntax_message(char *compiled_name)
+{
+    printf("Correct syntax:\n");
+    printf("%s <spec> <output-file> [options]\n", compiled_name);
+    printf("where: \n");
+    printf("<spec> is the generator specification, e.g. nodes=100000,density=0.001,shape=layered,seed=7.\n");
+    printf("<output-file> is the file generated Graph will be written.\n");
+    printf("options:\n");
+    printf("--threads=<T> generates the Graph with T Threads, 1 by default.\n");
+    printf("--format=text|binary writes the Graph in RandomGraph text or binary format, text by default.\n");
+    printf("--weights also stores the edges weights in binary format.\n");
+}
+
+// This function checks run-time parameters validity, retrieves the
+// generator specification and opens the output file.
+// Inputs:
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
+// Output:
+//      1 --> Parameters read successfully.
+//      0 --> Something went wrong.
+int read_parameters(int argc, char **argv)
+{
+    spec = argv[1];
+    if (spec == NULL) {
+        printf("Generator specification parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    char *output_filename = argv[2];
+    if (output_filename == NULL) {
+        printf("Output file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    threads_count = 1;
+    output_format = FORMAT_TEXT;
+    with_weights = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads_count = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--format=text") == 0) {
+            output_format = FORMAT_TEXT;
+        } else if (strcmp(argv[i], "--format=binary") == 0) {
+            output_format = FORMAT_BINARY;
+        } else if (strcmp(argv[i], "--weights") == 0) {
+            with_weights = 1;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            syntax_message(argv[0]);
+            return 0;
+        }
+    }
+    if (threads_count <= 0) {
+        printf("Threads count must be positive.\n");
+        return 0;
+    }
+    ctx = toposort_create(threads_count);
+    if (ctx == NULL) {
+        printf("Failed to allocate memory for the sort context.\n");
+        return 0;
+    }
+    if (!toposort_read_generator(ctx, spec, &nodes_count)) {
+        printf("%s\n", toposort_error(ctx));
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    fout = fopen(output_filename, "wb");
+    if (fout == NULL) {
+        printf("Cannot open output file %s.\n", output_filename);
+        return 0;
+    }
+
+    printf("Generating synthetic Graph with %d Threads.\n", threads_count);
+    printf("Generated Graph will be written in output file: %s\n", output_filename);
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int written;
+
+    // Run-time parameters check.
+    if (!read_parameters(argc, argv)) {
+        printf("Program terminates.\n");
+        return -1;
+    }
+
+    tid = (pthread_t*)malloc(sizeof(pthread_t) * threads_count);
+    if (tid == NULL) {
+        printf("Failed to allocate memory for the Threads.\n");
+        printf("Program terminates.\n");
+        return -1;
+    }
+
+    // Generate the Graph and write it to the output file.
+    if (output_format == FORMAT_BINARY) {
+        written = write_graph();
+    } else {
+        written = write_text_graph();
+    }
+    if (!written || fclose(fout) != 0) {
+        printf("Failed to write generated Graph.\n");
+        return -1;
+    }
+    printf("Nodes count: %d\n", nodes_count);
+    printf("Edges count: %ld\n", edges_count);
+
+    toposort_destroy(ctx);
+    free(tid);
+    printf("Program terminates.\n");
+
+    return 0;
+}
@@ -3,10 +3,12 @@
 // This program implements a Topology sorting algorithm,
 // based on Kahn's algorithm(https://en.wikipedia.org/wiki/Topological_sorting).
 // In this version, algorithm calculations are performed in serial.
-// Directed Acyclic Graph(DAG) is read from an input file created by RandomGraph generator 
-// by S.Pettie and V.Ramachandran using the following arguments: 
+// Directed Acyclic Graph(DAG) is read from an input file created by RandomGraph generator
+// by S.Pettie and V.Ramachandran using the following arguments:
 // ./RandomGraph directed_grph_<N> <N> 2 1 <N/2>
 // where N is the Graph nodes count we want to generate.
+// The algorithm is implemented by libtoposort(toposort.h), driven here through
+// a single Thread sort context with the serial Queue engine.
 //
 // Author: Angelos Stamatiou, March 2020
 //
@@ -14,129 +16,211 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "toposort.h"
 
-// Queue node structure.
-typedef struct node {
-    int val;
-    struct node *next;
-} node;
-
-node *head;                // Queue head node.
-node *tail;                // Queue tail node.
-FILE *fin;                 // Input file.
-FILE *fout;                // Output file.
-int  nodes_count;           // Graph nodes count.
-int **matrix;              // Graph nodes matrix.
-int *dependencies_matrix;  // Graph nodes dependencies matrix.
-int *topology_matrix;      // Graph nodes topology matrix.
-int topology_matrix_index; // Graph nodes topology matrix index.
-
-// This function inserts a given value at the end of the Queue.
-// Inputs:
-//      int val: The value to insert.
-int push_value(int val)
-{
-    node *new_node = (node*) malloc(sizeof(node));
-    if (new_node == NULL) {
-        return -1;
-    }
+#define STATS_NONE 0        // No statistics report.
+#define STATS_TEXT 1        // Statistics report printed as text.
+#define STATS_JSON 2        // Statistics report printed as JSON.
 
-    new_node->val = val;
-    new_node->next = NULL;
-    if (head == NULL) {
-        head = new_node;
-        tail = new_node;
-        return 0;
-    }
+FILE *fout;
+toposort_context *ctx;     // Sort context.
+int graph_layout;          // Graph adjacency layout requested.
+int stats_format;          // Statistics report format.
+long mem_limit;            // Out-of-core mode memory limit in bytes, 0 for the in-memory mode.
+char *previous_order_filename; // Incremental mode previous Topology matrix file, NULL for a full calculation.
+char *delta_filename;      // Incremental mode edges delta file.
+int check_order;           // Incremental mode checks every edge leads forward in the previous Topology matrix.
+int output_format;         // Topology matrix output file format.
+char *schedule_filename;   // Schedule mode output file, NULL unless the schedule is calculated.
+int order;                 // Topology matrix order requested.
+int relabel;               // Nodes relabeling requested.
+int batch_mode;            // Input file is a manifest or a directory of Graphs, output file is a directory.
+int jobs_threads;          // Batch mode Threads, each one sorting whole Graphs with its own sort context.
 
-    tail->next = new_node;
-    tail = new_node;
+// Batch mode job structure, one per Graph.
+typedef struct batch_job {
+    char *input;           // Graph input file name.
+    char *output;          // Topology matrix output file name.
+    int sorted;            // Graph was sorted and its Topology matrix written.
+    toposort_stats stats;  // Graph sort context statistics.
+} batch_job;
 
-    return 0;
-}
+batch_job *jobs;           // Batch mode jobs.
+int jobs_count;            // Batch mode jobs count.
+int jobs_allocated;        // Batch mode jobs capacity.
+int next_job;              // Batch mode next unclaimed job.
+toposort_context **contexts; // Batch mode per Thread sort contexts, reused between Graphs.
 
-// This function returns the head value of the Queue.
-// It will also move the head of the Queue to the next
-// node, if it exists.
-// Output:
-//      retval --> Queue head value.
-//      -1     --> Queue is empty.
-int pop_value()
+// Auxiliary function that displays a message in case of wrong input parameters.
+// Inputs:
+//      char *compiled_name: Programs compiled name.
+void syntax_message(char *compiled_name)
 {
-    if (head == NULL) {
-        return -1;
-    }
-    int retval = head->val;
-    node *new_head = head->next;
-    free(head);
-    if (new_head == NULL) {
-        head = NULL;
-        tail = NULL;
-    } else {
-        head = new_head;    
-    }
-
-    return retval;
+    printf("Correct syntax:\n");
+    printf("%s <input-file> <output-file> [options]\n", compiled_name);
+    printf("where: \n");
+    printf("<input-file> is the file containing a generated directed Graph by RandomGraph that the algorithm will use,\n");
+    printf("             or gen:<spec> to generate a synthetic Graph in memory, e.g. gen:nodes=100000,density=0.001,shape=layered.\n");
+    printf("<output-file> is the file Topology Matrix will be written.\n");
+    printf("options:\n");
+    printf("--layout=auto|csr|bitset|compressed selects the Graph adjacency layout, auto picks bitset for edge density above 5%%,\n");
+    printf("             compressed stores each node sorted targets as varint encoded gaps.\n");
+    printf("--output-format=text|binary|binary64 writes the Topology Matrix as text(default), or as a binary int32 or int64 array.\n");
+    printf("--mem-limit=<bytes>[K|M|G] sorts Graphs larger than memory out-of-core, spilling sorted edge runs to TMPDIR.\n");
+    printf("--incremental=<order-file> --delta=<delta-file> repairs a previous Topology Matrix of the Graph after\n");
+    printf("             the edges delta, one \"+ <src> <dst>\" or \"- <src> <dst>\" line per inserted or removed edge.\n");
+    printf("--check-order also checks every edge of the Graph leads forward in the previous Topology Matrix.\n");
+    printf("--deterministic=level|lex writes a canonical Topology Matrix, the same for any Threads count: level by level,\n");
+    printf("             each level sorted by node(level), or the lexicographically smallest one(lex, calculated serially).\n");
+    printf("--relabel=bfs|rcm|degree relabels the nodes for locality before sorting, in breadth-first, reverse Cuthill-McKee\n");
+    printf("             or decreasing degree order, the Topology Matrix being written with the original nodes.\n");
+    printf("--schedule=<schedule-file> also calculates the nodes earliest start times and levels from the edges weights,\n");
+    printf("             and the critical path, written to the schedule file.\n");
+    printf("--stats|--stats=json prints the phases times and, when built with STATS=1, the calculation counters.\n");
+    printf("--batch sorts a batch of Graphs: <input-file> is a manifest file, one \"<input-file> [<output-file>]\" line per Graph,\n");
+    printf("             or a directory of Graphs, and <output-file> is the directory Topology Matrices will be written,\n");
+    printf("             relative manifest output files included.\n");
+    printf("--jobs=<count> sets the Threads sorting Graphs of the batch concurrently(default the processors count).\n");
 }
 
-// This function initializes the Graph matrix and Dependencies matrix, by reading the input file.
+// This function reads the optional run-time parameters, following the positional ones.
+// Inputs:
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
+//      int first: The first optional parameter index.
 // Output:
-//      1 --> Initialized successfully.
+//      1 --> Options read successfully.
 //      0 --> Something went wrong.
-int initialize()
+int read_options(int argc, char **argv, int first)
 {
-    int i,j,fscanf_result;
-    double w;
-    head = NULL;
-    tail = NULL;
-    matrix = (int**)malloc(sizeof(int*) * nodes_count + sizeof(int) * nodes_count * nodes_count);
-    dependencies_matrix = (int*)malloc(sizeof(int*) * nodes_count);
-    topology_matrix = (int*)malloc(sizeof(int*) * nodes_count);
-    if ((matrix == NULL)  || (dependencies_matrix == NULL) || (topology_matrix == NULL)) {
-        return 0;
+    int i;
+    graph_layout = TOPOSORT_LAYOUT_AUTO;
+    stats_format = STATS_NONE;
+    output_format = TOPOSORT_OUTPUT_TEXT;
+    schedule_filename = NULL;
+    order = TOPOSORT_ORDER_ANY;
+    relabel = TOPOSORT_RELABEL_NONE;
+    mem_limit = 0;
+    previous_order_filename = NULL;
+    delta_filename = NULL;
+    check_order = 0;
+    batch_mode = 0;
+    jobs_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--layout=auto") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_AUTO;
+        } else if (strcmp(argv[i], "--layout=csr") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_CSR;
+        } else if (strcmp(argv[i], "--layout=bitset") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_BITSET;
+        } else if (strcmp(argv[i], "--layout=compressed") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_COMPRESSED;
+        } else if (strcmp(argv[i], "--output-format=text") == 0) {
+            output_format = TOPOSORT_OUTPUT_TEXT;
+        } else if (strcmp(argv[i], "--output-format=binary") == 0) {
+            output_format = TOPOSORT_OUTPUT_BINARY;
+        } else if (strcmp(argv[i], "--output-format=binary64") == 0) {
+            output_format = TOPOSORT_OUTPUT_BINARY64;
+        } else if (strncmp(argv[i], "--mem-limit=", 12) == 0) {
+            char *unit;
+            mem_limit = strtol(argv[i] + 12, &unit, 10);
+            mem_limit <<= *unit == 'K' ? 10 : *unit == 'M' ? 20 : *unit == 'G' ? 30 : 0;
+            if (mem_limit <= 0) {
+                printf("Invalid memory limit %s.\n", argv[i] + 12);
+                return 0;
+            }
+        } else if (strncmp(argv[i], "--incremental=", 14) == 0) {
+            previous_order_filename = argv[i] + 14;
+        } else if (strncmp(argv[i], "--delta=", 8) == 0) {
+            delta_filename = argv[i] + 8;
+        } else if (strcmp(argv[i], "--check-order") == 0) {
+            check_order = 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch_mode = 1;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs_threads = atoi(argv[i] + 7);
+            if (jobs_threads <= 0) {
+                printf("Invalid jobs count %s.\n", argv[i] + 7);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--deterministic=level") == 0) {
+            order = TOPOSORT_ORDER_LEVEL;
+        } else if (strcmp(argv[i], "--deterministic=lex") == 0) {
+            order = TOPOSORT_ORDER_LEX;
+        } else if (strcmp(argv[i], "--relabel=bfs") == 0) {
+            relabel = TOPOSORT_RELABEL_BFS;
+        } else if (strcmp(argv[i], "--relabel=rcm") == 0) {
+            relabel = TOPOSORT_RELABEL_RCM;
+        } else if (strcmp(argv[i], "--relabel=degree") == 0) {
+            relabel = TOPOSORT_RELABEL_DEGREE;
+        } else if (strncmp(argv[i], "--schedule=", 11) == 0) {
+            schedule_filename = argv[i] + 11;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_format = STATS_TEXT;
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            stats_format = STATS_JSON;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            return 0;
+        }
     }
 
-    int *ptr = (int*)(matrix + nodes_count);
-    for(i = 0; i < nodes_count; i++) {
-        matrix[i] = (ptr + nodes_count * i);
-        dependencies_matrix[i] = 0;
-        topology_matrix[i] = 0;    
-        for (j = 0; j < nodes_count; j++) {
-            matrix[i][j] = 0;            
+    if ((previous_order_filename == NULL) != (delta_filename == NULL)) {
+        printf("Incremental mode requires both --incremental and --delta.\n");
+        return 0;
+    }
+    if (check_order && previous_order_filename == NULL) {
+        printf("--check-order requires the incremental mode.\n");
+        return 0;
+    }
+    if (previous_order_filename != NULL) {
+        if (batch_mode) {
+            printf("Batch mode cannot run incremental repairs.\n");
+            return 0;
+        }
+        if (mem_limit > 0) {
+            printf("Incremental mode cannot run out-of-core.\n");
+            return 0;
         }
-    }            
-    fscanf_result = fscanf(fin, "%d", &i);
-    while(fscanf_result != 1 || i != -1) {
-        fscanf_result = fscanf(fin, "%d %lf \n", &j, &w);
-        matrix[i][j] = 1;
-        dependencies_matrix[j]++;    
-        fscanf_result = fscanf(fin, "%d", &i);
+        if (order != TOPOSORT_ORDER_ANY) {
+            printf("Incremental mode repairs the previous order, it cannot write a canonical one.\n");
+            return 0;
+        }
+        if (relabel != TOPOSORT_RELABEL_NONE) {
+            printf("Incremental mode cannot relabel the Graph.\n");
+            return 0;
+        }
+        // Searches follow the edges of single nodes, the CSR layout is required.
+        graph_layout = TOPOSORT_LAYOUT_CSR;
+    }
+    if ((order == TOPOSORT_ORDER_LEX || relabel != TOPOSORT_RELABEL_NONE) && mem_limit > 0) {
+        printf("Lexicographic order and relabeling are not available out-of-core.\n");
+        return 0;
+    }
+    if (schedule_filename != NULL && (batch_mode || mem_limit > 0 || previous_order_filename != NULL)) {
+        printf("Schedule mode cannot run in batch, out-of-core or incremental mode.\n");
+        return 0;
     }
 
     return 1;
 }
 
-// Auxiliary function that displays a message in case of wrong input parameters.
-// Inputs:
-//      char *compiled_name: Programs compiled name.
-void syntax_message(char *compiled_name)
-{
-    printf("Correct syntax:\n");
-    printf("%s <input-file> <output-file>\n", compiled_name);
-    printf("where: \n");
-    printf("<input-file> is the file containing a generated directed Graph by RandomGraph that the algorithm will use.\n");
-    printf("<output-file> is the file Topology Matrix will be written.\n");
-}
-
 // This function checks run-time parameters validity and
 // retrieves input and output file names.
 // Inputs:
-//      char** argv: The run-time parameters.
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
 // Output:
 //      1 --> Parameters read successfully.
 //      0 --> Something went wrong.
-int read_parameters(char **argv)
+int read_parameters(int argc, char **argv)
 {
     char *input_filename = argv[1];
     if (input_filename == NULL) {
@@ -144,132 +228,510 @@ int read_parameters(char **argv)
         syntax_message(argv[0]);
         return 0;
     }
-            
-    fin = fopen(input_filename, "r");
-    if (fin == NULL) {
-        printf("Cannot open input file %s.\n", input_filename);
-        return 0;        
-    }
-    
+
     char *output_filename = argv[2];
     if (output_filename == NULL) {
         printf("Output file parameter missing.\n");
         syntax_message(argv[0]);
         return 0;
     }
-            
+
+    if (!read_options(argc, argv, 3)) {
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    if (batch_mode) {
+        printf("Calculating Topology sorting of a batch of Graphs.\n");
+        printf("Graphs will be retrieved from: %s\n", input_filename);
+        printf("Topology Matrices will be written in output directory: %s\n", output_filename);
+        return 1;
+    }
+
     fout = fopen(output_filename, "w");
     if (fout == NULL) {
         printf("Cannot open output file %s.\n", output_filename);
-        return 0;        
+        return 0;
     }
 
     printf("Calculating Topology sorting of Graph.\n");
-    printf("Graph will be retrieved from input file: %s\n", input_filename);
+    printf("Graph will be %s: %s\n", strncmp(input_filename, "gen:", 4) == 0 ? "generated from specification" : "retrieved from input file", input_filename);
     printf("Topology Matrix will be written in output file: %s\n", output_filename);
+    if (order != TOPOSORT_ORDER_ANY) {
+        printf("Deterministic order: %s\n", toposort_order_name(order));
+    }
 
     return 1;
 }
 
-// This function implements a Topology shorting algorithm,
-// based on Kahn's algorithm.
-void calculate_topology()
+// This function prints the statistics report: the phases wall-clock times and,
+// when the instrumentation counters are compiled in, the calculation counters.
+// Inputs:
+//      const toposort_stats *stats: The sort context statistics.
+//      long peak_memory: Peak resident memory in KB.
+void print_stats(const toposort_stats *stats, long peak_memory)
+{
+    const toposort_counters *c = stats->counters;
+    if (stats_format == STATS_JSON) {
+        printf("{\"nodes\": %d, \"edges\": %ld, \"layout\": \"%s\", ",
+            stats->nodes_count, stats->edges_count, toposort_layout_name(stats->layout));
+        printf("\"phases\": {\"initialize_secs\": %f, \"parse_secs\": %f, \"build_secs\": %f, \"relabel_secs\": %f, \"calculate_topology_secs\": %f, \"write_topology_secs\": %f}, ",
+            stats->parse_time + stats->build_time + stats->relabel_time, stats->parse_time, stats->build_time, stats->relabel_time, stats->sort_time, stats->write_time);
+        printf("\"peak_rss_kb\": %ld, ", peak_memory);
+        if (c != NULL) {
+            printf("\"counters\": {\"nodes_processed\": %ld, \"edges_relaxed\": %ld, \"queue_high_water\": %ld}}\n",
+                c->nodes_processed, c->edges_relaxed, c->queue_high_water);
+        } else {
+            printf("\"counters\": null}\n");
+        }
+        return;
+    }
+
+    printf("Statistics:\n");
+    printf("initialize: %f secs(parse %f, build %f, relabel %f)\n", stats->parse_time + stats->build_time + stats->relabel_time,
+        stats->parse_time, stats->build_time, stats->relabel_time);
+    printf("calculate_topology: %f secs\n", stats->sort_time);
+    printf("write_topology_to_file: %f secs\n", stats->write_time);
+    if (c != NULL) {
+        printf("Nodes processed: %ld\n", c->nodes_processed);
+        printf("Edges relaxed: %ld\n", c->edges_relaxed);
+        printf("Queue high-water: %ld\n", c->queue_high_water);
+    } else {
+        printf("Calculation counters are disabled, build with STATS=1 to enable them.\n");
+    }
+}
+
+// This function adds a Graph to the batch. Its Topology matrix is written in the output
+// directory under the input file name, or under the given output file name, which is
+// relative to the output directory unless absolute.
+// Inputs:
+//      const char *input: The Graph input file name.
+//      const char *output: The Topology matrix output file name, NULL for the default one.
+//      const char *output_directory: The output directory.
+// Output:
+//      1 --> Added successfully.
+//      0 --> Something went wrong.
+int add_batch_job(const char *input, const char *output, const char *output_directory)
 {
-    int i, current_node_index;
-    
-    // Push initial nodes(0 dependencies) to Queue.
-    topology_matrix_index = 0;
-    for (i = 0; i < nodes_count; i++) {
-        if (dependencies_matrix[i] != 0) {
+    batch_job *job;
+    if (jobs_count == jobs_allocated) {
+        int allocated = jobs_allocated > 0 ? 2 * jobs_allocated : 64;
+        batch_job *grown = (batch_job*)realloc(jobs, allocated * sizeof(batch_job));
+        if (grown == NULL) {
+            return 0;
+        }
+        jobs = grown;
+        jobs_allocated = allocated;
+    }
+
+    job = &jobs[jobs_count];
+    memset(job, 0, sizeof(batch_job));
+    job->input = strdup(input);
+    if (output != NULL && output[0] == '/') {
+        job->output = strdup(output);
+    } else {
+        const char *name = output;
+        if (name == NULL) {
+            name = strrchr(input, '/');
+            name = name != NULL ? name + 1 : input;
+        }
+        job->output = (char*)malloc(strlen(output_directory) + strlen(name) + 2);
+        if (job->output != NULL) {
+            sprintf(job->output, "%s/%s", output_directory, name);
+        }
+    }
+    if (job->input == NULL || job->output == NULL) {
+        free(job->input);
+        free(job->output);
+        return 0;
+    }
+    jobs_count++;
+
+    return 1;
+}
+
+// This function reads the batch Graphs from a manifest file, one "<input-file> [<output-file>]"
+// line per Graph. Empty lines and lines starting with # are skipped.
+// Inputs:
+//      const char *manifest_filename: The manifest file name.
+//      const char *output_directory: The output directory.
+// Output:
+//      1 --> Read successfully.
+//      0 --> Something went wrong.
+int read_manifest(const char *manifest_filename, const char *output_directory)
+{
+    char *line = NULL, *input, *output;
+    size_t length = 0;
+    int added = 1;
+    FILE *manifest = fopen(manifest_filename, "r");
+    if (manifest == NULL) {
+        printf("Cannot open manifest file %s.\n", manifest_filename);
+        return 0;
+    }
+
+    while (added && getline(&line, &length, manifest) != -1) {
+        input = strtok(line, " \t\r\n");
+        if (input == NULL || input[0] == '#') {
             continue;
         }
-        if (push_value(i) == -1) {
-            printf("Could not allocate memory.\n");
-            exit(0);
+        output = strtok(NULL, " \t\r\n");
+        added = add_batch_job(input, output, output_directory);
+    }
+    free(line);
+    fclose(manifest);
+    if (!added) {
+        printf("Failed to allocate memory for the batch.\n");
+    }
+
+    return added;
+}
+
+// This function reads the batch Graphs from a directory, one per regular file in name order,
+// hidden files excluded.
+// Inputs:
+//      const char *input_directory: The input directory.
+//      const char *output_directory: The output directory.
+// Output:
+//      1 --> Read successfully.
+//      0 --> Something went wrong.
+int read_directory(const char *input_directory, const char *output_directory)
+{
+    struct dirent **entries;
+    struct stat status;
+    char path[4096];
+    int i, added = 1, count = scandir(input_directory, &entries, NULL, alphasort);
+    if (count < 0) {
+        printf("Cannot open input directory %s.\n", input_directory);
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", input_directory, entries[i]->d_name);
+        if (added && entries[i]->d_name[0] != '.' && stat(path, &status) == 0 && S_ISREG(status.st_mode)) {
+            added = add_batch_job(path, NULL, output_directory);
         }
+        free(entries[i]);
     }
-    
-    // While the Queue is not empty...
-    current_node_index = pop_value(); // Retrieve Queue head
-    while (current_node_index != -1) {
-        for (i=0; i<nodes_count; i++) {
-            if (matrix[current_node_index][i] != 1) {
-                continue;
-            }
-            // Remove current node dependencies and check
-            // if dependent nodes can be pushed to Queue.
-            dependencies_matrix[i]--;
-            if (dependencies_matrix[i] != 0) {
-                continue;
-            }
-            // Push node to Queue.
-            if (push_value(i) == -1) {
-                printf("Could not allocate memory.\n");
-                exit(0);
+    free(entries);
+    if (!added) {
+        printf("Failed to allocate memory for the batch.\n");
+    }
+
+    return added;
+}
+
+// This function sorts a Graph of the batch and writes its Topology matrix,
+// with the sort context of the calling Thread.
+// Inputs:
+//      toposort_context *context: The sort context.
+//      batch_job *job: The batch job.
+void run_batch_job(toposort_context *context, batch_job *job)
+{
+    FILE *output;
+    job->sorted = toposort_load_file(context, job->input) && toposort_sort(context);
+    if (job->sorted) {
+        output = fopen(job->output, "w");
+        if (output == NULL) {
+            printf("%s: Cannot open output file %s.\n", job->input, job->output);
+            job->sorted = 0;
+        } else {
+            job->sorted = toposort_write(context, output, output_format);
+            if (fclose(output) != 0 || !job->sorted) {
+                printf("%s: Failed to write Topology Matrix to output file %s.\n", job->input, job->output);
+                job->sorted = 0;
             }
         }
-        // Insert current node index to Topology matrix.
-        topology_matrix[topology_matrix_index] = current_node_index;
-        topology_matrix_index++;
-        // Retrieve next node(Queue head) to process.
-        current_node_index = pop_value();
+    } else {
+        printf("%s: %s\n", job->input, toposort_error(context));
+    }
+    toposort_get_stats(context, &job->stats);
+}
+
+// This Thread function claims the batch jobs one at a time, until none is left.
+// Inputs:
+//      void *arg: The Thread ID.
+void *thread_run_batch(void *arg)
+{
+    toposort_context *context = contexts[(long)arg];
+    int j;
+    while ((j = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < jobs_count) {
+        run_batch_job(context, &jobs[j]);
+    }
+
+    return (NULL);
+}
+
+// This function prints the batch report: the Graphs sorted, the throughput and the peak
+// resident memory, followed by the total time of each phase over all Graphs, when
+// the statistics report is requested.
+// Inputs:
+//      double elapsed: The batch wall-clock time.
+//      long peak_memory: Peak resident memory in KB.
+void print_batch_stats(double elapsed, long peak_memory)
+{
+    long nodes = 0, edges = 0;
+    int sorted = 0;
+    double parse = 0, build = 0, relabel_time = 0, sort = 0, write = 0;
+    for (int j = 0; j < jobs_count; j++) {
+        if (jobs[j].sorted) {
+            sorted++;
+            nodes += jobs[j].stats.nodes_count;
+            edges += jobs[j].stats.edges_count;
+        }
+        parse += jobs[j].stats.parse_time;
+        build += jobs[j].stats.build_time;
+        relabel_time += jobs[j].stats.relabel_time;
+        sort += jobs[j].stats.sort_time;
+        write += jobs[j].stats.write_time;
+    }
+    if (elapsed <= 0) {
+        elapsed = 1e-9;
+    }
+
+    printf("Graphs sorted: %d of %d\n", sorted, jobs_count);
+    printf("Nodes sorted: %ld\n", nodes);
+    printf("Edges sorted: %ld\n", edges);
+    printf("Batch time: %f secs\n", elapsed);
+    printf("Throughput: %f Graphs/sec, %f nodes/sec, %f edges/sec\n", sorted / elapsed, nodes / elapsed, edges / elapsed);
+    printf("Peak memory: %ld KB\n", peak_memory);
+    if (stats_format == STATS_JSON) {
+        printf("{\"graphs\": %d, \"sorted\": %d, \"failed\": %d, \"threads\": %d, \"nodes\": %ld, \"edges\": %ld, \"elapsed_secs\": %f, ",
+            jobs_count, sorted, jobs_count - sorted, jobs_threads, nodes, edges, elapsed);
+        printf("\"graphs_per_sec\": %f, \"nodes_per_sec\": %f, \"edges_per_sec\": %f, ", sorted / elapsed, nodes / elapsed, edges / elapsed);
+        printf("\"phases\": {\"parse_secs\": %f, \"build_secs\": %f, \"relabel_secs\": %f, \"calculate_topology_secs\": %f, \"write_topology_secs\": %f}, ",
+            parse, build, relabel_time, sort, write);
+        printf("\"peak_rss_kb\": %ld}\n", peak_memory);
+    } else if (stats_format == STATS_TEXT) {
+        printf("Statistics(all Graphs, %d Threads):\n", jobs_threads);
+        printf("initialize: %f secs(parse %f, build %f, relabel %f)\n", parse + build + relabel_time, parse, build, relabel_time);
+        printf("calculate_topology: %f secs\n", sort);
+        printf("write_topology_to_file: %f secs\n", write);
+    }
+}
+
+// This function sorts a batch of Graphs, listed in a manifest file or found in a directory.
+// Whole Graphs are scheduled across the Threads, each one with a sort context
+// whose buffers are reused between its Graphs.
+// Inputs:
+//      const char *input: The manifest file or input directory.
+//      const char *output_directory: The output directory.
+// Output:
+//      The program exit status.
+int run_batch(const char *input, const char *output_directory)
+{
+    struct stat status;
+    struct timespec start, finish;
+    struct rusage usage;
+    pthread_t *tid;
+    long t;
+    int read, failed = 0;
+    if (stat(input, &status) != 0) {
+        printf("Cannot open input file %s.\n", input);
+        return -1;
+    }
+    if (S_ISDIR(status.st_mode)) {
+        struct stat output_status;
+        // Topology matrices take the input file names, they must not replace the Graphs.
+        if (stat(output_directory, &output_status) == 0 && output_status.st_dev == status.st_dev && output_status.st_ino == status.st_ino) {
+            printf("Output directory must differ from the input directory.\n");
+            return -1;
+        }
+        read = read_directory(input, output_directory);
+    } else {
+        read = read_manifest(input, output_directory);
+    }
+    if (read && mkdir(output_directory, 0777) != 0 && (stat(output_directory, &status) != 0 || !S_ISDIR(status.st_mode))) {
+        printf("Cannot create output directory %s.\n", output_directory);
+        read = 0;
+    }
+
+    if (jobs_threads > jobs_count) {
+        jobs_threads = jobs_count > 0 ? jobs_count : 1;
+    }
+    tid = (pthread_t*)malloc(jobs_threads * sizeof(pthread_t));
+    contexts = (toposort_context**)calloc(jobs_threads, sizeof(toposort_context*));
+    for (t = 0; read && t < jobs_threads; t++) {
+        if (tid == NULL || contexts == NULL || (contexts[t] = toposort_create(1)) == NULL) {
+            printf("Failed to allocate memory for the sort contexts.\n");
+            read = 0;
+            break;
+        }
+        toposort_set_layout(contexts[t], graph_layout);
+        toposort_set_mem_limit(contexts[t], mem_limit);
+        toposort_set_order(contexts[t], order);
+        toposort_set_relabel(contexts[t], relabel);
+    }
+
+    if (read) {
+        printf("Graphs count: %d\n", jobs_count);
+        printf("Threads that will be used: %d\n", jobs_threads);
+        printf("Algorithm started, please wait...\n");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (t = 0; t < jobs_threads; t++) {
+            pthread_create(&tid[t], NULL, thread_run_batch, (void*)t);
+        }
+        for (t = 0; t < jobs_threads; t++) {
+            pthread_join(tid[t], NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &finish);
+        printf("Algorithm finished!\n");
+
+        getrusage(RUSAGE_SELF, &usage);
+        print_batch_stats(finish.tv_sec - start.tv_sec + (finish.tv_nsec - start.tv_nsec) * 1e-9, usage.ru_maxrss);
+    }
+
+    for (t = 0; contexts != NULL && t < jobs_threads; t++) {
+        toposort_destroy(contexts[t]);
     }
+    for (int j = 0; j < jobs_count; j++) {
+        failed += !jobs[j].sorted;
+        free(jobs[j].input);
+        free(jobs[j].output);
+    }
+    free(contexts);
+    free(tid);
+    free(jobs);
+    printf("Program terminates.\n");
 
-    free(matrix);
-    free(dependencies_matrix);
+    return read && failed == 0 ? 0 : -1;
 }
 
-// This function writes the Topology matrix to the output file.
-// First line contains the nodes count.
-// Last line contains -1 as EOF char.
-void write_topology_to_file()
+// This function writes the schedule calculated along the Topology matrix to the schedule file,
+// and reports the critical path.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int write_schedule()
 {
-    fprintf(fout, "%d\n", nodes_count);
-    for (int i = 0; i < nodes_count; i++) {
-        fprintf(fout, "%d\n", topology_matrix[i]);            
+    toposort_stats stats;
+    int written;
+    FILE *fschedule = fopen(schedule_filename, "w");
+    if (fschedule == NULL) {
+        printf("Cannot open schedule file %s.\n", schedule_filename);
+        return 0;
+    }
+    written = toposort_write_schedule(ctx, fschedule);
+    if (fclose(fschedule) != 0 || !written) {
+        printf("Failed to write schedule to file.\n");
+        return 0;
     }
-    fprintf(fout, "-1");
-    free(topology_matrix);
+
+    toposort_get_stats(ctx, &stats);
+    printf("Critical path: %.9g over %d nodes, %d levels\n", stats.critical_path_length, stats.critical_path_nodes, stats.levels_count);
+
+    return 1;
+}
+
+// This function releases the sort context and closes the output file, before the program terminates.
+// Inputs:
+//      int status: The program exit status.
+// Output:
+//      The program exit status.
+int terminate(int status)
+{
+    toposort_destroy(ctx);
+    if (fout != NULL) {
+        fclose(fout);
+    }
+    printf("Program terminates.\n");
+
+    return status;
 }
 
 int main(int argc, char **argv)
 {
+    toposort_stats stats;
+    int sorted;
     // Run-time parameters check.
-    if (!read_parameters(argv)) {
+    if (!read_parameters(argc, argv)) {
         printf("Program terminates.\n");
-        return -1;    
+        return -1;
     }
-
-    // Retrieve Graph nodes count.
-    int fscanf_result = fscanf(fin, "%d \n", &nodes_count);
-    if (fscanf_result == 1 && nodes_count == 0) {
-        printf("File is empty.\n");
-        fclose(fin);
+    if (batch_mode) {
+        return run_batch(argv[1], argv[2]);
+    }
+    ctx = toposort_create(1);
+    if (ctx == NULL) {
+        printf("Failed to allocate memory for the sort context.\n");
         fclose(fout);
         printf("Program terminates.\n");
-        return 0;
+        return -1;
     }
+    toposort_set_log(ctx, stdout);
+    toposort_set_layout(ctx, graph_layout);
+    toposort_set_schedule(ctx, schedule_filename != NULL);
+    toposort_set_order(ctx, order);
+    toposort_set_relabel(ctx, relabel);
+    toposort_set_mem_limit(ctx, mem_limit);
+    toposort_set_check_order(ctx, check_order);
 
-    printf("Nodes count: %d\n", nodes_count);
+    // Load the Graph adjacency and Dependencies matrix, by reading the input file or generating it.
     printf("Algorithm started, please wait...\n");
-    // Initializes the Graph matrix and Dependencies matrix, by reading the input file.
-    if (!initialize()) {
-        printf("Failed to allocate memory during initialization.\n");
-        return -1;
+    if (!toposort_load_file(ctx, argv[1])) {
+        printf("%s\n", toposort_error(ctx));
+        return terminate(-1);
+    }
+    if (toposort_nodes_count(ctx) == 0) {
+        printf("File is empty.\n");
+        return terminate(0);
+    }
+    toposort_get_stats(ctx, &stats);
+    printf("Nodes count: %d\n", stats.nodes_count);
+    printf("Edges count: %ld\n", stats.edges_count);
+    printf("Graph layout: %s\n", toposort_layout_name(stats.layout));
+    if (stats.adjacency_bytes > 0) {
+        printf("Adjacency size: %ld bytes\n", stats.adjacency_bytes);
+    }
+    if (stats.index_width > 0) {
+        printf("Node index width: %d bits\n", stats.index_width);
+    }
+
+    // Calculate graphs Topology order, or repair the previous one after the edges delta.
+    if (previous_order_filename != NULL) {
+        sorted = toposort_repair(ctx, previous_order_filename, delta_filename);
+    } else {
+        sorted = toposort_sort(ctx);
+    }
+    toposort_get_stats(ctx, &stats);
+    if (previous_order_filename != NULL && sorted) {
+        printf("Incremental update: %d edges inserted, %d removed, %d rejected, %d not found, %ld nodes reordered.\n",
+            stats.inserted, stats.removed, stats.rejected, stats.missing, stats.reordered);
     }
-    clock_t t1 = clock();
-    // Calculate graphs Topology order.
-    calculate_topology();
-    clock_t t2 = clock();
     printf("Algorithm finished!\n");
-    printf("Time spend: %f secs\n", ((float)t2 -t1) / CLOCKS_PER_SEC);
+    printf("Time spend: %f secs\n", stats.sort_time);
+    if (!sorted) {
+        // A Graph with a cycle cannot be sorted, report it instead of writing a truncated order.
+        printf("%s\n", toposort_error(ctx));
+        if (previous_order_filename == NULL && !toposort_report_cycle(ctx)) {
+            printf("%s\n", toposort_error(ctx));
+        }
+        return terminate(-1);
+    }
     printf("Writing Topology Matrix to output file.\n");
     // Write the Topology matrix to the output file.
-    write_topology_to_file();
+    if (!toposort_write(ctx, fout, output_format)) {
+        printf("Failed to write Topology Matrix to output file.\n");
+        return terminate(-1);
+    }
+    if (schedule_filename != NULL && !write_schedule()) {
+        return terminate(-1);
+    }
+    toposort_get_stats(ctx, &stats);
 
-    fclose(fin);
-    fclose(fout);
-    printf("Program terminates.\n");
+    // Report the phases wall-clock times and the peak resident memory.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Parse time: %f secs\n", stats.parse_time);
+    printf("Build time: %f secs\n", stats.build_time);
+    if (relabel != TOPOSORT_RELABEL_NONE) {
+        printf("Relabel time: %f secs(%s order)\n", stats.relabel_time, toposort_relabel_name(relabel));
+    }
+    printf("Sort time: %f secs\n", stats.sort_time);
+    printf("Write time: %f secs\n", stats.write_time);
+    printf("Peak memory: %ld KB\n", usage.ru_maxrss);
+    if (stats_format != STATS_NONE) {
+        print_stats(&stats, usage.ru_maxrss);
+    }
 
-    return 0;
+    return terminate(0);
 }
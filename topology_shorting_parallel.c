@@ -3,10 +3,12 @@
 // This program implements a Topology sorting algorithm,
 // based on Kahn's algorithm(https://en.wikipedia.org/wiki/Topological_sorting).
 // In this version, POSIX Threads standard is used for parallelizing the algorithm.
-// Directed Acyclic Graph(DAG) is read from an input file created by RandomGraph generator 
-// by S.Pettie and V.Ramachandran using the following arguments: 
+// Directed Acyclic Graph(DAG) is read from an input file created by RandomGraph generator
+// by S.Pettie and V.Ramachandran using the following arguments:
 // ./RandomGraph directed_grph_<N> <N> 2 1 <N/2>
 // where N is the Graph nodes count we want to generate.
+// The algorithm is implemented by libtoposort(toposort.h), driven here through
+// a sort context with the given Threads count and one of its parallel engines.
 //
 // Author: Angelos Stamatiou, March 2020
 //
@@ -14,144 +16,141 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
-#include <pthread.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "toposort.h"
 
-// Queue node structure.
-typedef struct node {
-    int val;
-    struct node *next;
-} node;
+#define STATS_NONE 0        // No statistics report.
+#define STATS_TEXT 1        // Statistics report printed as text.
+#define STATS_JSON 2        // Statistics report printed as JSON.
 
-node *head;                // Queue head node.
-node *tail;                // Queue tail node.
-FILE *fin;                 // Input file.
-FILE *fout;                // Output file.
-int nodes_count;           // Graph nodes count.
-int **matrix;              // Graph nodes matrix.
-int *dependencies_matrix;  // Graph nodes dependencies matrix.
-int *topology_matrix;      // Graph nodes topology matrix.
-int topology_matrix_index; // Graph nodes topology matrix index.
+FILE *fout;
+toposort_context *ctx;     // Sort context.
 int threads_count;
-pthread_mutex_t mutex;
+int engine;                // Parallel engine used for the calculation.
+int graph_layout;          // Graph adjacency layout requested.
+int stats_format;          // Statistics report format.
+int output_format;         // Topology matrix output file format.
+char *schedule_filename;   // Schedule mode output file, NULL unless the schedule is calculated.
+int order;                 // Topology matrix order requested.
+int relabel;               // Nodes relabeling requested.
+int affinity;              // Threads placement requested.
 
-// This function inserts a given value at the end of a given Queue.
+// Auxiliary function that displays a message in case of wrong input parameters.
 // Inputs:
-//      node **queue_head: Queue head node.
-//      node **queue_tail: Queue tail node.
-//      int val: The value to insert.
-int push_value(node **queue_head, node **queue_tail, int val)
+//      char *compiled_name: Programs compiled name.
+void syntax_message(char *compiled_name)
 {
-    node *new_node = (node*) malloc(sizeof(node));
-    if (new_node == NULL) {
-        return -1;
-    }
-
-    new_node->val = val;
-    new_node->next = NULL;
-    if (*queue_head == NULL) {
-        *queue_head = new_node;
-        *queue_tail = new_node;
-        return 0;
-    }
-
-    (*queue_tail)->next = new_node;
-    *queue_tail = new_node;
-
-    return 0;
+    printf("Correct syntax:\n");
+    printf("%s <threads_count> <input-file> <output-file> [options]\n", compiled_name);
+    printf("where: \n");
+    printf("<threads_count> is the number of threads that will be created.\n");
+    printf("<input-file> is the file containing a generated directed Graph by RandomGraph that the algorithm will use,\n");
+    printf("             or gen:<spec> to generate a synthetic Graph in memory, e.g. gen:nodes=100000,density=0.001,shape=layered.\n");
+    printf("<output-file> is the file Topology Matrix will be written.\n");
+    printf("options:\n");
+    printf("--layout=auto|csr|bitset|compressed selects the Graph adjacency layout, auto picks bitset for edge density above 5%%,\n");
+    printf("             compressed stores each node sorted targets as varint encoded gaps.\n");
+    printf("--engine=level|steal|hybrid selects the parallel engine, level(default) is lock-free and level-synchronous, steal uses per Thread work-stealing deques,\n");
+    printf("             hybrid is level-synchronous, pulling the frontiers whose out-edges exceed half the unsorted nodes dependencies instead of pushing them.\n");
+    printf("--output-format=text|binary|binary64 writes the Topology Matrix as text(default), or as a binary int32 or int64 array.\n");
+    printf("--deterministic=level|lex writes a canonical Topology Matrix, the same for any Threads count: level by level,\n");
+    printf("             each level sorted by node(level), or the lexicographically smallest one(lex, calculated serially).\n");
+    printf("--relabel=bfs|rcm|degree relabels the nodes for locality before sorting, in breadth-first, reverse Cuthill-McKee\n");
+    printf("             or decreasing degree order, the Topology Matrix being written with the original nodes.\n");
+    printf("--affinity=none|compact|scatter pins the Threads to CPUs, filling each NUMA node in turn(compact) or spreading\n");
+    printf("             them over the NUMA nodes(scatter), and first touches the Graph buffers from the pinned Threads.\n");
+    printf("--schedule=<schedule-file> also calculates the nodes earliest start times and levels from the edges weights,\n");
+    printf("             and the critical path, written to the schedule file.\n");
+    printf("--stats|--stats=json prints the phases times and, when built with STATS=1, the per Thread counters.\n");
 }
 
-// This function returns the head value of a given Queue.
-// It will also move the head of the Queue to the next
-// node, if it exists.
+// This function reads the optional run-time parameters, following the positional ones.
 // Inputs:
-//      node **queue_head: Queue head node.
-//      node **queue_tail: Queue tail node.
-// Output:
-//      retval --> Queue head value.
-//      -1     --> Queue is empty.
-int pop_value(node **queue_head, node **queue_tail)
-{
-    if (*queue_head == NULL) {
-        return -1;
-    }
-    int retval = (*queue_head)->val;
-    node *new_head = (*queue_head)->next;
-    free(*queue_head);
-    if (new_head == NULL) {
-        *queue_head = NULL;
-        *queue_tail = NULL;
-    } else {
-        *queue_head = new_head;    
-    }
-    
-    return retval;
-}
-
-// This function initializes the Graph matrix and Dependencies matrix, by reading the input file.
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
+//      int first: The first optional parameter index.
 // Output:
-//      1 --> Initialized successfully.
+//      1 --> Options read successfully.
 //      0 --> Something went wrong.
-int initialize()
+int read_options(int argc, char **argv, int first)
 {
-    int i,j,fscanf_result;
-    double w;
-    head = NULL;
-    tail = NULL;
-    matrix = (int**)malloc(sizeof(int*) * nodes_count + sizeof(int) * nodes_count * nodes_count);
-    dependencies_matrix = (int*)malloc(sizeof(int*) * nodes_count);
-    topology_matrix = (int*)malloc(sizeof(int*) * nodes_count);
-    if ((matrix == NULL)  || (dependencies_matrix == NULL) || (topology_matrix == NULL)) {
-        return 0;
-    }
-
-    int *ptr = (int*)(matrix + nodes_count);
-    for(i = 0; i < nodes_count; i++) {
-        matrix[i] = (ptr + nodes_count * i);
-        dependencies_matrix[i] = 0;
-        topology_matrix[i] = 0;    
-        for (j = 0; j < nodes_count; j++) {
-            matrix[i][j] = 0;            
+    int i;
+    graph_layout = TOPOSORT_LAYOUT_AUTO;
+    engine = TOPOSORT_ENGINE_LEVEL;
+    stats_format = STATS_NONE;
+    output_format = TOPOSORT_OUTPUT_TEXT;
+    schedule_filename = NULL;
+    order = TOPOSORT_ORDER_ANY;
+    relabel = TOPOSORT_RELABEL_NONE;
+    affinity = TOPOSORT_AFFINITY_NONE;
+    for (i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--layout=auto") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_AUTO;
+        } else if (strcmp(argv[i], "--layout=csr") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_CSR;
+        } else if (strcmp(argv[i], "--layout=bitset") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_BITSET;
+        } else if (strcmp(argv[i], "--layout=compressed") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_COMPRESSED;
+        } else if (strcmp(argv[i], "--engine=level") == 0) {
+            engine = TOPOSORT_ENGINE_LEVEL;
+        } else if (strcmp(argv[i], "--engine=steal") == 0) {
+            engine = TOPOSORT_ENGINE_STEAL;
+        } else if (strcmp(argv[i], "--engine=hybrid") == 0) {
+            engine = TOPOSORT_ENGINE_HYBRID;
+        } else if (strcmp(argv[i], "--output-format=text") == 0) {
+            output_format = TOPOSORT_OUTPUT_TEXT;
+        } else if (strcmp(argv[i], "--output-format=binary") == 0) {
+            output_format = TOPOSORT_OUTPUT_BINARY;
+        } else if (strcmp(argv[i], "--output-format=binary64") == 0) {
+            output_format = TOPOSORT_OUTPUT_BINARY64;
+        } else if (strcmp(argv[i], "--deterministic=level") == 0) {
+            order = TOPOSORT_ORDER_LEVEL;
+        } else if (strcmp(argv[i], "--deterministic=lex") == 0) {
+            order = TOPOSORT_ORDER_LEX;
+        } else if (strcmp(argv[i], "--relabel=bfs") == 0) {
+            relabel = TOPOSORT_RELABEL_BFS;
+        } else if (strcmp(argv[i], "--relabel=rcm") == 0) {
+            relabel = TOPOSORT_RELABEL_RCM;
+        } else if (strcmp(argv[i], "--relabel=degree") == 0) {
+            relabel = TOPOSORT_RELABEL_DEGREE;
+        } else if (strcmp(argv[i], "--affinity=none") == 0) {
+            affinity = TOPOSORT_AFFINITY_NONE;
+        } else if (strcmp(argv[i], "--affinity=compact") == 0) {
+            affinity = TOPOSORT_AFFINITY_COMPACT;
+        } else if (strcmp(argv[i], "--affinity=scatter") == 0) {
+            affinity = TOPOSORT_AFFINITY_SCATTER;
+        } else if (strncmp(argv[i], "--schedule=", 11) == 0) {
+            schedule_filename = argv[i] + 11;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_format = STATS_TEXT;
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            stats_format = STATS_JSON;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            return 0;
         }
-    }            
-    fscanf_result = fscanf(fin, "%d", &i);
-    while(fscanf_result != 1 || i != -1) {
-        fscanf_result = fscanf(fin, "%d %lf \n", &j, &w);
-        matrix[i][j] = 1;
-        dependencies_matrix[j]++;    
-        fscanf_result = fscanf(fin, "%d", &i);
     }
 
     return 1;
 }
 
-// Auxiliary function that displays a message in case of wrong input parameters.
-// Inputs:
-//      char *compiled_name: Programs compiled name.
-void syntax_message(char *compiled_name)
-{
-    printf("Correct syntax:\n");
-    printf("%s <threads_count> <input-file> <output-file>\n", compiled_name);
-    printf("where: \n");
-    printf("<threads_count> is the number of threads that will be created.\n");
-    printf("<input-file> is the file containing a generated directed Graph by RandomGraph that the algorithm will use.\n");
-    printf("<output-file> is the file Topology Matrix will be written.\n");
-}
-
 // This function checks run-time parameters validity and
 // retrieves Threads count value, input and output file names.
 // Inputs:
+//      int argc: The run-time parameters count.
 //      char **argv: The run-time parameters.
 // Output:
 //      1 --> Parameters read successfully.
 //      0 --> Something went wrong.
-int read_parameters(char **argv)
+int read_parameters(int argc, char **argv)
 {
     char *threads_count_string = argv[1];
     if (threads_count_string == NULL) {
         printf("Threads count parameter missing.\n");
         syntax_message(argv[0]);
-        return 0;        
+        return 0;
     }
 
     threads_count = atoi(threads_count_string);
@@ -168,12 +167,6 @@ int read_parameters(char **argv)
         return 0;
     }
 
-    fin = fopen(input_filename, "r");
-    if (fin == NULL) {
-        printf("Cannot open input file %s.\n", input_filename);
-        return 0;        
-    }
-
     char *output_filename = argv[3];
     if (output_filename == NULL) {
         printf("Output file parameter missing.\n");
@@ -184,212 +177,210 @@ int read_parameters(char **argv)
     fout = fopen(output_filename, "w");
     if (fout == NULL) {
         printf("Cannot open output file %s.\n", output_filename);
-        return 0;        
+        return 0;
+    }
+
+    if (!read_options(argc, argv, 4)) {
+        syntax_message(argv[0]);
+        return 0;
+    }
+    if (engine == TOPOSORT_ENGINE_HYBRID && order == TOPOSORT_ORDER_ANY
+        && (schedule_filename != NULL || (graph_layout != TOPOSORT_LAYOUT_AUTO && graph_layout != TOPOSORT_LAYOUT_CSR))) {
+        printf("Hybrid engine requires the csr layout, and cannot calculate a schedule.\n");
+        return 0;
     }
 
     printf("Calculating Topology sorting of Graph.\n");
     printf("Threads that will be used: %d\n", threads_count);
-    printf("Graph will be retrieved from input file: %s\n", input_filename);
+    if (order != TOPOSORT_ORDER_ANY) {
+        printf("Deterministic order: %s\n", toposort_order_name(order));
+    } else {
+        printf("Parallel engine: %s\n", toposort_engine_name(engine));
+    }
+    printf("Graph will be %s: %s\n", strncmp(input_filename, "gen:", 4) == 0 ? "generated from specification" : "retrieved from input file", input_filename);
     printf("Topology Matrix will be written in output file: %s\n", output_filename);
 
     return 1;
 }
 
-// This Thread function pushes initial nodes(0 dependencies) to Queue.
-// Each Thread uses a local Queue, in order to minimize mutex usage.
+// This function prints the statistics report: the phases wall-clock times and,
+// when the instrumentation counters are compiled in, the per Thread counters.
 // Inputs:
-//      void *thread_id: The Thread ID.
-void *initialize_queue(void *thread_id)
+//      const toposort_stats *stats: The sort context statistics.
+//      long peak_memory: Peak resident memory in KB.
+void print_stats(const toposort_stats *stats, long peak_memory)
 {
-    int i;
-    long id = (long) thread_id;
-    node *thread_head = NULL;                    // Thread Queue head.
-    node *thread_tail = NULL;                    // Thread Queue tail.
-    node *temp_node = NULL;                      // Temporary pointer for removals.
-    int interval = nodes_count / threads_count;  // Each thread will process interval nodes.
-    int remainder = nodes_count % threads_count; // Remaining nodes will be distributed evenly among threads.
-    int start = id * interval;
-    int finish = start + interval;
-
-    // Process assigned nodes.
-    for (i = start; i < finish; i++) {
-        if (dependencies_matrix[i] != 0) {
-            continue;
+    const char *engine_name = toposort_engine_name(stats->engine);
+    if (stats_format == STATS_JSON) {
+        printf("{\"nodes\": %d, \"edges\": %ld, \"threads\": %d, \"engine\": \"%s\", \"layout\": \"%s\", ",
+            stats->nodes_count, stats->edges_count, stats->threads_count, engine_name, toposort_layout_name(stats->layout));
+        printf("\"phases\": {\"initialize_secs\": %f, \"parse_secs\": %f, \"build_secs\": %f, \"relabel_secs\": %f, \"calculate_topology_secs\": %f, \"write_topology_secs\": %f}, ",
+            stats->parse_time + stats->build_time + stats->relabel_time, stats->parse_time, stats->build_time, stats->relabel_time, stats->sort_time, stats->write_time);
+        printf("\"push_levels\": %d, \"pull_levels\": %d, \"peak_rss_kb\": %ld, ", stats->push_levels, stats->pull_levels, peak_memory);
+        if (stats->counters == NULL) {
+            printf("\"counters\": null}\n");
+            return;
         }
-        // Each Thread pushes the node to its local Queue.
-        if (push_value(&thread_head, &thread_tail, i) == -1) {
-            printf("Could not allocate memory.\n");
-            exit(0);
+        printf("\"counters\": [");
+        for (int t = 0; t < stats->threads_count; t++) {
+            const toposort_counters *c = &stats->counters[t];
+            printf("%s{\"thread\": %d, \"nodes_processed\": %ld, \"edges_relaxed\": %ld, \"atomic_ops\": %ld, \"cas_failures\": %ld, "
+                "\"lock_contended\": %ld, \"steals\": %ld, \"failed_steals\": %ld, \"queue_high_water\": %ld, \"idle_secs\": %f}",
+                t > 0 ? ", " : "", t, c->nodes_processed, c->edges_relaxed, c->atomic_ops, c->cas_failures,
+                c->lock_contended, c->steals, c->failed_steals, c->queue_high_water, c->idle_time);
         }
+        printf("]}\n");
+        return;
     }
 
-    // Process remaining node.
-    if (id < remainder) {
-        i = nodes_count - id - 1;
-        if (dependencies_matrix[i] == 0) {
-            if (push_value(&thread_head, &thread_tail, i) == -1) {
-                printf("Could not allocate memory.\n");
-                exit(0);
-            }
-        }
+    printf("Statistics(%s engine, %d Threads):\n", engine_name, stats->threads_count);
+    printf("initialize: %f secs(parse %f, build %f, relabel %f)\n", stats->parse_time + stats->build_time + stats->relabel_time,
+        stats->parse_time, stats->build_time, stats->relabel_time);
+    printf("calculate_topology: %f secs\n", stats->sort_time);
+    if (stats->engine == TOPOSORT_ENGINE_HYBRID) {
+        printf("Hybrid frontiers: %d pushed, %d pulled\n", stats->push_levels, stats->pull_levels);
     }
-
-    // If the Thread local Queue is not empty, it pushes its nodes to the global Queue.
-    if (thread_head == NULL) {
-        return (NULL);
+    printf("write_topology_to_file: %f secs\n", stats->write_time);
+    if (stats->counters == NULL) {
+        printf("Thread counters are disabled, build with STATS=1 to enable them.\n");
+        return;
     }
-
-    pthread_mutex_lock(&mutex);
-
-    while (thread_head != NULL) {
-        if (push_value(&head, &tail, thread_head->val) == -1) {
-            printf("Could not allocate memory.\n");
-            exit(0);
-        }
-        temp_node = thread_head->next;
-        free(thread_head);
-        thread_head = temp_node;
+    printf("%6s %12s %12s %12s %10s %10s %10s %10s %10s %10s\n", "Thread", "Nodes", "Edges", "Atomics",
+        "CAS fails", "Lock cont.", "Steals", "Failed", "High-water", "Idle secs");
+    for (int t = 0; t < stats->threads_count; t++) {
+        const toposort_counters *c = &stats->counters[t];
+        printf("%6d %12ld %12ld %12ld %10ld %10ld %10ld %10ld %10ld %10.6f\n", t, c->nodes_processed, c->edges_relaxed,
+            c->atomic_ops, c->cas_failures, c->lock_contended, c->steals, c->failed_steals, c->queue_high_water, c->idle_time);
     }
-    pthread_mutex_unlock(&mutex);
-
-    return (NULL);
 }
 
-// This Thread function calculates the nodes Topology.
-// Each Thread uses a local Queue, in order to minimize mutex usage.
-void *thread_topology_calculation()
-{
-    int i, current_node_index;
-    node *thread_head = NULL;
-    node *thread_tail = NULL;
-    node *temp_node = NULL;
-    
-    // While not all Nodes have been sorted...
-    while (topology_matrix_index != nodes_count) {
-        pthread_mutex_lock(&mutex);
-        // If the Thread local Queue is not empty, process it. 
-        if (thread_head != NULL) {
-            while (thread_head != NULL) {
-                // Remove local Queue head dependencies and check
-                // if dependent nodes can be pushed to global Queue.
-                dependencies_matrix[thread_head->val]--;
-                if (dependencies_matrix[thread_head->val] == 0) {
-                    // Push node to global Queue.
-                    if (push_value(&head, &tail, thread_head->val) == -1) {
-                        printf("Could not allocate memory.\n");
-                        exit(0);
-                    }
-                }
-                temp_node = thread_head->next;
-                free(thread_head);
-                thread_head = temp_node;
-            }
-        }
-        // Retrieve global Queue head.
-        current_node_index = pop_value(&head, &tail);
-        if (current_node_index != -1) {
-            // Insert Thread current node index to Topology matrix.
-            topology_matrix[topology_matrix_index] = current_node_index;
-            topology_matrix_index++;
-        }
-        pthread_mutex_unlock(&mutex);
-        // Check if Thread current node dependent nodes can be pushed to local Queue.
-        if (current_node_index != -1) {
-            for (i=0; i<nodes_count; i++) {
-                if (matrix[current_node_index][i] != 1) {
-                    continue;
-                }
-                if (push_value(&thread_head, &thread_tail, i) == -1) {
-                    printf("Could not allocate memory.\n");
-                    exit(0);
-                }
-            }
-        }
-    }
-
-    return (NULL);
-}
-
-// This function implements a parallel Topology shorting algorithm,
-// based on Kahn's algorithm.
-void calculate_topology()
+// This function writes the schedule calculated along the Topology matrix to the schedule file,
+// and reports the critical path.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int write_schedule()
 {
-    pthread_t *tid;
-    long t;
-
-    // Push initial nodes(0 dependencies) to Queue.
-    tid = (pthread_t*)malloc(threads_count * sizeof(pthread_t));
-    for (t = 0; t < threads_count; t++) {
-        pthread_create(&tid[t], NULL, initialize_queue, (void*)t);
+    toposort_stats stats;
+    int written;
+    FILE *fschedule = fopen(schedule_filename, "w");
+    if (fschedule == NULL) {
+        printf("Cannot open schedule file %s.\n", schedule_filename);
+        return 0;
     }
-    for (t = 0; t < threads_count; t++) {
-        pthread_join(tid[t], NULL);
+    written = toposort_write_schedule(ctx, fschedule);
+    if (fclose(fschedule) != 0 || !written) {
+        printf("Failed to write schedule to file.\n");
+        return 0;
     }
 
-    // Calculate Topology.
-    topology_matrix_index = 0;
-    for (t = 0; t < threads_count; t++) {
-        pthread_create(&tid[t], NULL, thread_topology_calculation, NULL);
-    }
-    for (t = 0; t < threads_count; t++) {
-        pthread_join(tid[t], NULL);
-    }
+    toposort_get_stats(ctx, &stats);
+    printf("Critical path: %.9g over %d nodes, %d levels\n", stats.critical_path_length, stats.critical_path_nodes, stats.levels_count);
 
-    free(matrix);
-    free(dependencies_matrix);
+    return 1;
 }
 
-// This function writes the Topology matrix to the output file.
-// First line contains the nodes count.
-// Last line contains -1 as EOF char.
-void write_topology_to_file()
+// This function releases the sort context and closes the output file, before the program terminates.
+// Inputs:
+//      int status: The program exit status.
+// Output:
+//      The program exit status.
+int terminate(int status)
 {
-    fprintf(fout, "%d\n", nodes_count);
-    for (int i = 0; i < nodes_count; i++) {
-        fprintf(fout, "%d\n", topology_matrix[i]);            
-    }
-    fprintf(fout, "-1");
-    free(topology_matrix);
+    toposort_destroy(ctx);
+    fclose(fout);
+    printf("Program terminates.\n");
+
+    return status;
 }
 
 int main(int argc, char **argv)
 {
+    toposort_stats stats;
+    int sorted;
     // Run-time parameters check.
-    if (!read_parameters(argv)) {
+    if (!read_parameters(argc, argv)) {
         printf("Program terminates.\n");
-        return -1;    
+        return -1;
     }
-
-    // Retrieve Graph nodes count.
-    int fscanf_result = fscanf(fin, "%d \n", &nodes_count);
-    if (fscanf_result == 1 && nodes_count == 0) {
-        printf("File is empty.\n");
-        fclose(fin);
+    ctx = toposort_create(threads_count);
+    if (ctx == NULL) {
+        printf("Failed to allocate memory for the sort context.\n");
         fclose(fout);
         printf("Program terminates.\n");
-        return 0;
+        return -1;
+    }
+    toposort_set_log(ctx, stdout);
+    toposort_set_engine(ctx, engine);
+    toposort_set_layout(ctx, graph_layout);
+    toposort_set_schedule(ctx, schedule_filename != NULL);
+    toposort_set_order(ctx, order);
+    toposort_set_relabel(ctx, relabel);
+    toposort_set_affinity(ctx, affinity);
+    toposort_get_stats(ctx, &stats);
+    if (affinity != TOPOSORT_AFFINITY_NONE) {
+        printf("Thread placement: %s, NUMA nodes: %d\n", toposort_affinity_name(affinity), stats.numa_nodes);
     }
 
-    printf("Nodes count: %d\n", nodes_count);
+    // Load the Graph adjacency and Dependencies matrix, by reading the input file or generating it.
     printf("Algorithm started, please wait...\n");
-    // Initializes the Graph matrix and Dependencies matrix, by reading the input file.
-    if (!initialize()) {
-        printf("Failed to allocate memory during initialization.\n");
-        return -1;
+    if (!toposort_load_file(ctx, argv[2])) {
+        printf("%s\n", toposort_error(ctx));
+        return terminate(-1);
+    }
+    if (toposort_nodes_count(ctx) == 0) {
+        printf("File is empty.\n");
+        return terminate(0);
     }
-    clock_t t1 = clock();
+    toposort_get_stats(ctx, &stats);
+    printf("Nodes count: %d\n", stats.nodes_count);
+    printf("Edges count: %ld\n", stats.edges_count);
+    printf("Graph layout: %s\n", toposort_layout_name(stats.layout));
+    if (stats.adjacency_bytes > 0) {
+        printf("Adjacency size: %ld bytes\n", stats.adjacency_bytes);
+    }
+    if (stats.index_width > 0) {
+        printf("Node index width: %d bits\n", stats.index_width);
+    }
+
     // Calculate graphs Topology order.
-    calculate_topology();
-    clock_t t2 = clock();
+    sorted = toposort_sort(ctx);
+    toposort_get_stats(ctx, &stats);
     printf("Algorithm finished!\n");
-    printf("Time spend: %f secs\n", ((float)t2 -t1) / CLOCKS_PER_SEC);
+    printf("Time spend: %f secs\n", stats.sort_time);
+    if (!sorted) {
+        // A Graph with a cycle cannot be sorted, report it instead of writing a truncated order.
+        printf("%s\n", toposort_error(ctx));
+        if (!toposort_report_cycle(ctx)) {
+            printf("%s\n", toposort_error(ctx));
+        }
+        return terminate(-1);
+    }
     printf("Writing Topology Matrix to output file.\n");
     // Write the Topology matrix to the output file.
-    write_topology_to_file();
-
-    fclose(fin);
-    fclose(fout);
-    printf("Program terminates.\n");
+    if (!toposort_write(ctx, fout, output_format)) {
+        printf("Failed to write Topology Matrix to output file.\n");
+        return terminate(-1);
+    }
+    if (schedule_filename != NULL && !write_schedule()) {
+        return terminate(-1);
+    }
+    toposort_get_stats(ctx, &stats);
+
+    // Report the phases wall-clock times and the peak resident memory.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Parse time: %f secs\n", stats.parse_time);
+    printf("Build time: %f secs\n", stats.build_time);
+    if (relabel != TOPOSORT_RELABEL_NONE) {
+        printf("Relabel time: %f secs(%s order)\n", stats.relabel_time, toposort_relabel_name(relabel));
+    }
+    printf("Sort time: %f secs\n", stats.sort_time);
+    printf("Write time: %f secs\n", stats.write_time);
+    printf("Peak memory: %ld KB\n", usage.ru_maxrss);
+    if (stats_format != STATS_NONE) {
+        print_stats(&stats, usage.ru_maxrss);
+    }
 
-    return 0;
+    return terminate(0);
 }
@@ -0,0 +1,419 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort public interface.
+// The library implements the Topology sorting algorithm of the topology_shorting programs,
+// based on Kahn's algorithm(https://en.wikipedia.org/wiki/Topological_sorting), behind a
+// sort context. A context owns a Graph and every buffer needed to sort it, and keeps its
+// buffers between Graphs, so a process can sort many Graphs without reallocating them.
+// Contexts share no state, so different Threads may use different contexts concurrently,
+// while a single context must only be used by one Thread at a time.
+//
+// Typical use:
+//      toposort_context *ctx = toposort_create(threads_count);
+//      toposort_load_file(ctx, "graph") or toposort_load_edges(ctx, nodes, edges, sources, targets);
+//      toposort_sort(ctx);
+//      toposort_write(ctx, output, TOPOSORT_OUTPUT_TEXT) or toposort_order(ctx);
+//      ...
+//      toposort_destroy(ctx);
+//
+// Functions returning int return 1 on success and 0 on failure, with the failure
+// described by toposort_error().
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#ifndef TOPOSORT_H
+#define TOPOSORT_H
+
+#include <stdio.h>
+
+#define TOPOSORT_LAYOUT_AUTO     0 // Graph adjacency layout selected from the edge density.
+#define TOPOSORT_LAYOUT_CSR      1 // Graph adjacency stored as CSR(compressed sparse row) arrays.
+#define TOPOSORT_LAYOUT_BITSET   2 // Graph adjacency stored as a bit-packed matrix.
+#define TOPOSORT_LAYOUT_EXTERNAL 3 // Graph adjacency stored in a sorted spill file(out-of-core mode).
+#define TOPOSORT_LAYOUT_COMPRESSED 4 // Graph adjacency stored as CSR rows of delta encoded varints.
+
+#define TOPOSORT_ENGINE_SERIAL 0   // Serial Queue engine.
+#define TOPOSORT_ENGINE_LEVEL  1   // Lock-free level-synchronous frontier parallel engine.
+#define TOPOSORT_ENGINE_STEAL  2   // Work-stealing parallel engine, using per Thread deques.
+#define TOPOSORT_ENGINE_HYBRID 3   // Direction-optimizing level-synchronous parallel engine, pushing or pulling each frontier.
+
+#define TOPOSORT_ORDER_ANY   0     // Topology order given by the engine, depending on the Threads interleaving.
+#define TOPOSORT_ORDER_LEVEL 1     // Canonical Topology order, level by level, each level sorted by node.
+#define TOPOSORT_ORDER_LEX   2     // Canonical Topology order, the lexicographically smallest one.
+
+#define TOPOSORT_RELABEL_NONE   0  // Nodes keep their labels.
+#define TOPOSORT_RELABEL_BFS    1  // Nodes relabeled in breadth-first order from the nodes without dependencies.
+#define TOPOSORT_RELABEL_RCM    2  // Nodes relabeled in reverse Cuthill-McKee order.
+#define TOPOSORT_RELABEL_DEGREE 3  // Nodes relabeled by decreasing degree.
+
+#define TOPOSORT_AFFINITY_NONE    0 // Threads left unpinned, placed by the scheduler.
+#define TOPOSORT_AFFINITY_COMPACT 1 // Threads pinned to the CPUs of a NUMA node, before filling the next one.
+#define TOPOSORT_AFFINITY_SCATTER 2 // Threads pinned to CPUs of each NUMA node in turn.
+
+#define TOPOSORT_OUTPUT_TEXT     0 // Topology matrix written as text, one node per line.
+#define TOPOSORT_OUTPUT_BINARY   1 // Topology matrix written as a binary int32 array.
+#define TOPOSORT_OUTPUT_BINARY64 2 // Topology matrix written as a binary int64 array.
+
+// Sort context structure, only accessed through the library functions.
+typedef struct toposort_context toposort_context;
+
+// Per Thread instrumentation counters structure, aligned to a cache line,
+// so Threads never share one while counting. The serial engine uses a single one.
+typedef struct toposort_counters {
+    long nodes_processed;  // Nodes whose dependencies were removed by the Thread.
+    long edges_relaxed;    // Dependencies removed by the Thread.
+    long atomic_ops;       // Shared atomic read-modify-write operations, besides dependencies removal.
+    long cas_failures;     // Compare-and-swap operations lost to another Thread.
+    long lock_contended;   // Park mutex acquisitions that found it held by another Thread.
+    long steals;           // Nodes stolen from other Threads deques.
+    long failed_steals;    // Steal attempts that found an empty deque or lost a race.
+    long queue_high_water; // Maximum nodes held by the Queue, the Thread buffer or deque.
+    double idle_time;      // Time spent waiting on barriers, yielding or parked.
+} __attribute__((aligned(64))) toposort_counters;
+
+// Sort context statistics structure, describing the last loaded Graph and its last sort.
+typedef struct toposort_stats {
+    int nodes_count;       // Graph nodes count.
+    long edges_count;      // Graph edges count.
+    int layout;            // Graph adjacency layout in use.
+    long adjacency_bytes;  // Graph adjacency size in bytes, rows offsets included.
+    int index_width;       // CSR layout target node indexes width in bits, 16 or 32, 0 for the other layouts.
+    int engine;            // Engine used for the calculation.
+    int threads_count;     // Threads used by the parallel engines.
+    int numa_nodes;        // NUMA nodes the Threads are placed on, 1 unless pinned on a multi-node machine.
+    int sorted_count;      // Nodes placed in the Topology matrix.
+    int push_levels;       // Hybrid engine frontiers processed by pushing along their out-edges.
+    int pull_levels;       // Hybrid engine frontiers processed by pulling the unsorted nodes dependencies.
+    double parse_time;     // Input parsing or Graph generation wall-clock time.
+    double build_time;     // Graph adjacency building wall-clock time.
+    double sort_time;      // Topology calculation wall-clock time.
+    double write_time;     // Topology matrix writing wall-clock time.
+    double relabel_time;   // Relabeling pass wall-clock time, 0 unless the Graph was relabeled.
+    int spill_runs;        // Out-of-core mode sorted edge runs spilled.
+    long spill_buffer;     // Out-of-core mode edges buffer size in bytes.
+    int inserted;          // Incremental mode edges inserted.
+    int removed;           // Incremental mode edges removed.
+    int rejected;          // Incremental mode edges rejected, as they create a cycle.
+    int missing;           // Incremental mode removed edges not found in the Graph.
+    long reordered;        // Incremental mode nodes reordered.
+    int levels_count;      // Schedule mode levels count, the nodes count of the longest path.
+    int critical_path_nodes; // Schedule mode critical path nodes count.
+    double critical_path_length; // Schedule mode critical path length, the largest earliest start time.
+    const toposort_counters *counters; // Per Thread counters, NULL unless built with TOPOLOGY_STATS.
+} toposort_stats;
+
+// This function creates a sort context.
+// Inputs:
+//      int threads_count: Threads used by the parallel engines, parsing and writing.
+// Output:
+//      The sort context, NULL if it could not be allocated.
+toposort_context *toposort_create(int threads_count);
+
+// This function destroys a sort context, releasing its Graph and buffers.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+void toposort_destroy(toposort_context *ctx);
+
+// This function selects the engine of the following sorts.
+// The default is the serial engine for a single Thread, the level engine otherwise.
+// The hybrid engine runs on the csr layout without schedule mode, and uses a reverse
+// CSR index of the dependencies, built by the following loads(or by the first sort).
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int engine: The engine.
+void toposort_set_engine(toposort_context *ctx, int engine);
+
+// This function selects the Topology order of the following sorts(default any).
+// The level and lexicographic orders are canonical: a Graph always gets the same order,
+// whatever the Threads count and the engine selected. The level order is calculated by
+// the level engine, each frontier being sorted by the context Threads before it is
+// processed; the out-of-core mode always calculates it. The lexicographic order is
+// calculated by the serial engine with a heap instead of the Queue, as each node
+// depends on the previous choices, and is not available in out-of-core mode.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int order: The order.
+void toposort_set_order(toposort_context *ctx, int order);
+
+// This function selects the nodes relabeling of the following loads(default none).
+// After loading, the nodes are relabeled for locality, in breadth-first, reverse Cuthill-McKee
+// or decreasing degree order, and the Graph is rebuilt with the new labels. Sorts run on
+// the relabeled Graph, and the Topology matrix is mapped back to the original nodes.
+// The pass cost is reported apart(relabel_time), to be weighed against the sort time saved
+// by repeated sorts. It requires the csr layout, and is not available in out-of-core,
+// incremental or schedule mode, nor with a deterministic order.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int relabel: The relabeling order.
+void toposort_set_relabel(toposort_context *ctx, int relabel);
+
+// This function selects the placement of the context Threads(default none). Pinned Threads
+// are created on the CPUs they may run on, ordered by NUMA node as found in sysfs, and their
+// nodes ranges follow the NUMA nodes order, so the nodes of a NUMA node Threads are contiguous.
+// The Graph buffers built from edge lists or generated are then first touched in parallel,
+// each Thread touching its own range, so their pages are spread over the Threads NUMA nodes.
+// Machines without NUMA information are handled as a single NUMA node, and Threads whose
+// pinning is refused run unpinned.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int affinity: The placement.
+void toposort_set_affinity(toposort_context *ctx, int affinity);
+
+// This function selects the adjacency layout of the following loads(default auto).
+// The compressed layout stores each node sorted row as the varint encoded gaps between its
+// targets, decoded on the fly by the sorts. Text Graphs are encoded directly from their
+// parsed edges, the other Graphs from their CSR arrays. It is never selected by auto,
+// and cannot be combined with the schedule or incremental modes.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int layout: The layout.
+void toposort_set_layout(toposort_context *ctx, int layout);
+
+// This function sets the memory limit of the following loads. A positive limit selects
+// the out-of-core mode, which sorts text Graphs larger than memory with the serial engine.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long mem_limit: The memory limit in bytes, 0 for the in-memory mode.
+void toposort_set_mem_limit(toposort_context *ctx, long mem_limit);
+
+// This function sets the file the library prints its progress and diagnostics to,
+// such as witness cycles and rejected edges(default none).
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      FILE *log: The log file, NULL to print nothing.
+void toposort_set_log(toposort_context *ctx, FILE *log);
+
+// This function enables or disables the schedule mode of the following loads(default disabled).
+// In schedule mode the edges weights are kept, and each sort also calculates in the same pass
+// the earliest start time of each node(longest weighted path from a node without dependencies),
+// its level(longest path length in edges) and the critical path of the Graph.
+// It requires the csr layout, and is not available in out-of-core mode.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int enabled: Schedule mode is enabled if set.
+void toposort_set_schedule(toposort_context *ctx, int enabled);
+
+// This function enables or disables the previous Topology matrix check of the following
+// repairs(default disabled). Repairs always check the previous Topology matrix is a permutation
+// of the nodes, and with the check enabled also that every edge of the Graph leads forward,
+// which costs a pass over the whole Graph.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int enabled: The previous Topology matrix check is enabled if set.
+void toposort_set_check_order(toposort_context *ctx, int enabled);
+
+// This function loads a Graph from a file, replacing the context Graph. The file is a
+// RandomGraph text file or a binary Graph written by graph_converter, recognized by its
+// magic number, or a gen:<spec> synthetic Graph specification generated in memory.
+// An empty file loads an empty Graph, while an invalid nodes count fails to load.
+// Graphs are limited to 2^31 - 1 nodes, while edges are counted and indexed with 64bit integers.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *filename: The Graph file name or specification.
+// Output:
+//      1 --> Loaded successfully.
+//      0 --> Something went wrong.
+int toposort_load_file(toposort_context *ctx, const char *filename);
+
+// This function loads a Graph from in-memory edge arrays, replacing the context Graph.
+// The arrays are copied, so they may be released once loaded.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int nodes_count: The Graph nodes count.
+//      long edges_count: The Graph edges count.
+//      const int *sources: The edges sources.
+//      const int *targets: The edges targets.
+//      const double *weights: The edges weights, only used in schedule mode, NULL for unit weights.
+// Output:
+//      1 --> Loaded successfully.
+//      0 --> Something went wrong.
+int toposort_load_edges(toposort_context *ctx, int nodes_count, long edges_count, const int *sources, const int *targets,
+    const double *weights);
+
+// This function reads a gen:<spec> synthetic Graph specification without generating the
+// Graph, so its rows can be streamed with toposort_generate_row() instead of kept in memory.
+// The context Graph is left unchanged.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *spec: The generator specification, the gen: prefix being optional.
+//      int *nodes_count: The specified Graph nodes count.
+// Output:
+//      1 --> Specification read successfully.
+//      0 --> Something went wrong.
+int toposort_read_generator(toposort_context *ctx, const char *spec, int *nodes_count);
+
+// This function generates the out-edges of a node of the synthetic Graph specified by the
+// last toposort_read_generator() or gen:<spec> load, the same rows a gen:<spec> load builds.
+// Rows are reproducible, so they may be generated by several Threads in any order.
+// Only the first capacity edges are stored, while all of them are counted, so a row longer
+// than the outputs is generated again once they are grown to its count.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      int node: The node, below the specified nodes count.
+//      int *targets: The edges targets output.
+//      double *weights: The edges weights output, NULL to skip them.
+//      int capacity: Edges the outputs can hold, 0 to only count them.
+// Output:
+//      The node out-edges count.
+int toposort_generate_row(const toposort_context *ctx, int node, int *targets, double *weights, int capacity);
+
+// This function calculates the Topology order of the context Graph. The Graph is kept,
+// so it can be sorted again.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Every node was sorted.
+//      0 --> The Graph contains a cycle, or something went wrong.
+int toposort_sort(toposort_context *ctx);
+
+// This function repairs a previous Topology order of the context Graph after an edges delta,
+// instead of sorting again(incremental mode). The Graph must be loaded with the CSR layout,
+// and is left with the delta applied, so it must be loaded again before a full sort.
+// Each inserted edge only visits the nodes positioned between its target and its source
+// in the previous order, no reverse Graph is built.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *order_filename: The previous Topology matrix file, text or binary.
+//      const char *delta_filename: The edges delta file.
+// Output:
+//      1 --> Repaired successfully, rejected edges are reported in the statistics.
+//      0 --> Something went wrong.
+int toposort_repair(toposort_context *ctx, const char *order_filename, const char *delta_filename);
+
+// This function prints a witness cycle of the context Graph to the log,
+// after a sort that could not place every node.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Cycle found and printed.
+//      0 --> Something went wrong.
+int toposort_report_cycle(toposort_context *ctx);
+
+// This function writes the Topology matrix of the last sort to a file.
+// Text format first line contains the nodes count, last line contains -1 as EOF char.
+// Binary formats write a header(magic "TOPOORDR", uint32 version, uint32 integer width,
+// uint64 nodes count) followed by the nodes as little endian integers.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      FILE *output: The output file.
+//      int format: The output format.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int toposort_write(toposort_context *ctx, FILE *output, int format);
+
+// This function returns the Topology matrix of the last sort, valid until the next
+// load or sort of the context.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+// Output:
+//      The Graph nodes in Topology order.
+const int *toposort_order(const toposort_context *ctx);
+
+// This function returns the earliest start time of each node, calculated by the last
+// schedule mode sort, valid until the next load or sort of the context.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+// Output:
+//      The earliest start times, NULL if they were not calculated.
+const double *toposort_start_times(const toposort_context *ctx);
+
+// This function returns the level of each node, calculated by the last schedule mode sort,
+// valid until the next load or sort of the context.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+// Output:
+//      The levels, NULL if they were not calculated.
+const int *toposort_levels(const toposort_context *ctx);
+
+// This function returns the critical path found by the last schedule mode sort, from a node
+// without dependencies to the node with the largest earliest start time.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      int *nodes_count: The critical path nodes count.
+// Output:
+//      The critical path nodes, NULL if it was not calculated.
+const int *toposort_critical_path(const toposort_context *ctx, int *nodes_count);
+
+// This function writes the schedule calculated by the last schedule mode sort to a file.
+// First line contains the nodes count, the levels count, the critical path length and its
+// nodes count. Each node follows, in Topology order, on a line with its level and earliest
+// start time. The critical path nodes follow on a single line, and the last line contains -1.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      FILE *output: The output file.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int toposort_write_schedule(toposort_context *ctx, FILE *output);
+
+// This function saves the context Graph as a binary Graph file(version 2), the format
+// toposort_load_file() maps. The Graph must be loaded with the CSR layout and without
+// relabeling, and is saved as loaded, so a repaired Graph must be loaded again first.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      FILE *output: The output file.
+//      int with_weights: The edges weights are saved if set, requiring a schedule mode load.
+// Output:
+//      1 --> Saved successfully.
+//      0 --> Something went wrong.
+int toposort_save_graph(toposort_context *ctx, FILE *output, int with_weights);
+
+// This function returns the context Graph nodes count.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+// Output:
+//      The nodes count.
+int toposort_nodes_count(const toposort_context *ctx);
+
+// This function retrieves the context statistics.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      toposort_stats *stats: The statistics.
+void toposort_get_stats(const toposort_context *ctx, toposort_stats *stats);
+
+// This function returns the description of the last failure of the context.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+// Output:
+//      The failure description.
+const char *toposort_error(const toposort_context *ctx);
+
+// This function returns an adjacency layout name.
+// Inputs:
+//      int layout: The layout.
+// Output:
+//      The layout name.
+const char *toposort_layout_name(int layout);
+
+// This function returns a Topology order name.
+// Inputs:
+//      int order: The order.
+// Output:
+//      The order name.
+const char *toposort_order_name(int order);
+
+// This function returns a relabeling order name.
+// Inputs:
+//      int relabel: The relabeling order.
+// Output:
+//      The relabeling order name.
+const char *toposort_relabel_name(int relabel);
+
+// This function returns a Threads placement name.
+// Inputs:
+//      int affinity: The placement.
+// Output:
+//      The placement name.
+const char *toposort_affinity_name(int affinity);
+
+// This function returns an engine name.
+// Inputs:
+//      int engine: The engine.
+// Output:
+//      The engine name.
+const char *toposort_engine_name(int engine);
+
+#endif
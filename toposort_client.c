@@ -0,0 +1,286 @@
+// -------------------------------------------------------------------------------------
+//
+// This program requests the Topology sorting of a Graph from toposort_server, over its
+// Unix domain socket, and writes the received Topology Matrix to an output file,
+// as text like topology_shorting, or as the binary int32 array sent by the server.
+// Requests may be repeated, to measure the round trip time of cached Graphs.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define REPLY_MAGIC "TOPORPLY"  // Server reply magic number.
+#define REPLY_SORTED 0          // Graph was sorted, the Topology matrix follows.
+#define ORDER_MAGIC "TOPOORDR"  // Binary Topology matrix format magic number.
+#define FORMAT_TEXT 0           // Topology matrix written as text.
+#define FORMAT_BINARY 1         // Topology matrix written as received.
+
+// Server reply header structure.
+typedef struct reply_header {
+    char magic[8];              // Reply magic number.
+    uint32_t status;            // Reply status.
+    uint32_t cache;             // Reply cache outcome.
+    uint64_t length;            // Bytes following the header.
+} reply_header;
+
+// Binary Topology matrix format header structure.
+typedef struct order_header {
+    char magic[8];              // Format magic number.
+    uint32_t version;           // Format version.
+    uint32_t width;             // Node integers width in bytes.
+    uint64_t nodes_count;       // Graph nodes count.
+} order_header;
+
+char *socket_path;              // Server Unix domain socket file name.
+char input_path[PATH_MAX];      // Requested Graph file name, absolute as the server resolves it.
+FILE *fout;                     // Output file.
+int output_format;              // Topology matrix output file format.
+int repeat;                     // Requests count.
+char *reply;                    // Last reply body.
+
+// This function returns the monotonic wall-clock time.
+// Output:
+//      Seconds elapsed since an arbitrary fixed point.
+double wall_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// This function reads a buffer from a socket, resuming after partial reads.
+// Inputs:
+//      int fd: The socket.
+//      void *data: The buffer.
+//      size_t size: The bytes to read.
+// Output:
+//      1 --> Read successfully.
+//      0 --> Something went wrong.
+int receive_all(int fd, void *data, size_t size)
+{
+    char *p = (char*)data;
+    while (size > 0) {
+        ssize_t received = read(fd, p, size);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return 0;
+        }
+        p += received;
+        size -= received;
+    }
+
+    return 1;
+}
+
+// This function sends a sort request to the server and receives its reply.
+// Inputs:
+//      reply_header *header: The reply header.
+// Output:
+//      1 --> Reply received, its body is stored in reply.
+//      0 --> Something went wrong.
+int request_sort(reply_header *header)
+{
+    struct sockaddr_un address;
+    char request[PATH_MAX + 8];
+    int fd, length, received;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("Cannot connect to server socket %s.\n", socket_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    length = snprintf(request, sizeof(request), "SORT %s\n", input_path);
+    received = write(fd, request, length) == length && receive_all(fd, header, sizeof(reply_header))
+        && memcmp(header->magic, REPLY_MAGIC, sizeof(header->magic)) == 0;
+    if (received) {
+        free(reply);
+        reply = (char*)malloc(header->length + 1);
+        received = reply != NULL && receive_all(fd, reply, header->length);
+    }
+    close(fd);
+    if (!received) {
+        printf("Invalid reply from server.\n");
+        return 0;
+    }
+    reply[header->length] = '\0';
+
+    return 1;
+}
+
+// This function writes the received Topology matrix to the output file.
+// Inputs:
+//      const reply_header *header: The reply header.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int write_topology(const reply_header *header)
+{
+    const order_header *order = (const order_header*)reply;
+    const int *nodes = (const int*)(reply + sizeof(order_header));
+    if (header->length < sizeof(order_header) || memcmp(order->magic, ORDER_MAGIC, sizeof(order->magic)) != 0
+        || header->length != sizeof(order_header) + sizeof(int) * order->nodes_count) {
+        printf("Invalid Topology Matrix received.\n");
+        return 0;
+    }
+    printf("Nodes count: %ld\n", (long)order->nodes_count);
+    if (output_format == FORMAT_BINARY) {
+        return fwrite(reply, 1, header->length, fout) == header->length;
+    }
+
+    // First line contains the nodes count, last line contains -1 as EOF char.
+    fprintf(fout, "%ld\n", (long)order->nodes_count);
+    for (uint64_t i = 0; i < order->nodes_count; i++) {
+        fprintf(fout, "%d\n", nodes[i]);
+    }
+    fprintf(fout, "-1");
+
+    return 1;
+}
+
+// Auxiliary function that displays a message in case of wrong input parameters.
+// Inputs:
+//      char *compiled_name: Programs compiled name.
+void syntax_message(char *compiled_name)
+{
+    printf("Correct syntax:\n");
+    printf("%s <socket-file> <input-file> <output-file> [options]\n", compiled_name);
+    printf("where: \n");
+    printf("<socket-file> is the Unix domain socket toposort_server listens on.\n");
+    printf("<input-file> is the Graph file the server will sort, or gen:<spec> to generate a synthetic Graph.\n");
+    printf("<output-file> is the file Topology Matrix will be written.\n");
+    printf("options:\n");
+    printf("--output-format=text|binary writes the Topology Matrix as text(default), or as the binary int32 array sent by the server.\n");
+    printf("--repeat=<count> sends the request the given times, reporting each round trip time.\n");
+}
+
+// This function checks run-time parameters validity and
+// retrieves the socket, input and output file names.
+// Inputs:
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
+// Output:
+//      1 --> Parameters read successfully.
+//      0 --> Something went wrong.
+int read_parameters(int argc, char **argv)
+{
+    socket_path = argv[1];
+    if (socket_path == NULL) {
+        printf("Socket file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    char *input_filename = argv[2];
+    if (input_filename == NULL) {
+        printf("Input file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+    // The server resolves file names relative to its own working directory.
+    if (strncmp(input_filename, "gen:", 4) == 0) {
+        snprintf(input_path, sizeof(input_path), "%s", input_filename);
+    } else if (realpath(input_filename, input_path) == NULL) {
+        printf("Cannot open input file %s.\n", input_filename);
+        return 0;
+    }
+
+    char *output_filename = argv[3];
+    if (output_filename == NULL) {
+        printf("Output file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    output_format = FORMAT_TEXT;
+    repeat = 1;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--output-format=text") == 0) {
+            output_format = FORMAT_TEXT;
+        } else if (strcmp(argv[i], "--output-format=binary") == 0) {
+            output_format = FORMAT_BINARY;
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeat = atoi(argv[i] + 9);
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            syntax_message(argv[0]);
+            return 0;
+        }
+    }
+    if (repeat <= 0) {
+        printf("Requests count must be positive.\n");
+        return 0;
+    }
+
+    fout = fopen(output_filename, "wb");
+    if (fout == NULL) {
+        printf("Cannot open output file %s.\n", output_filename);
+        return 0;
+    }
+
+    printf("Requesting Topology sorting of Graph from server: %s\n", input_path);
+    printf("Topology Matrix will be written in output file: %s\n", output_filename);
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *cache_outcomes[] = {"loaded", "graph cached", "order cached"};
+    reply_header header;
+    int r;
+
+    // Run-time parameters check.
+    if (!read_parameters(argc, argv)) {
+        printf("Program terminates.\n");
+        return -1;
+    }
+
+    for (r = 0; r < repeat; r++) {
+        double start = wall_time();
+        if (!request_sort(&header)) {
+            break;
+        }
+        printf("Request %d: %s, %f secs\n", r + 1, header.cache <= 2 ? cache_outcomes[header.cache] : "unknown", wall_time() - start);
+        if (header.status != REPLY_SORTED) {
+            printf("Server failed: %s\n", reply);
+            break;
+        }
+    }
+    if (r < repeat) {
+        free(reply);
+        fclose(fout);
+        printf("Program terminates.\n");
+        return -1;
+    }
+
+    printf("Writing Topology Matrix to output file.\n");
+    if (!write_topology(&header) || fclose(fout) != 0) {
+        printf("Failed to write Topology Matrix to output file.\n");
+        free(reply);
+        return -1;
+    }
+    free(reply);
+    printf("Program terminates.\n");
+
+    return 0;
+}
@@ -0,0 +1,542 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort sort context: creation and destruction, options, failure descriptions,
+// statistics, the Threads placement and the buffer and Thread helpers shared by the
+// library source files.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+#include "toposort_internal.h"
+
+// This function returns the monotonic wall-clock time, unaffected by
+// the number of running Threads, unlike the process CPU time.
+// Output:
+//      Seconds elapsed since an arbitrary fixed point.
+double wall_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// This function records the description of a failure of the context.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *format: The description format, followed by its arguments.
+void set_error(toposort_context *ctx, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(ctx->error, sizeof(ctx->error), format, arguments);
+    va_end(arguments);
+}
+
+// This function prints a progress or diagnostics message to the context log, if any.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *format: The message format, followed by its arguments.
+void log_message(toposort_context *ctx, const char *format, ...)
+{
+    va_list arguments;
+    if (ctx->log == NULL) {
+        return;
+    }
+    va_start(arguments, format);
+    vfprintf(ctx->log, format, arguments);
+    va_end(arguments);
+}
+
+// This function makes sure a context buffer holds at least the given size, reallocating
+// it only when it must grow. The buffer contents are not preserved when it grows.
+// Inputs:
+//      void **buffer: The buffer.
+//      size_t *allocated: The buffer allocated size.
+//      size_t size: The needed size in bytes.
+// Output:
+//      1 --> Buffer is large enough.
+//      0 --> Something went wrong.
+int reserve_buffer(void **buffer, size_t *allocated, size_t size)
+{
+    if (size <= *allocated && *buffer != NULL) {
+        return 1;
+    }
+
+    free(*buffer);
+    *allocated = 0;
+    // Buffers are aligned to 256bit boundaries, so bitset rows can be scanned with vector instructions.
+    if (posix_memalign(buffer, 32, size > 0 ? size : 1) != 0) {
+        *buffer = NULL;
+        return 0;
+    }
+    *allocated = size;
+
+    return 1;
+}
+
+// This function runs a Thread function with every context Thread, each one receiving its
+// worker structure. A single Thread context runs the function in the calling Thread.
+// Pinned Threads are created on their CPU, or unpinned if the placement is refused.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      void *(*function)(void*): The Thread function.
+void run_workers(toposort_context *ctx, void *(*function)(void*))
+{
+    pthread_attr_t attributes;
+    cpu_set_t cpus;
+    long t;
+    if (ctx->threads_count == 1) {
+        function(&ctx->workers[0]);
+        return;
+    }
+
+    for (t = 0; t < ctx->threads_count; t++) {
+        if (ctx->thread_cpus[t] < 0) {
+            pthread_create(&ctx->tid[t], NULL, function, &ctx->workers[t]);
+            continue;
+        }
+        pthread_attr_init(&attributes);
+        CPU_ZERO(&cpus);
+        CPU_SET(ctx->thread_cpus[t], &cpus);
+        if (pthread_attr_setaffinity_np(&attributes, sizeof(cpus), &cpus) != 0
+            || pthread_create(&ctx->tid[t], &attributes, function, &ctx->workers[t]) != 0) {
+            pthread_create(&ctx->tid[t], NULL, function, &ctx->workers[t]);
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    for (t = 0; t < ctx->threads_count; t++) {
+        pthread_join(ctx->tid[t], NULL);
+    }
+}
+
+// This function reads a sysfs list of CPUs or NUMA nodes, such as "0-3,8-11", into a CPU set.
+// Inputs:
+//      const char *filename: The list file name.
+//      cpu_set_t *set: The read set.
+// Output:
+//      1 --> Read successfully.
+//      0 --> The list is not available.
+static int read_cpu_list(const char *filename, cpu_set_t *set)
+{
+    char list[4096], *p = list;
+    long first, last;
+    FILE *file = fopen(filename, "r");
+    CPU_ZERO(set);
+    if (file == NULL) {
+        return 0;
+    }
+    if (fgets(list, sizeof(list), file) == NULL) {
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    while (*p >= '0' && *p <= '9') {
+        first = last = strtol(p, &p, 10);
+        if (*p == '-') {
+            last = strtol(p + 1, &p, 10);
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, set);
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+
+    return 1;
+}
+
+// This function places the context Threads on the CPUs the process may run on. The CPUs are
+// listed by NUMA node, then each Thread takes the next CPU of the list(compact) or of the next
+// NUMA node(scatter), wrapping around when there are more Threads than CPUs. The Threads ranks
+// order them by NUMA node, so each NUMA node Threads get contiguous nodes ranges.
+// Without sysfs NUMA information all the CPUs form a single NUMA node.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+static void place_threads(toposort_context *ctx)
+{
+    int cpus[CPU_SETSIZE], cpu_nodes[CPU_SETSIZE];
+    int node_first[NUMA_NODES_MAX + 1], node_count[NUMA_NODES_MAX + 1];
+    int i, node, round, count = 0, nodes_count = 0;
+    cpu_set_t allowed, nodes, node_cpus;
+    char filename[64];
+    long t, rank = 0;
+    ctx->numa_nodes = 1;
+    for (t = 0; t < ctx->threads_count; t++) {
+        ctx->thread_cpus[t] = -1;
+        ctx->thread_ranks[t] = t;
+    }
+    if (ctx->affinity == TOPOSORT_AFFINITY_NONE || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    if (read_cpu_list("/sys/devices/system/node/online", &nodes)) {
+        for (node = 0; node < NUMA_NODES_MAX; node++) {
+            if (!CPU_ISSET(node, &nodes)) {
+                continue;
+            }
+            snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%d/cpulist", node);
+            read_cpu_list(filename, &node_cpus);
+            node_first[nodes_count] = count;
+            for (i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &node_cpus) && CPU_ISSET(i, &allowed)) {
+                    cpu_nodes[i] = nodes_count;
+                    cpus[count++] = i;
+                }
+            }
+            node_count[nodes_count] = count - node_first[nodes_count];
+            // NUMA nodes without allowed CPUs, such as memory-only nodes, are skipped.
+            if (node_count[nodes_count] > 0) {
+                nodes_count++;
+            }
+        }
+    }
+    if (count == 0) {
+        nodes_count = 1;
+        node_first[0] = 0;
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &allowed)) {
+                cpu_nodes[i] = 0;
+                cpus[count++] = i;
+            }
+        }
+        node_count[0] = count;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    for (t = 0; t < ctx->threads_count; t++) {
+        if (ctx->affinity == TOPOSORT_AFFINITY_COMPACT) {
+            ctx->thread_cpus[t] = cpus[t % count];
+            continue;
+        }
+        // Scatter takes the CPUs of each round from every NUMA node still having some.
+        i = t % count;
+        for (round = 0; ; round++) {
+            for (node = 0; node < nodes_count; node++) {
+                if (round < node_count[node] && i-- == 0) {
+                    break;
+                }
+            }
+            if (node < nodes_count) {
+                break;
+            }
+        }
+        ctx->thread_cpus[t] = cpus[node_first[node] + round];
+    }
+    for (node = 0; node < nodes_count; node++) {
+        for (t = 0; t < ctx->threads_count; t++) {
+            if (cpu_nodes[ctx->thread_cpus[t]] == node) {
+                ctx->thread_ranks[t] = rank++;
+            }
+        }
+    }
+    ctx->numa_nodes = nodes_count < ctx->threads_count ? nodes_count : ctx->threads_count;
+}
+
+toposort_context *toposort_create(int threads_count)
+{
+    long t;
+    toposort_context *ctx;
+    if (threads_count <= 0) {
+        return NULL;
+    }
+    ctx = (toposort_context*)calloc(1, sizeof(toposort_context));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    ctx->threads_count = threads_count;
+    ctx->engine = threads_count == 1 ? TOPOSORT_ENGINE_SERIAL : TOPOSORT_ENGINE_LEVEL;
+    ctx->requested_layout = TOPOSORT_LAYOUT_AUTO;
+    ctx->graph_layout = TOPOSORT_LAYOUT_CSR;
+    ctx->topology_matrix_index = -1;
+    ctx->critical_path_count = -1;
+    ctx->numa_nodes = 1;
+    ctx->index_width = 32;
+    pthread_mutex_init(&ctx->park_mutex, NULL);
+    pthread_cond_init(&ctx->park_cond, NULL);
+    ctx->tid = (pthread_t*)malloc(threads_count * sizeof(pthread_t));
+    ctx->workers = (worker*)malloc(threads_count * sizeof(worker));
+    ctx->level_counts = (int*)malloc(threads_count * sizeof(int));
+    ctx->level_edges = (long*)malloc(threads_count * sizeof(long));
+    ctx->level_in_edges = (long*)malloc(threads_count * sizeof(long));
+    ctx->bucket_counts = (int*)malloc((size_t)threads_count * threads_count * sizeof(int));
+    ctx->bucket_cursors = (long*)malloc((size_t)threads_count * threads_count * sizeof(long));
+    ctx->chunks = (edge_chunk*)calloc(threads_count, sizeof(edge_chunk));
+    ctx->output_chunks = (output_chunk*)calloc(threads_count, sizeof(output_chunk));
+    ctx->output_vectors = (struct iovec*)malloc((threads_count + 2) * sizeof(struct iovec));
+    ctx->thread_cpus = (int*)malloc(threads_count * sizeof(int));
+    ctx->thread_ranks = (int*)malloc(threads_count * sizeof(int));
+    ctx->build_sums = (long*)malloc(threads_count * sizeof(long));
+    if ((ctx->tid == NULL) || (ctx->workers == NULL) || (ctx->level_counts == NULL) || (ctx->level_edges == NULL) || (ctx->chunks == NULL)
+        || (ctx->level_in_edges == NULL) || (ctx->bucket_counts == NULL) || (ctx->bucket_cursors == NULL)
+        || (ctx->thread_cpus == NULL) || (ctx->thread_ranks == NULL) || (ctx->build_sums == NULL)
+        || (ctx->output_chunks == NULL) || (ctx->output_vectors == NULL)
+        || (posix_memalign((void**)&ctx->deques, 64, threads_count * sizeof(deque)) != 0)) {
+        ctx->deques = NULL;
+        toposort_destroy(ctx);
+        return NULL;
+    }
+#ifdef TOPOLOGY_STATS
+    if (posix_memalign((void**)&ctx->thread_statistics, 64, threads_count * sizeof(toposort_counters)) != 0) {
+        ctx->thread_statistics = NULL;
+        toposort_destroy(ctx);
+        return NULL;
+    }
+    memset(ctx->thread_statistics, 0, threads_count * sizeof(toposort_counters));
+#endif
+    for (t = 0; t < threads_count; t++) {
+        ctx->workers[t].ctx = ctx;
+        ctx->workers[t].id = t;
+        ctx->thread_cpus[t] = -1;
+        ctx->thread_ranks[t] = t;
+    }
+
+    return ctx;
+}
+
+void toposort_destroy(toposort_context *ctx)
+{
+    int c;
+    if (ctx == NULL) {
+        return;
+    }
+
+    release_graph(ctx);
+    for (c = 0; ctx->chunks != NULL && c < ctx->threads_count; c++) {
+        free(ctx->chunks[c].sources);
+        free(ctx->chunks[c].targets);
+        free(ctx->chunks[c].weights);
+    }
+    free(ctx->chunks);
+    free(ctx->csr_offsets);
+    free(ctx->csr_targets);
+    free(ctx->csr_weights);
+    free(ctx->bitset);
+    free(ctx->relabel_old);
+    free(ctx->relabel_keys);
+    free(ctx->relabel_offsets);
+    free(ctx->relabel_targets);
+    free(ctx->relabel_reverse);
+    free(ctx->relabel_sources);
+    free(ctx->in_degrees);
+    free(ctx->dependencies_matrix);
+    free(ctx->topology_matrix);
+    free(ctx->queue);
+    free(ctx->start_times);
+    free(ctx->levels);
+    free(ctx->critical_parents);
+    free(ctx->schedule_locks);
+    free(ctx->critical_path);
+    free(ctx->tid);
+    free(ctx->workers);
+    free(ctx->thread_cpus);
+    free(ctx->thread_ranks);
+    free(ctx->build_counts);
+    free(ctx->build_sums);
+    free(ctx->targets16);
+    free(ctx->compressed);
+    free(ctx->compressed_offsets);
+    free(ctx->compressed_bases);
+    free(ctx->thread_arena);
+    free(ctx->level_counts);
+    free(ctx->level_edges);
+    free(ctx->level_in_edges);
+    free(ctx->frontier_bits);
+    free(ctx->reverse_offsets);
+    free(ctx->reverse_sources);
+    free(ctx->bucket_counts);
+    free(ctx->bucket_cursors);
+    free(ctx->deques);
+    free(ctx->thread_statistics);
+    free(ctx->output_buffer);
+    free(ctx->output_chunks);
+    free(ctx->output_vectors);
+    pthread_mutex_destroy(&ctx->park_mutex);
+    pthread_cond_destroy(&ctx->park_cond);
+    free(ctx);
+}
+
+void toposort_set_engine(toposort_context *ctx, int engine)
+{
+    ctx->engine = engine;
+}
+
+void toposort_set_order(toposort_context *ctx, int order)
+{
+    ctx->order = order;
+}
+
+void toposort_set_relabel(toposort_context *ctx, int relabel)
+{
+    ctx->relabel = relabel;
+}
+
+void toposort_set_affinity(toposort_context *ctx, int affinity)
+{
+    ctx->affinity = affinity;
+    place_threads(ctx);
+}
+
+void toposort_set_layout(toposort_context *ctx, int layout)
+{
+    ctx->requested_layout = layout;
+}
+
+void toposort_set_mem_limit(toposort_context *ctx, long mem_limit)
+{
+    ctx->mem_limit = mem_limit > 0 ? mem_limit : 0;
+}
+
+void toposort_set_log(toposort_context *ctx, FILE *log)
+{
+    ctx->log = log;
+}
+
+void toposort_set_schedule(toposort_context *ctx, int enabled)
+{
+    ctx->schedule = enabled != 0;
+}
+
+void toposort_set_check_order(toposort_context *ctx, int enabled)
+{
+    ctx->check_order = enabled != 0;
+}
+
+const int *toposort_order(const toposort_context *ctx)
+{
+    return ctx->topology_matrix;
+}
+
+const double *toposort_start_times(const toposort_context *ctx)
+{
+    return ctx->critical_path_count >= 0 ? ctx->start_times : NULL;
+}
+
+const int *toposort_levels(const toposort_context *ctx)
+{
+    return ctx->critical_path_count >= 0 ? ctx->levels : NULL;
+}
+
+const int *toposort_critical_path(const toposort_context *ctx, int *nodes_count)
+{
+    *nodes_count = ctx->critical_path_count >= 0 ? ctx->critical_path_count : 0;
+
+    return ctx->critical_path_count >= 0 ? ctx->critical_path : NULL;
+}
+
+int toposort_nodes_count(const toposort_context *ctx)
+{
+    return ctx->nodes_count;
+}
+
+void toposort_get_stats(const toposort_context *ctx, toposort_stats *stats)
+{
+    memset(stats, 0, sizeof(toposort_stats));
+    stats->nodes_count = ctx->nodes_count;
+    stats->edges_count = ctx->edges_count;
+    stats->layout = ctx->graph_layout;
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_CSR) {
+        stats->adjacency_bytes = sizeof(long) * ((long)ctx->nodes_count + 1) + ctx->index_width / 8 * ctx->edges_count;
+        stats->index_width = ctx->index_width;
+    } else if (ctx->graph_layout == TOPOSORT_LAYOUT_BITSET) {
+        stats->adjacency_bytes = sizeof(uint64_t) * (long)ctx->row_words * ctx->nodes_count;
+    } else if (ctx->graph_layout == TOPOSORT_LAYOUT_COMPRESSED && ctx->compressed_offsets != NULL) {
+        stats->adjacency_bytes = sizeof(uint32_t) * ((long)ctx->nodes_count + 1)
+            + sizeof(long) * (((long)ctx->nodes_count >> COMPRESSED_BLOCK_SHIFT) + 1) + compressed_row(ctx, ctx->nodes_count) - ctx->compressed;
+    }
+    stats->engine = sort_engine(ctx);
+    stats->threads_count = ctx->threads_count;
+    stats->numa_nodes = ctx->numa_nodes;
+    stats->push_levels = ctx->push_levels;
+    stats->pull_levels = ctx->pull_levels;
+    stats->sorted_count = ctx->topology_matrix_index > 0 ? ctx->topology_matrix_index : 0;
+    stats->parse_time = ctx->parse_time;
+    stats->build_time = ctx->build_time;
+    stats->sort_time = ctx->sort_time;
+    stats->write_time = ctx->write_time;
+    stats->relabel_time = ctx->relabel_time;
+    stats->spill_runs = ctx->spill_runs_count;
+    stats->spill_buffer = ctx->spill_capacity * (long)sizeof(uint64_t);
+    stats->inserted = ctx->inserted;
+    stats->removed = ctx->removed;
+    stats->rejected = ctx->rejected;
+    stats->missing = ctx->missing;
+    stats->reordered = ctx->reordered_count;
+    if (ctx->critical_path_count >= 0) {
+        stats->levels_count = ctx->levels_count;
+        stats->critical_path_nodes = ctx->critical_path_count;
+        stats->critical_path_length = ctx->critical_path_length;
+    }
+    stats->counters = ctx->thread_statistics;
+}
+
+const char *toposort_error(const toposort_context *ctx)
+{
+    return ctx->error;
+}
+
+const char *toposort_layout_name(int layout)
+{
+    if (layout == TOPOSORT_LAYOUT_EXTERNAL) {
+        return "external";
+    }
+    if (layout == TOPOSORT_LAYOUT_COMPRESSED) {
+        return "compressed";
+    }
+
+    return layout == TOPOSORT_LAYOUT_BITSET ? "bitset" : "csr";
+}
+
+const char *toposort_order_name(int order)
+{
+    if (order == TOPOSORT_ORDER_LEVEL) {
+        return "level";
+    }
+
+    return order == TOPOSORT_ORDER_LEX ? "lex" : "any";
+}
+
+const char *toposort_relabel_name(int relabel)
+{
+    if (relabel == TOPOSORT_RELABEL_BFS) {
+        return "bfs";
+    }
+    if (relabel == TOPOSORT_RELABEL_RCM) {
+        return "rcm";
+    }
+
+    return relabel == TOPOSORT_RELABEL_DEGREE ? "degree" : "none";
+}
+
+const char *toposort_affinity_name(int affinity)
+{
+    if (affinity == TOPOSORT_AFFINITY_COMPACT) {
+        return "compact";
+    }
+
+    return affinity == TOPOSORT_AFFINITY_SCATTER ? "scatter" : "none";
+}
+
+const char *toposort_engine_name(int engine)
+{
+    if (engine == TOPOSORT_ENGINE_SERIAL) {
+        return "serial";
+    }
+
+    if (engine == TOPOSORT_ENGINE_HYBRID) {
+        return "hybrid";
+    }
+
+    return engine == TOPOSORT_ENGINE_STEAL ? "steal" : "level";
+}
@@ -0,0 +1,1112 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort engines, implementing the Topology sorting algorithm based on Kahn's
+// algorithm(https://en.wikipedia.org/wiki/Topological_sorting): the serial Queue engine,
+// the lock-free level-synchronous frontier engine and the work-stealing engine, along
+// with the witness cycle search run when a Graph could not be sorted.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <sched.h>
+#include "toposort_internal.h"
+
+// This function inserts a given value at the end of the Queue.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int val: The value to insert.
+// Output:
+//      0  --> Value inserted.
+//      -1 --> Queue is full.
+static inline int push_value(toposort_context *ctx, int val)
+{
+    int index;
+    if (ctx->queue_count == ctx->queue_capacity) {
+        return -1;
+    }
+
+    index = ctx->queue_head + ctx->queue_count;
+    if (index >= ctx->queue_capacity) {
+        index -= ctx->queue_capacity;
+    }
+    ctx->queue[index] = val;
+    ctx->queue_count++;
+    STATS_MAX(0, queue_high_water, ctx->queue_count);
+
+    return 0;
+}
+
+// This function returns the head value of the Queue.
+// It will also move the head of the Queue to the next
+// node, if it exists.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      retval --> Queue head value.
+//      -1     --> Queue is empty.
+static inline int pop_value(toposort_context *ctx)
+{
+    if (ctx->queue_count == 0) {
+        return -1;
+    }
+    int retval = ctx->queue[ctx->queue_head];
+    ctx->queue_head++;
+    if (ctx->queue_head == ctx->queue_capacity) {
+        ctx->queue_head = 0;
+    }
+    ctx->queue_count--;
+
+    return retval;
+}
+
+// This function inserts a value in the heap replacing the Queue in the lexicographic order,
+// a binary min-heap stored in the Queue buffer.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int val: The value to insert.
+static inline void push_heap_value(toposort_context *ctx, int val)
+{
+    int i = ctx->queue_count++;
+    while (i > 0 && ctx->queue[(i - 1) / 2] > val) {
+        ctx->queue[i] = ctx->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ctx->queue[i] = val;
+    STATS_MAX(0, queue_high_water, ctx->queue_count);
+}
+
+// This function removes the smallest value of the heap replacing the Queue in the lexicographic order.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      retval --> Smallest heap value.
+//      -1     --> Heap is empty.
+static inline int pop_heap_value(toposort_context *ctx)
+{
+    int i = 0, child, last, retval;
+    if (ctx->queue_count == 0) {
+        return -1;
+    }
+    retval = ctx->queue[0];
+    last = ctx->queue[--ctx->queue_count];
+    while ((child = 2 * i + 1) < ctx->queue_count) {
+        if (child + 1 < ctx->queue_count && ctx->queue[child + 1] < ctx->queue[child]) {
+            child++;
+        }
+        if (ctx->queue[child] >= last) {
+            break;
+        }
+        ctx->queue[i] = ctx->queue[child];
+        i = child;
+    }
+    ctx->queue[i] = last;
+
+    return retval;
+}
+
+// This function removes a dependency of a node, pushing it to the Queue(or the heap
+// in the lexicographic order) once all of its dependencies are removed.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int i: The dependent node.
+static inline void release_dependency(toposort_context *ctx, int i)
+{
+    STATS_ADD(0, edges_relaxed, 1);
+    ctx->dependencies_matrix[i]--;
+    if (ctx->dependencies_matrix[i] != 0) {
+        return;
+    }
+    // Push node to Queue.
+    if (ctx->order == TOPOSORT_ORDER_LEX) {
+        push_heap_value(ctx, i);
+    } else {
+        push_value(ctx, i);
+    }
+}
+
+// This function relaxes an edge of the schedule mode: the dependent node earliest start
+// time and level are raised to the ones reached through the edge, its predecessor on the
+// longest path being recorded. The first relaxed edge always sets them, so negative
+// weights are handled.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int u: The processed node.
+//      int v: The dependent node.
+//      double w: The edge weight.
+static inline void schedule_edge(toposort_context *ctx, int u, int v, double w)
+{
+    double candidate = ctx->start_times[u] + w;
+    if (candidate > ctx->start_times[v] || ctx->critical_parents[v] == -1) {
+        ctx->start_times[v] = candidate;
+        ctx->critical_parents[v] = u;
+    }
+    if (ctx->levels[u] + 1 > ctx->levels[v]) {
+        ctx->levels[v] = ctx->levels[u] + 1;
+    }
+}
+
+// This function relaxes an edge of the schedule mode from the parallel engines. The dependent
+// node start time, level and predecessor are updated together under its spin lock, held for
+// a few instructions only. The dependency removal that follows publishes them to the Thread
+// that processes the dependent node.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long id: The locking Thread ID.
+//      int u: The processed node.
+//      int v: The dependent node.
+//      double w: The edge weight.
+static inline void schedule_edge_atomic(toposort_context *ctx, long id, int u, int v, double w)
+{
+    while (__atomic_test_and_set(&ctx->schedule_locks[v], __ATOMIC_ACQUIRE)) {
+        STATS_ADD(id, lock_contended, 1);
+    }
+    schedule_edge(ctx, u, v, w);
+    __atomic_clear(&ctx->schedule_locks[v], __ATOMIC_RELEASE);
+    STATS_ADD(id, atomic_ops, 2);
+    (void)id;
+}
+
+// This function calculates the nodes Topology with the serial Queue engine.
+// In the lexicographic order the Queue is replaced by a heap, so the smallest ready node
+// is always processed next. Initial nodes are pushed in increasing order, already forming a heap.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+static void calculate_serial_topology(toposort_context *ctx)
+{
+    int i, current_node_index, lex = ctx->order == TOPOSORT_ORDER_LEX;
+    long edge;
+    unsigned int gap;
+    ctx->queue_capacity = ctx->nodes_count;
+    ctx->queue_head = 0;
+    ctx->queue_count = 0;
+
+    // Push initial nodes(0 dependencies) to Queue.
+    ctx->topology_matrix_index = 0;
+    for (i = 0; i < ctx->nodes_count; i++) {
+        if (ctx->dependencies_matrix[i] != 0) {
+            continue;
+        }
+        push_value(ctx, i);
+    }
+
+    // While the Queue is not empty...
+    current_node_index = lex ? pop_heap_value(ctx) : pop_value(ctx); // Retrieve Queue head
+    while (current_node_index != -1) {
+        // Remove current node dependencies and check
+        // if dependent nodes can be pushed to Queue.
+        if (ctx->graph_layout == TOPOSORT_LAYOUT_BITSET) {
+            for (i = next_bitset_edge(ctx, current_node_index, 0); i != -1; i = next_bitset_edge(ctx, current_node_index, i + 1)) {
+                release_dependency(ctx, i);
+            }
+        } else if (ctx->graph_layout == TOPOSORT_LAYOUT_COMPRESSED) {
+            const uint8_t *p = compressed_row(ctx, current_node_index);
+            const uint8_t *end = compressed_row(ctx, current_node_index + 1);
+            for (i = 0; p < end; i += gap) {
+                p = decode_varint(p, &gap);
+                release_dependency(ctx, i + gap);
+            }
+        } else {
+            FOR_EACH_CSR_EDGE(ctx, current_node_index, edge, target,
+                if (ctx->weights != NULL) {
+                    schedule_edge(ctx, current_node_index, target, ctx->weights[edge]);
+                }
+                release_dependency(ctx, target);
+            )
+        }
+        // Insert current node index to Topology matrix.
+        ctx->topology_matrix[ctx->topology_matrix_index] = current_node_index;
+        ctx->topology_matrix_index++;
+        STATS_ADD(0, nodes_processed, 1);
+        // Retrieve next node(Queue head) to process.
+        current_node_index = lex ? pop_heap_value(ctx) : pop_value(ctx);
+    }
+}
+
+// This function pushes a node at the bottom of a Thread own deque, unless it is full.
+// Only the owner Thread may push.
+// Inputs:
+//      deque *d: The deque.
+//      int val: The node to push.
+// Output:
+//      1 --> Node pushed.
+//      0 --> Deque is full.
+static inline int deque_push(deque *d, int val)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    // A stale top only makes the deque look fuller, as stealers only advance it.
+    if (b - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) > d->mask) {
+        return 0;
+    }
+    __atomic_store_n(&d->buffer[b & d->mask], val, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+// This function takes a node from the bottom of a Thread own deque.
+// Only the owner Thread may take.
+// Inputs:
+//      deque *d: The deque.
+// Output:
+//      val         --> The taken node.
+//      DEQUE_EMPTY --> Deque is empty.
+//      DEQUE_ABORT --> A stealing Thread took the last node first.
+static inline int deque_take(deque *d)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    long t;
+    int val;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return DEQUE_EMPTY;
+    }
+
+    val = __atomic_load_n(&d->buffer[b & d->mask], __ATOMIC_RELAXED);
+    if (t == b) {
+        // Last node, race against stealers for it.
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            val = DEQUE_ABORT;
+        }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return val;
+}
+
+// This function steals a node from the top of another Thread deque.
+// Inputs:
+//      deque *d: The deque.
+// Output:
+//      val         --> The stolen node.
+//      DEQUE_EMPTY --> Deque is empty.
+//      DEQUE_ABORT --> Another Thread took the node first.
+static inline int deque_steal(deque *d)
+{
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    long b;
+    int val;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return DEQUE_EMPTY;
+    }
+
+    val = __atomic_load_n(&d->buffer[t & d->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return DEQUE_ABORT;
+    }
+
+    return val;
+}
+
+// This function spills a node that did not fit its Thread full deque to the shared spill
+// segment, the Queue buffer, which every Thread takes nodes from. Each node becomes ready
+// only once, so the segment never overflows.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int val: The node to spill.
+static inline void spill_node(toposort_context *ctx, int val)
+{
+    long tail = __atomic_fetch_add(&ctx->spill_tail, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->queue[tail], val, __ATOMIC_RELEASE);
+}
+
+// This function takes a node from the shared spill segment.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      val         --> The taken node.
+//      DEQUE_EMPTY --> Spill segment is empty.
+static inline int take_spilled_node(toposort_context *ctx)
+{
+    long head = __atomic_load_n(&ctx->spill_head, __ATOMIC_ACQUIRE);
+    int val;
+    do {
+        if (head >= __atomic_load_n(&ctx->spill_tail, __ATOMIC_ACQUIRE)) {
+            return DEQUE_EMPTY;
+        }
+    } while (!__atomic_compare_exchange_n(&ctx->spill_head, &head, head + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    // The spilling Thread claims its slot before storing the node, which it is about to do.
+    while ((val = __atomic_load_n(&ctx->queue[head], __ATOMIC_ACQUIRE)) == -1) {
+        sched_yield();
+    }
+
+    return val;
+}
+
+// This function checks whether any work-stealing deque, or the spill segment, holds nodes.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Some deque or the spill segment is not empty.
+//      0 --> All of them are empty.
+static inline int work_available(toposort_context *ctx)
+{
+    for (long t = 0; t < ctx->threads_count; t++) {
+        if (__atomic_load_n(&ctx->deques[t].top, __ATOMIC_SEQ_CST) < __atomic_load_n(&ctx->deques[t].bottom, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+
+    return __atomic_load_n(&ctx->spill_head, __ATOMIC_SEQ_CST) < __atomic_load_n(&ctx->spill_tail, __ATOMIC_SEQ_CST);
+}
+
+// This function locks the work-stealing engine parking mutex, counting contended acquisitions.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long id: The locking Thread ID.
+static inline void lock_park_mutex(toposort_context *ctx, long id)
+{
+#ifdef TOPOLOGY_STATS
+    if (pthread_mutex_trylock(&ctx->park_mutex) == 0) {
+        return;
+    }
+    STATS_ADD(id, lock_contended, 1);
+#endif
+    (void)id;
+    pthread_mutex_lock(&ctx->park_mutex);
+}
+
+// This function parks an idle Thread on the condition variable, until some deque
+// holds nodes or no work remains. The mutex is only taken by idle Threads and by
+// pushing Threads that found parked ones, never on the hot path of a busy run.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long id: The parked Thread ID.
+static void park_thread(toposort_context *ctx, long id)
+{
+    lock_park_mutex(ctx, id);
+    __atomic_add_fetch(&ctx->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&ctx->pending, __ATOMIC_SEQ_CST) != 0 && !work_available(ctx)) {
+        pthread_cond_wait(&ctx->park_cond, &ctx->park_mutex);
+    }
+    __atomic_sub_fetch(&ctx->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ctx->park_mutex);
+}
+
+// This function pushes a node that became ready to a Thread own deque, or spills it when
+// the deque is full, waking a parked Thread to steal it.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      deque *d: The Thread own deque.
+//      int val: The node to push.
+static inline void push_ready_node(toposort_context *ctx, deque *d, int val)
+{
+    __atomic_add_fetch(&ctx->pending, 1, __ATOMIC_RELAXED);
+    if (!deque_push(d, val)) {
+        spill_node(ctx, val);
+    }
+    STATS_ADD(d - ctx->deques, atomic_ops, 1);
+    STATS_MAX(d - ctx->deques, queue_high_water, d->bottom - d->top);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ctx->sleepers, __ATOMIC_RELAXED) > 0) {
+        lock_park_mutex(ctx, d - ctx->deques);
+        pthread_cond_signal(&ctx->park_cond);
+        pthread_mutex_unlock(&ctx->park_mutex);
+    }
+}
+
+// This Thread function calculates the nodes Topology using work-stealing.
+// Each Thread pushes the nodes that became ready to its own bounded deque, spilling them to
+// the shared spill segment when it is full, and processes them, while idle Threads take the
+// spilled nodes, then steal nodes from the other Threads deques, starting from a random victim.
+// Topology matrix positions are claimed with an atomic increment of its index.
+// The run ends when no pushed node remains unprocessed, which also covers Graphs with
+// cycles, whose nodes never become ready. Threads failing to steal repeatedly are parked.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_steal_calculation(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    int i, current_node_index, position, idle_rounds = 0;
+    long edge;
+    unsigned int gap;
+    long t, initial = 0, id = ((worker*)arg)->id, threads_count = ctx->threads_count;
+    unsigned int seed = (unsigned int)id * 2654435761u + 1;
+    deque *own = &ctx->deques[id];
+    int *dependencies_matrix = ctx->dependencies_matrix;
+    long start, finish;
+    thread_range(ctx, id, ctx->nodes_count, &start, &finish);
+
+    // Push initial nodes(0 dependencies) of the assigned nodes range to own deque.
+    for (i = start; i < finish; i++) {
+        if (dependencies_matrix[i] == 0) {
+            if (!deque_push(own, i)) {
+                spill_node(ctx, i);
+            }
+            initial++;
+        }
+    }
+    __atomic_add_fetch(&ctx->pending, initial, __ATOMIC_RELAXED);
+    STATS_MAX(id, queue_high_water, initial);
+    // Wait for all initial nodes to be found, before any dependency is removed.
+    STATS_CLOCK(wait_start);
+    pthread_barrier_wait(&ctx->barrier);
+    STATS_IDLE(id, wait_start);
+
+    while (1) {
+        current_node_index = deque_take(own);
+        if (current_node_index < 0) {
+            STATS_ADD(id, cas_failures, current_node_index == DEQUE_ABORT);
+            // No node left to process, no more work can appear.
+            if (__atomic_load_n(&ctx->pending, __ATOMIC_ACQUIRE) == 0) {
+                break;
+            }
+            // Take a spilled node, or try to steal from each other Thread once, starting from a random one.
+            current_node_index = take_spilled_node(ctx);
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            for (t = 0; t < threads_count && current_node_index < 0; t++) {
+                long victim = (seed + t) % threads_count;
+                if (victim != id) {
+                    current_node_index = deque_steal(&ctx->deques[victim]);
+                    STATS_ADD(id, steals, current_node_index >= 0);
+                    STATS_ADD(id, failed_steals, current_node_index < 0);
+                    STATS_ADD(id, cas_failures, current_node_index == DEQUE_ABORT);
+                }
+            }
+            if (current_node_index < 0) {
+                STATS_CLOCK(idle_start);
+                if (++idle_rounds < STEAL_ROUNDS) {
+                    sched_yield();
+                } else {
+                    park_thread(ctx, id);
+                    idle_rounds = 0;
+                }
+                STATS_IDLE(id, idle_start);
+                continue;
+            }
+        }
+        idle_rounds = 0;
+
+        // Insert current node index to Topology matrix.
+        position = __atomic_fetch_add(&ctx->topology_matrix_index, 1, __ATOMIC_ACQ_REL);
+        ctx->topology_matrix[position] = current_node_index;
+        STATS_ADD(id, nodes_processed, 1);
+        STATS_ADD(id, atomic_ops, 2);
+
+        // Remove current node dependencies and push the dependent nodes that became ready.
+        if (ctx->graph_layout == TOPOSORT_LAYOUT_BITSET) {
+            for (i = next_bitset_edge(ctx, current_node_index, 0); i != -1; i = next_bitset_edge(ctx, current_node_index, i + 1)) {
+                STATS_ADD(id, edges_relaxed, 1);
+                if (__atomic_sub_fetch(&dependencies_matrix[i], 1, __ATOMIC_ACQ_REL) == 0) {
+                    push_ready_node(ctx, own, i);
+                }
+            }
+        } else if (ctx->graph_layout == TOPOSORT_LAYOUT_COMPRESSED) {
+            const uint8_t *p = compressed_row(ctx, current_node_index);
+            const uint8_t *end = compressed_row(ctx, current_node_index + 1);
+            for (i = 0; p < end; ) {
+                p = decode_varint(p, &gap);
+                i += gap;
+                STATS_ADD(id, edges_relaxed, 1);
+                if (__atomic_sub_fetch(&dependencies_matrix[i], 1, __ATOMIC_ACQ_REL) == 0) {
+                    push_ready_node(ctx, own, i);
+                }
+            }
+        } else {
+            FOR_EACH_CSR_EDGE(ctx, current_node_index, edge, target,
+                STATS_ADD(id, edges_relaxed, 1);
+                if (ctx->weights != NULL) {
+                    schedule_edge_atomic(ctx, id, current_node_index, target, ctx->weights[edge]);
+                }
+                if (__atomic_sub_fetch(&dependencies_matrix[target], 1, __ATOMIC_ACQ_REL) == 0) {
+                    push_ready_node(ctx, own, target);
+                }
+            )
+        }
+
+        // Current node is processed, wake all parked Threads if it was the last one.
+        if (__atomic_sub_fetch(&ctx->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            lock_park_mutex(ctx, id);
+            pthread_cond_broadcast(&ctx->park_cond);
+            pthread_mutex_unlock(&ctx->park_mutex);
+        }
+    }
+
+    return (NULL);
+}
+
+// This function appends a node to a Thread next frontier buffer of the level engine.
+// A full buffer is flushed to the Topology matrix, after the current frontier,
+// at a position reserved with an atomic increment of the level flushed nodes tail.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int *buffer: The Thread buffer.
+//      int *count: The Thread buffer nodes count.
+//      int level: The current level.
+//      int i: The node to append.
+static inline void append_level_node(toposort_context *ctx, int *buffer, int *count, int level, int i)
+{
+    if (*count == LEVEL_BUFFER) {
+        int position = __atomic_fetch_add(&ctx->frontier_tails[level & 1], LEVEL_BUFFER, __ATOMIC_RELAXED);
+        STATS_ADD((buffer - ctx->thread_arena) / LEVEL_BUFFER, atomic_ops, 1);
+        memcpy(ctx->topology_matrix + position, buffer, sizeof(int) * LEVEL_BUFFER);
+        *count = 0;
+    }
+    buffer[(*count)++] = i;
+}
+
+// This function sorts a level engine frontier in the level order, with every Thread.
+// Small frontiers are sorted by Thread 0. Larger ones are partitioned by node ranges,
+// one per Thread: each Thread counts the nodes of its frontier slice falling in each
+// range, scatters them to the Queue buffer at offsets given by a prefix sum of the counts,
+// and then sorts its own range and copies it back, so no Thread sorts the whole frontier.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long id: The Thread ID.
+//      int frontier_start: The frontier first position in the Topology matrix.
+//      int frontier_end: The frontier end position in the Topology matrix.
+static void sort_frontier(toposort_context *ctx, long id, int frontier_start, int frontier_end)
+{
+    long t, b, threads_count = ctx->threads_count;
+    int i, position, range_start = 0, range_end = 0, count = frontier_end - frontier_start;
+    int *frontier = ctx->topology_matrix + frontier_start, *scratch = ctx->queue + frontier_start;
+    int *counts = ctx->bucket_counts + id * threads_count;
+    long *cursors = ctx->bucket_cursors + id * threads_count;
+    int slice_start = (long)count * id / threads_count;
+    int slice_end = (long)count * (id + 1) / threads_count;
+    if (count <= LEVEL_SORT_SERIAL || threads_count == 1) {
+        if (id == 0) {
+            sort_nodes(frontier, count);
+        }
+        pthread_barrier_wait(&ctx->barrier);
+        return;
+    }
+
+    memset(counts, 0, sizeof(int) * threads_count);
+    for (i = slice_start; i < slice_end; i++) {
+        counts[(long)frontier[i] * threads_count / ctx->nodes_count]++;
+    }
+    pthread_barrier_wait(&ctx->barrier);
+    // A range follows the smaller ranges, and within a range a slice follows the previous slices.
+    position = 0;
+    for (b = 0; b < threads_count; b++) {
+        if (b == id) {
+            range_start = position;
+        }
+        for (t = 0; t < threads_count; t++) {
+            if (t == id) {
+                cursors[b] = position;
+            }
+            position += ctx->bucket_counts[t * threads_count + b];
+        }
+        if (b == id) {
+            range_end = position;
+        }
+    }
+    for (i = slice_start; i < slice_end; i++) {
+        scratch[cursors[(long)frontier[i] * threads_count / ctx->nodes_count]++] = frontier[i];
+    }
+    pthread_barrier_wait(&ctx->barrier);
+    sort_nodes(scratch + range_start, range_end - range_start);
+    memcpy(frontier + range_start, scratch + range_start, sizeof(int) * (range_end - range_start));
+    pthread_barrier_wait(&ctx->barrier);
+}
+
+// This function removes the dependencies of the unsorted nodes of a Thread nodes range on the
+// current frontier, marked in the frontier bitmap, in a pull level of the hybrid engine.
+// Each node is only updated by the Thread owning its range, so no atomic operation is needed.
+// The scan of a node dependencies stops once all its remaining ones are found on the frontier.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long id: The Thread ID.
+//      int *buffer: The Thread next frontier buffer.
+//      int *count: The Thread buffer nodes count.
+//      int level: The current level.
+//      long *ready_in_edges: The dependencies count of the nodes that became ready, added to it.
+// Output:
+//      The out-edges count of the nodes that became ready.
+static long pull_frontier(toposort_context *ctx, long id, int *buffer, int *count, int level, long *ready_in_edges)
+{
+    const uint64_t *bits = ctx->frontier_bits;
+    int v, removed, remaining;
+    long edge, start, finish, ready_edges = 0;
+    thread_range(ctx, id, ctx->nodes_count, &start, &finish);
+    for (v = start; v < finish; v++) {
+        remaining = ctx->dependencies_matrix[v];
+        if (remaining == 0) {
+            continue;
+        }
+        removed = 0;
+        for (edge = ctx->reverse_offsets[v]; edge < ctx->reverse_offsets[v + 1] && removed < remaining; edge++) {
+            int u = ctx->reverse_sources[edge];
+            removed += (bits[u >> 6] >> (u & 63)) & 1;
+        }
+        STATS_ADD(id, edges_relaxed, edge - ctx->reverse_offsets[v]);
+        if (removed > 0 && (ctx->dependencies_matrix[v] -= removed) == 0) {
+            append_level_node(ctx, buffer, count, level, v);
+            ready_edges += ctx->offsets[v + 1] - ctx->offsets[v];
+            *ready_in_edges += ctx->in_degrees[v];
+        }
+    }
+
+    return ready_edges;
+}
+
+// This Thread function calculates the nodes Topology frontier by frontier(level-synchronous).
+// The current frontier is a slice of the Topology matrix, processed in chunks claimed with
+// an atomic cursor. Dependencies are removed with atomic decrements, and each Thread collects
+// the nodes that became ready in its own bounded buffer, flushing it after the frontier when full.
+// Remaining buffered nodes are then copied after the flushed ones, at offsets given by a prefix
+// sum of the buffer counts, forming the next frontier.
+// No mutex is taken; Threads only synchronize on a barrier twice per level, plus the
+// frontier sort barriers in the level order.
+// The flushed nodes tail alternates between two variables per level, so Thread 0 can set
+// the next level one while the other Threads still read the current level one.
+// The hybrid engine also sums the out-edges and dependencies of the buffered nodes, and every
+// Thread picks the direction of the next frontier from the same sums. A pull scans the
+// dependencies of every unsorted node, so only the frontiers whose out-edges times
+// HYBRID_PULL_RATIO exceed them are marked in a bitmap and pulled, the others are pushed.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_level_calculation(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    int i, node_index, chunk_end, position, next_end, count = 0, level = 0;
+    unsigned int gap;
+    long t, id = ((worker*)arg)->id, threads_count = ctx->threads_count;
+    int *buffer = ctx->thread_arena + id * LEVEL_BUFFER;
+    int *dependencies_matrix = ctx->dependencies_matrix, *topology_matrix = ctx->topology_matrix;
+    int frontier_start = 0, frontier_end = 0, pull = 0;
+    int hybrid = sort_engine(ctx) == TOPOSORT_ENGINE_HYBRID;
+    long edge, start, finish, next_edges, ready_edges = 0, ready_in_edges = 0, unsorted_in_edges = ctx->edges_count;
+    thread_range(ctx, id, ctx->nodes_count, &start, &finish);
+
+    // Collect initial nodes(0 dependencies) of the assigned nodes range.
+    for (i = start; i < finish; i++) {
+        if (dependencies_matrix[i] == 0) {
+            append_level_node(ctx, buffer, &count, level, i);
+            if (hybrid) {
+                ready_edges += ctx->offsets[i + 1] - ctx->offsets[i];
+            }
+        }
+    }
+
+    while (1) {
+        ctx->level_counts[id] = count;
+        ctx->level_edges[id] = ready_edges;
+        ctx->level_in_edges[id] = ready_in_edges;
+        STATS_MAX(id, queue_high_water, count);
+        STATS_CLOCK(wait_start);
+        pthread_barrier_wait(&ctx->barrier);
+        STATS_IDLE(id, wait_start);
+        // Every Thread computes the prefix sum of the buffer counts, to find its next frontier offset.
+        position = ctx->frontier_tails[level & 1];
+        next_end = position;
+        for (t = 0; t < threads_count; t++) {
+            if (t < id) {
+                position += ctx->level_counts[t];
+            }
+            next_end += ctx->level_counts[t];
+        }
+        memcpy(topology_matrix + position, buffer, sizeof(int) * count);
+        if (hybrid) {
+            if (pull) {
+                // The pulled frontier is done, each Thread clears its slice of the bitmap.
+                size_t words = ((size_t)ctx->nodes_count + 63) / 64;
+                size_t first = words * id / threads_count, last = words * (id + 1) / threads_count;
+                memset(ctx->frontier_bits + first, 0, sizeof(uint64_t) * (last - first));
+            }
+            // The next frontier nodes leave the unsorted nodes, the ones a pull would scan.
+            next_edges = 0;
+            for (t = 0; t < threads_count; t++) {
+                next_edges += ctx->level_edges[t];
+                unsorted_in_edges -= ctx->level_in_edges[t];
+            }
+            pull = next_edges * HYBRID_PULL_RATIO > unsorted_in_edges;
+        }
+        if (id == 0) {
+            ctx->frontier_cursor = frontier_end;
+            ctx->frontier_tails[(level + 1) & 1] = next_end;
+            if (hybrid && next_end > frontier_end) {
+                ctx->pull_levels += pull;
+                ctx->push_levels += !pull;
+            }
+        }
+        STATS_CLOCK(level_start);
+        pthread_barrier_wait(&ctx->barrier);
+        STATS_IDLE(id, level_start);
+        if (next_end == frontier_end) {
+            break;
+        }
+        if (ctx->order == TOPOSORT_ORDER_LEVEL) {
+            sort_frontier(ctx, id, frontier_end, next_end);
+        }
+
+        // Process the next frontier, pulling it or claiming chunks of nodes.
+        frontier_start = frontier_end;
+        frontier_end = next_end;
+        level++;
+        count = 0;
+        ready_edges = 0;
+        ready_in_edges = 0;
+        if (pull) {
+            int slice_start = frontier_start + (long)(frontier_end - frontier_start) * id / threads_count;
+            int slice_end = frontier_start + (long)(frontier_end - frontier_start) * (id + 1) / threads_count;
+            for (node_index = slice_start; node_index < slice_end; node_index++) {
+                int u = topology_matrix[node_index];
+                __atomic_fetch_or(&ctx->frontier_bits[u >> 6], (uint64_t)1 << (u & 63), __ATOMIC_RELAXED);
+            }
+            STATS_ADD(id, nodes_processed, slice_end - slice_start);
+            STATS_ADD(id, atomic_ops, slice_end - slice_start);
+            STATS_CLOCK(pull_start);
+            pthread_barrier_wait(&ctx->barrier);
+            STATS_IDLE(id, pull_start);
+            ready_edges = pull_frontier(ctx, id, buffer, &count, level, &ready_in_edges);
+            continue;
+        }
+        while ((node_index = __atomic_fetch_add(&ctx->frontier_cursor, LEVEL_CHUNK, __ATOMIC_RELAXED)) < frontier_end) {
+            chunk_end = node_index + LEVEL_CHUNK < frontier_end ? node_index + LEVEL_CHUNK : frontier_end;
+            STATS_ADD(id, nodes_processed, chunk_end - node_index);
+            STATS_ADD(id, atomic_ops, 1);
+            for (; node_index < chunk_end; node_index++) {
+                int current_node_index = topology_matrix[node_index];
+                if (ctx->graph_layout == TOPOSORT_LAYOUT_BITSET) {
+                    for (i = next_bitset_edge(ctx, current_node_index, 0); i != -1; i = next_bitset_edge(ctx, current_node_index, i + 1)) {
+                        STATS_ADD(id, edges_relaxed, 1);
+                        if (__atomic_sub_fetch(&dependencies_matrix[i], 1, __ATOMIC_ACQ_REL) == 0) {
+                            append_level_node(ctx, buffer, &count, level, i);
+                        }
+                    }
+                } else if (ctx->graph_layout == TOPOSORT_LAYOUT_COMPRESSED) {
+                    const uint8_t *p = compressed_row(ctx, current_node_index);
+                    const uint8_t *end = compressed_row(ctx, current_node_index + 1);
+                    for (i = 0; p < end; ) {
+                        p = decode_varint(p, &gap);
+                        i += gap;
+                        STATS_ADD(id, edges_relaxed, 1);
+                        if (__atomic_sub_fetch(&dependencies_matrix[i], 1, __ATOMIC_ACQ_REL) == 0) {
+                            append_level_node(ctx, buffer, &count, level, i);
+                        }
+                    }
+                } else {
+                    FOR_EACH_CSR_EDGE(ctx, current_node_index, edge, target,
+                        STATS_ADD(id, edges_relaxed, 1);
+                        if (ctx->weights != NULL) {
+                            schedule_edge_atomic(ctx, id, current_node_index, target, ctx->weights[edge]);
+                        }
+                        if (__atomic_sub_fetch(&dependencies_matrix[target], 1, __ATOMIC_ACQ_REL) == 0) {
+                            append_level_node(ctx, buffer, &count, level, target);
+                            if (hybrid) {
+                                ready_edges += ctx->offsets[target + 1] - ctx->offsets[target];
+                                ready_in_edges += ctx->in_degrees[target];
+                            }
+                        }
+                    )
+                }
+            }
+        }
+    }
+
+    if (id == 0) {
+        ctx->topology_matrix_index = frontier_end;
+    }
+
+    return (NULL);
+}
+
+// This function returns the engine calculating the requested Topology order: the level
+// order is calculated by the level engine and the lexicographic one by the serial engine,
+// while the out-of-core mode has its own serial engine.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+// Output:
+//      The engine.
+int sort_engine(const toposort_context *ctx)
+{
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_EXTERNAL || ctx->order == TOPOSORT_ORDER_LEX) {
+        return TOPOSORT_ENGINE_SERIAL;
+    }
+
+    return ctx->order == TOPOSORT_ORDER_LEVEL ? TOPOSORT_ENGINE_LEVEL : ctx->engine;
+}
+
+// This function allocates the per Thread buffers of the context engine. The level and hybrid
+// engines use bounded next frontier buffers, the hybrid one also a frontier bitmap, and the
+// work-stealing engine bounded deques of the same capacity.
+// All per Thread buffers are slices of a single arena, kept between sorts.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Allocated successfully.
+//      0 --> Something went wrong.
+int reserve_engine_buffers(toposort_context *ctx)
+{
+    long t;
+    int engine = sort_engine(ctx);
+    if (engine == TOPOSORT_ENGINE_SERIAL) {
+        return 1;
+    }
+
+    if (!reserve_buffer((void**)&ctx->thread_arena, &ctx->arena_allocated, sizeof(int) * LEVEL_BUFFER * ctx->threads_count)) {
+        return 0;
+    }
+    if (engine == TOPOSORT_ENGINE_HYBRID) {
+        size_t size = sizeof(uint64_t) * (((size_t)ctx->nodes_count + 63) / 64);
+        if (!reserve_buffer((void**)&ctx->frontier_bits, &ctx->frontier_bits_allocated, size)) {
+            return 0;
+        }
+        memset(ctx->frontier_bits, 0, size);
+    }
+    for (t = 0; t < ctx->threads_count; t++) {
+        ctx->deques[t].top = 0;
+        ctx->deques[t].bottom = 0;
+        ctx->deques[t].mask = LEVEL_BUFFER - 1;
+        ctx->deques[t].buffer = ctx->thread_arena + t * LEVEL_BUFFER;
+    }
+
+    return 1;
+}
+
+// This function finds the critical path of a schedule mode sort, following the longest path
+// predecessors back from the node with the largest earliest start time, and the levels count.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+static void find_critical_path(toposort_context *ctx)
+{
+    int i, last = 0, count = 0, levels_count = 0;
+    for (i = 0; i < ctx->nodes_count; i++) {
+        if (ctx->start_times[i] > ctx->start_times[last]) {
+            last = i;
+        }
+        if (ctx->levels[i] + 1 > levels_count) {
+            levels_count = ctx->levels[i] + 1;
+        }
+    }
+    for (i = last; i != -1; i = ctx->critical_parents[i]) {
+        ctx->critical_path[count++] = i;
+    }
+    // The path was collected backwards.
+    for (i = 0; i < count / 2; i++) {
+        int node = ctx->critical_path[i];
+        ctx->critical_path[i] = ctx->critical_path[count - 1 - i];
+        ctx->critical_path[count - 1 - i] = node;
+    }
+    ctx->critical_path_count = count;
+    ctx->critical_path_length = ctx->start_times[last];
+    ctx->levels_count = levels_count;
+}
+
+int toposort_sort(toposort_context *ctx)
+{
+    double start = wall_time();
+    int engine = sort_engine(ctx);
+    if (ctx->graph_modified) {
+        set_error(ctx, "Graph holds an incremental delta, load it again before sorting.");
+        return 0;
+    }
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_EXTERNAL && ctx->order == TOPOSORT_ORDER_LEX) {
+        set_error(ctx, "Lexicographic order is not available in out-of-core mode.");
+        return 0;
+    }
+    if (engine == TOPOSORT_ENGINE_HYBRID && ctx->graph_layout != TOPOSORT_LAYOUT_CSR) {
+        set_error(ctx, "Hybrid engine requires the csr layout.");
+        return 0;
+    }
+    if (engine == TOPOSORT_ENGINE_HYBRID && ctx->weights != NULL) {
+        set_error(ctx, "Hybrid engine cannot calculate a schedule.");
+        return 0;
+    }
+    if (ctx->relabeled && ctx->order != TOPOSORT_ORDER_ANY) {
+        // The heap and the frontiers sort would compare the relabeled nodes.
+        set_error(ctx, "Relabeled Graphs cannot be sorted in a deterministic order.");
+        return 0;
+    }
+    ctx->topology_matrix_index = 0;
+    ctx->critical_path_count = -1;
+    ctx->push_levels = 0;
+    ctx->pull_levels = 0;
+    if (ctx->nodes_count == 0) {
+        return 1;
+    }
+    if (ctx->graph_layout != TOPOSORT_LAYOUT_EXTERNAL && !reserve_engine_buffers(ctx)) {
+        set_error(ctx, "Failed to allocate memory for the engine buffers.");
+        ctx->topology_matrix_index = -1;
+        return 0;
+    }
+    if (engine == TOPOSORT_ENGINE_HYBRID && !reverse_graph(ctx)) {
+        ctx->topology_matrix_index = -1;
+        return 0;
+    }
+
+    // Each sort starts over from the Graph dependencies count.
+    memcpy(ctx->dependencies_matrix, ctx->in_degrees, sizeof(int) * ctx->nodes_count);
+    if (ctx->weights != NULL) {
+        memset(ctx->start_times, 0, sizeof(double) * ctx->nodes_count);
+        memset(ctx->levels, 0, sizeof(int) * ctx->nodes_count);
+        memset(ctx->critical_parents, 0xFF, sizeof(int) * ctx->nodes_count);
+        memset(ctx->schedule_locks, 0, ctx->nodes_count);
+    }
+#ifdef TOPOLOGY_STATS
+    memset(ctx->thread_statistics, 0, ctx->threads_count * sizeof(toposort_counters));
+#endif
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_EXTERNAL) {
+        calculate_external_topology(ctx);
+    } else if (engine == TOPOSORT_ENGINE_SERIAL) {
+        calculate_serial_topology(ctx);
+    } else {
+        ctx->frontier_tails[0] = 0;
+        ctx->pending = 0;
+        ctx->sleepers = 0;
+        if (engine == TOPOSORT_ENGINE_STEAL) {
+            // Spill segment slots are empty until their node is stored.
+            ctx->spill_head = 0;
+            ctx->spill_tail = 0;
+            memset(ctx->queue, 0xFF, sizeof(int) * ctx->nodes_count);
+        }
+        pthread_barrier_init(&ctx->barrier, NULL, ctx->threads_count);
+        run_workers(ctx, engine == TOPOSORT_ENGINE_STEAL ? thread_steal_calculation : thread_level_calculation);
+        pthread_barrier_destroy(&ctx->barrier);
+    }
+    if (ctx->weights != NULL && ctx->topology_matrix_index == ctx->nodes_count) {
+        find_critical_path(ctx);
+    }
+    if (ctx->relabeled) {
+        restore_labels(ctx);
+    }
+    ctx->sort_time = wall_time() - start;
+
+    if (ctx->topology_matrix_index < ctx->nodes_count) {
+        set_error(ctx, "Graph contains a cycle, only %d of %d nodes were sorted.", ctx->topology_matrix_index, ctx->nodes_count);
+        return 0;
+    }
+    return 1;
+}
+
+// This function finds the next out-edge of a node that leads to an unsorted node.
+// Unsorted nodes are the ones still having dependencies after the calculation.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      int u: The node whose out-edges are scanned.
+//      long *position: The scan position, an edge index for CSR or a target node for bitset and compressed.
+// Output:
+//      target --> Next unsorted target node.
+//      -1     --> No more out-edges to unsorted nodes.
+static inline int next_unsorted_edge(const toposort_context *ctx, int u, long *position)
+{
+    int v;
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_BITSET) {
+        for (v = next_bitset_edge(ctx, u, *position); v != -1; v = next_bitset_edge(ctx, u, v + 1)) {
+            if (ctx->dependencies_matrix[v] > 0) {
+                *position = v + 1;
+                return v;
+            }
+        }
+        *position = ctx->nodes_count;
+        return -1;
+    }
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_COMPRESSED) {
+        // Rows are sorted, so the scan resumes after the last target returned.
+        const uint8_t *p = compressed_row(ctx, u);
+        const uint8_t *end = compressed_row(ctx, u + 1);
+        unsigned int gap;
+        for (v = 0; p < end; ) {
+            p = decode_varint(p, &gap);
+            v += gap;
+            if (v >= *position && ctx->dependencies_matrix[v] > 0) {
+                *position = v + 1;
+                return v;
+            }
+        }
+        *position = ctx->nodes_count;
+        return -1;
+    }
+
+    for (; *position < ctx->offsets[u + 1]; (*position)++) {
+        v = ctx->index_width == 16 ? ctx->targets16[*position] : ctx->targets[*position];
+        if (ctx->dependencies_matrix[v] > 0) {
+            (*position)++;
+            return v;
+        }
+    }
+
+    return -1;
+}
+
+// Every unsorted node still depends on another unsorted node, so the unsorted nodes
+// subgraph contains a cycle, found with an iterative depth-first search on it.
+int toposort_report_cycle(toposort_context *ctx)
+{
+    int i, u, v, depth, length, root, nodes_count = ctx->nodes_count;
+    int *state, *stack;
+    long *position;
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_EXTERNAL) {
+        set_error(ctx, "Witness cycle search is not available in out-of-core mode.");
+        return 0;
+    }
+    if (ctx->topology_matrix_index < 0) {
+        set_error(ctx, "Graph was not sorted.");
+        return 0;
+    }
+    if (ctx->topology_matrix_index == nodes_count) {
+        set_error(ctx, "Graph was sorted without a cycle.");
+        return 0;
+    }
+    state = (int*)malloc(sizeof(int) * nodes_count);    // 0: unvisited, -1: finished, k: stack depth k - 1.
+    stack = (int*)malloc(sizeof(int) * nodes_count);    // Search stack nodes.
+    position = (long*)malloc(sizeof(long) * nodes_count); // Search stack nodes scan position.
+    if ((state == NULL) || (stack == NULL) || (position == NULL)) {
+        set_error(ctx, "Could not allocate memory for the cycle search.");
+        free(state);
+        free(stack);
+        free(position);
+        return 0;
+    }
+
+    memset(state, 0, sizeof(int) * nodes_count);
+    for (root = 0; root < nodes_count; root++) {
+        if (ctx->dependencies_matrix[root] <= 0 || state[root] != 0) {
+            continue;
+        }
+        depth = 0;
+        stack[0] = root;
+        position[0] = ctx->graph_layout == TOPOSORT_LAYOUT_CSR ? ctx->offsets[root] : 0;
+        state[root] = 1;
+        while (depth >= 0) {
+            u = stack[depth];
+            v = next_unsorted_edge(ctx, u, &position[depth]);
+            if (v == -1) {
+                state[u] = -1;
+                depth--;
+                continue;
+            }
+            if (state[v] == 0) {
+                depth++;
+                stack[depth] = v;
+                position[depth] = ctx->graph_layout == TOPOSORT_LAYOUT_CSR ? ctx->offsets[v] : 0;
+                state[v] = depth + 1;
+                continue;
+            }
+            if (state[v] > 0) {
+                // Back edge, the stack from v up to u is a cycle.
+                length = depth - (state[v] - 1) + 1;
+                log_message(ctx, "Witness cycle(%d nodes): ", length);
+                for (i = state[v] - 1; i <= depth && i < state[v] - 1 + CYCLE_PRINT_LIMIT; i++) {
+                    log_message(ctx, "%d -> ", ctx->relabeled ? ctx->relabel_old[stack[i]] : stack[i]);
+                }
+                if (length > CYCLE_PRINT_LIMIT) {
+                    log_message(ctx, "... -> ");
+                }
+                log_message(ctx, "%d\n", ctx->relabeled ? ctx->relabel_old[v] : v);
+                free(state);
+                free(stack);
+                free(position);
+                return 1;
+            }
+        }
+    }
+
+    set_error(ctx, "No cycle found among the unsorted nodes.");
+    free(state);
+    free(stack);
+    free(position);
+    return 0;
+}
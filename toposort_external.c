@@ -0,0 +1,514 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort out-of-core mode, sorting text Graphs larger than memory within a memory limit.
+// The edges are streamed from the input file into sorted spill runs, merged into an adjacency
+// file sorted by source, and read back block by block while the frontiers are processed.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include "toposort_internal.h"
+
+// This function creates an anonymous spill file, in the TMPDIR directory or in /tmp.
+// The file is unlinked at once, so it is removed when closed.
+// Output:
+//      The spill file, NULL if it could not be created.
+static FILE *create_spill_file()
+{
+    const char *directory = getenv("TMPDIR");
+    char path[4096];
+    FILE *file;
+    int fd;
+    snprintf(path, sizeof(path), "%s/topology_spill_XXXXXX", directory != NULL ? directory : "/tmp");
+    fd = mkstemp(path);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    unlink(path);
+    file = fdopen(fd, "w+b");
+    if (file == NULL) {
+        close(fd);
+    }
+    return file;
+}
+
+// This function sorts packed edges by source in place, with a quicksort recursing on
+// the smaller partition. Unlike qsort(), it allocates no memory, keeping the
+// out-of-core mode within its memory limit.
+// Inputs:
+//      uint64_t *edges: The edges.
+//      long count: The edges count.
+void sort_edges(uint64_t *edges, long count)
+{
+    while (count > 16) {
+        uint64_t pivot = edges[count / 2], swap;
+        long i = -1, j = count;
+        while (1) {
+            while (edges[++i] < pivot);
+            while (edges[--j] > pivot);
+            if (i >= j) {
+                break;
+            }
+            swap = edges[i];
+            edges[i] = edges[j];
+            edges[j] = swap;
+        }
+        if (j + 1 < count - j - 1) {
+            sort_edges(edges, j + 1);
+            edges += j + 1;
+            count -= j + 1;
+        } else {
+            sort_edges(edges + j + 1, count - j - 1);
+            count = j + 1;
+        }
+    }
+    for (long i = 1; i < count; i++) {
+        uint64_t edge = edges[i];
+        long j = i;
+        for (; j > 0 && edges[j - 1] > edge; j--) {
+            edges[j] = edges[j - 1];
+        }
+        edges[j] = edge;
+    }
+}
+
+// This function sorts nodes in place, with a quicksort recursing on the smaller partition.
+// Inputs:
+//      int *nodes: The nodes.
+//      long count: The nodes count.
+void sort_nodes(int *nodes, long count)
+{
+    while (count > 16) {
+        int pivot = nodes[count / 2], swap;
+        long i = -1, j = count;
+        while (1) {
+            while (nodes[++i] < pivot);
+            while (nodes[--j] > pivot);
+            if (i >= j) {
+                break;
+            }
+            swap = nodes[i];
+            nodes[i] = nodes[j];
+            nodes[j] = swap;
+        }
+        if (j + 1 < count - j - 1) {
+            sort_nodes(nodes, j + 1);
+            nodes += j + 1;
+            count -= j + 1;
+        } else {
+            sort_nodes(nodes + j + 1, count - j - 1);
+            count = j + 1;
+        }
+    }
+    for (long i = 1; i < count; i++) {
+        int node = nodes[i];
+        long j = i;
+        for (; j > 0 && nodes[j - 1] > node; j--) {
+            nodes[j] = nodes[j - 1];
+        }
+        nodes[j] = node;
+    }
+}
+
+// This function sorts the buffered edges by source and writes them to a new spill run.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      long count: The buffered edges count.
+// Output:
+//      1 --> Spilled successfully.
+//      0 --> Something went wrong.
+static int spill_run(toposort_context *ctx, long count)
+{
+    FILE **runs = (FILE**)realloc(ctx->spill_runs, sizeof(FILE*) * (ctx->spill_runs_count + 1));
+    if (runs == NULL) {
+        set_error(ctx, "Failed to allocate memory for the spill runs.");
+        return 0;
+    }
+    ctx->spill_runs = runs;
+
+    sort_edges(ctx->spill_buffer, count);
+    runs[ctx->spill_runs_count] = create_spill_file();
+    if (runs[ctx->spill_runs_count] == NULL) {
+        set_error(ctx, "Cannot create spill file.");
+        return 0;
+    }
+    ctx->spill_runs_count++;
+    if (fwrite(ctx->spill_buffer, sizeof(uint64_t), count, runs[ctx->spill_runs_count - 1]) != (size_t)count
+        || fflush(runs[ctx->spill_runs_count - 1]) != 0) {
+        set_error(ctx, "Failed to write spill file.");
+        return 0;
+    }
+
+    return 1;
+}
+
+// This function streams the edges of the mapped input file in out-of-core mode.
+// The nodes dependencies are counted in memory, while the edges are buffered and
+// spilled to sorted runs whenever the buffer fills. Input pages are dropped once
+// parsed, so the file is read sequentially without staying resident.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Edges spilled successfully.
+//      0 --> Something went wrong.
+static int spill_edges(toposort_context *ctx)
+{
+    int i, j, nodes_count = ctx->nodes_count;
+    double w;
+    long count = 0, total = 0;
+    const char *p = ctx->input_body;
+    const char *end = ctx->input_data + ctx->input_size;
+    const char *dropped = ctx->input_data;
+    while (1) {
+        const char *line = p = skip_spaces(p, end);
+        if (p == end) {
+            break;
+        }
+        p = scan_int(p, end, &i);
+        if (p != NULL && i == -1) {
+            break;
+        }
+        if (p != NULL) {
+            p = scan_int(p, end, &j);
+        }
+        if (p != NULL) {
+            p = scan_double(p, end, &w);
+        }
+        if (p == NULL || i < 0 || i >= nodes_count || j < 0 || j >= nodes_count) {
+            set_error(ctx, "Invalid edge in input file at byte %ld.", (long)(line - ctx->input_data));
+            return 0;
+        }
+
+        ctx->in_degrees[j]++;
+        ctx->spill_buffer[count++] = (uint64_t)i << 32 | (uint32_t)j;
+        if (count == ctx->spill_capacity) {
+            if (!spill_run(ctx, count)) {
+                return 0;
+            }
+            count = 0;
+        }
+        total++;
+        if (p - dropped >= SPILL_WINDOW) {
+            // Drop the parsed input pages, keeping the page of the current position.
+            long length = ((p - dropped) / SPILL_WINDOW) * SPILL_WINDOW;
+            madvise((void*)dropped, length, MADV_DONTNEED);
+            dropped += length;
+        }
+    }
+
+    ctx->edges_count = total;
+    return count == 0 && ctx->spill_runs_count > 0 ? 1 : spill_run(ctx, count);
+}
+
+// This function merges sorted spill runs into an output file, with a k-way merge over a
+// min-heap of the runs heads. The edges buffer is split into a read buffer for each run
+// and a write buffer, so memory stays bounded. The merged runs are closed.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      FILE **runs: The runs to merge.
+//      int count: The runs count.
+//      FILE *output: The output file.
+//      int indexed: Build the adjacency sparse index of the output file.
+// Output:
+//      1 --> Merged successfully.
+//      0 --> Something went wrong.
+static int merge_spill_runs(toposort_context *ctx, FILE **runs, int count, FILE *output, int indexed)
+{
+    int r, k, parent, child, heap_count = 0;
+    long block = 0, position = 0, written = 0;
+    long share = ctx->spill_capacity / (count + 1);
+    long run_count[count], run_next[count];
+    int heap[count];
+    uint64_t edge, *spill_buffer = ctx->spill_buffer, *buffer = spill_buffer + share * count;
+
+    // Load the head of each run and build the min-heap.
+    for (r = 0; r < count; r++) {
+        rewind(runs[r]);
+        run_next[r] = 0;
+        run_count[r] = fread(spill_buffer + share * r, sizeof(uint64_t), share, runs[r]);
+        if (run_count[r] > 0) {
+            heap[heap_count++] = r;
+        }
+    }
+    #define RUN_HEAD(r) (spill_buffer[share * (r) + run_next[r]])
+    for (k = heap_count - 1; k >= 0; k--) {
+        for (parent = k; (child = 2 * parent + 1) < heap_count; parent = child) {
+            if (child + 1 < heap_count && RUN_HEAD(heap[child + 1]) < RUN_HEAD(heap[child])) {
+                child++;
+            }
+            if (RUN_HEAD(heap[parent]) <= RUN_HEAD(heap[child])) {
+                break;
+            }
+            r = heap[parent];
+            heap[parent] = heap[child];
+            heap[child] = r;
+        }
+    }
+
+    while (heap_count > 0) {
+        r = heap[0];
+        edge = RUN_HEAD(r);
+        // Index the first edge of every nodes block reached.
+        for (; indexed && block <= (long)(edge >> 32) / SPILL_INDEX_STRIDE; block++) {
+            ctx->adjacency_index[block] = position;
+        }
+        buffer[written++] = edge;
+        position++;
+        if (written == share) {
+            if (fwrite(buffer, sizeof(uint64_t), written, output) != (size_t)written) {
+                return 0;
+            }
+            written = 0;
+        }
+
+        // Advance the run, refilling its buffer or removing it from the heap when exhausted.
+        if (++run_next[r] == run_count[r]) {
+            run_count[r] = fread(spill_buffer + share * r, sizeof(uint64_t), share, runs[r]);
+            run_next[r] = 0;
+            if (run_count[r] == 0) {
+                heap[0] = heap[--heap_count];
+            }
+        }
+        for (parent = 0; (child = 2 * parent + 1) < heap_count; parent = child) {
+            if (child + 1 < heap_count && RUN_HEAD(heap[child + 1]) < RUN_HEAD(heap[child])) {
+                child++;
+            }
+            if (RUN_HEAD(heap[parent]) <= RUN_HEAD(heap[child])) {
+                break;
+            }
+            r = heap[parent];
+            heap[parent] = heap[child];
+            heap[child] = r;
+        }
+    }
+    #undef RUN_HEAD
+    for (; indexed && block <= (ctx->nodes_count + SPILL_INDEX_STRIDE - 1) / SPILL_INDEX_STRIDE; block++) {
+        ctx->adjacency_index[block] = position;
+    }
+
+    for (r = 0; r < count; r++) {
+        fclose(runs[r]);
+        runs[r] = NULL;
+    }
+    return fwrite(buffer, sizeof(uint64_t), written, output) == (size_t)written && fflush(output) == 0;
+}
+
+// This function merges the spill runs into the adjacency file and builds its sparse index.
+// When the edges buffer cannot hold a read buffer for every run, groups of runs are
+// first merged into longer runs, until a single merge pass remains.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Merged successfully.
+//      0 --> Something went wrong.
+static int merge_runs(toposort_context *ctx)
+{
+    int r, merged, group, fan_in = ctx->spill_capacity / SPILL_MIN_BUFFER - 1;
+    if (fan_in < 2) {
+        set_error(ctx, "Memory limit too low to merge the spill runs.");
+        return 0;
+    }
+
+    while (ctx->spill_runs_count > fan_in) {
+        for (r = 0, merged = 0; r < ctx->spill_runs_count; r += group, merged++) {
+            group = ctx->spill_runs_count - r < fan_in ? ctx->spill_runs_count - r : fan_in;
+            FILE *run = create_spill_file();
+            if (run == NULL) {
+                set_error(ctx, "Cannot create spill file.");
+                return 0;
+            }
+            if (!merge_spill_runs(ctx, ctx->spill_runs + r, group, run, 0)) {
+                fclose(run);
+                set_error(ctx, "Failed to write spill file.");
+                return 0;
+            }
+            ctx->spill_runs[merged] = run;
+        }
+        for (r = merged; r < ctx->spill_runs_count; r++) {
+            ctx->spill_runs[r] = NULL;
+        }
+        ctx->spill_runs_count = merged;
+    }
+
+    ctx->adjacency_file = create_spill_file();
+    if (ctx->adjacency_file == NULL) {
+        set_error(ctx, "Cannot create spill file.");
+        return 0;
+    }
+    if (!merge_spill_runs(ctx, ctx->spill_runs, ctx->spill_runs_count, ctx->adjacency_file, 1)) {
+        set_error(ctx, "Failed to write spill file.");
+        return 0;
+    }
+    free(ctx->spill_runs);
+    ctx->spill_runs = NULL;
+
+    return 1;
+}
+
+// This function initializes the out-of-core mode, keeping only the nodes dependencies count,
+// the Dependencies and Topology matrices and a sparse adjacency index resident. The rest of the
+// memory limit holds the edges buffer, used to spill sorted runs of edges and to merge them
+// into the adjacency file.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      double start: Wall-clock time the Graph loading started.
+// Output:
+//      1 --> Initialized successfully.
+//      0 --> Something went wrong.
+int initialize_external(toposort_context *ctx, double start)
+{
+    int nodes_count = ctx->nodes_count;
+    long blocks = (nodes_count + SPILL_INDEX_STRIDE - 1) / SPILL_INDEX_STRIDE;
+    long resident = sizeof(int) * 3L * nodes_count + sizeof(long) * (blocks + 1);
+    double parse_end;
+    size_t size = sizeof(int) * (size_t)nodes_count;
+    // The merge needs a read buffer for at least 2 runs, and a write buffer.
+    if (ctx->mem_limit - resident < (long)sizeof(uint64_t) * SPILL_MIN_BUFFER * (2 + 1)) {
+        set_error(ctx, "Memory limit too low for %d nodes, at least %ld KB are needed.",
+            nodes_count, (resident + sizeof(uint64_t) * SPILL_MIN_BUFFER * (2 + 1)) / 1024 + 1);
+        return 0;
+    }
+
+    ctx->spill_capacity = (ctx->mem_limit - resident) / sizeof(uint64_t);
+    ctx->spill_runs = NULL;
+    ctx->spill_runs_count = 0;
+    ctx->adjacency_index = (long*)malloc(sizeof(long) * (blocks + 1));
+    ctx->spill_buffer = (uint64_t*)malloc(sizeof(uint64_t) * ctx->spill_capacity);
+    if ((ctx->adjacency_index == NULL) || (ctx->spill_buffer == NULL)
+        || !reserve_buffer((void**)&ctx->in_degrees, &ctx->in_degrees_allocated, size)
+        || !reserve_buffer((void**)&ctx->dependencies_matrix, &ctx->dependencies_allocated, size)
+        || !reserve_buffer((void**)&ctx->topology_matrix, &ctx->topology_allocated, size)) {
+        set_error(ctx, "Failed to allocate memory during initialization.");
+        return 0;
+    }
+
+    memset(ctx->in_degrees, 0, size);
+    if (!spill_edges(ctx)) {
+        return 0;
+    }
+    munmap(ctx->input_data, ctx->input_size);
+    ctx->input_data = NULL;
+    parse_end = wall_time();
+    log_message(ctx, "Out-of-core mode: %d spill runs, %ld KB edges buffer.\n",
+        ctx->spill_runs_count, ctx->spill_capacity * (long)sizeof(uint64_t) / 1024);
+    if (!merge_runs(ctx)) {
+        return 0;
+    }
+    ctx->parse_time = parse_end - start;
+    ctx->build_time = wall_time() - parse_end;
+
+    return 1;
+}
+
+// This function calculates the nodes Topology in out-of-core mode, frontier by frontier.
+// Each frontier is sorted, so the adjacency blocks of its nodes are read from the
+// adjacency file in increasing offset order, and merged with the frontier nodes of
+// the block to remove their dependencies. The frontiers are stored consecutively
+// in the Topology matrix, which holds the order as it is built.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+void calculate_external_topology(toposort_context *ctx)
+{
+    int i, k, node, cached;
+    long block, position, stop, count, cached_block = -1;
+    int frontier_start = 0, topology_matrix_index = 0;
+    int *dependencies_matrix = ctx->dependencies_matrix, *topology_matrix = ctx->topology_matrix;
+    uint64_t *spill_buffer = ctx->spill_buffer;
+    for (i = 0; i < ctx->nodes_count; i++) {
+        if (dependencies_matrix[i] == 0) {
+            topology_matrix[topology_matrix_index++] = i;
+        }
+    }
+
+    while (frontier_start < topology_matrix_index) {
+        int frontier_end = topology_matrix_index;
+        sort_nodes(topology_matrix + frontier_start, frontier_end - frontier_start);
+        for (k = frontier_start; k < frontier_end; ) {
+            block = topology_matrix[k] / SPILL_INDEX_STRIDE;
+            position = ctx->adjacency_index[block];
+            stop = ctx->adjacency_index[block + 1];
+            // A block fitting the buffer stays cached, deep Graphs revisit it on consecutive frontiers.
+            cached = block == cached_block;
+            cached_block = stop - position <= ctx->spill_capacity ? block : -1;
+            if (position < stop && !cached) {
+                fseeko(ctx->adjacency_file, (off_t)position * sizeof(uint64_t), SEEK_SET);
+            }
+            // Read the block edges in buffer sized batches, merging them with the block frontier nodes.
+            while (position < stop && k < frontier_end && topology_matrix[k] / SPILL_INDEX_STRIDE == block) {
+                count = stop - position < ctx->spill_capacity ? stop - position : ctx->spill_capacity;
+                if (!cached) {
+                    count = fread(spill_buffer, sizeof(uint64_t), count, ctx->adjacency_file);
+                }
+                if (count <= 0) {
+                    break;
+                }
+                position += count;
+                for (long e = 0; e < count; e++) {
+                    node = (int)(spill_buffer[e] >> 32);
+                    while (k < frontier_end && topology_matrix[k] < node) {
+                        k++;
+                    }
+                    if (k == frontier_end || topology_matrix[k] / SPILL_INDEX_STRIDE != block) {
+                        break;
+                    }
+                    if (topology_matrix[k] > node) {
+                        // Skip to the first edge of the next frontier node, with a binary search.
+                        uint64_t key = (uint64_t)topology_matrix[k] << 32;
+                        long low = e + 1, high = count;
+                        while (low < high) {
+                            long middle = (low + high) / 2;
+                            if (spill_buffer[middle] < key) {
+                                low = middle + 1;
+                            } else {
+                                high = middle;
+                            }
+                        }
+                        e = low - 1;
+                        continue;
+                    }
+                    i = (int)(uint32_t)spill_buffer[e];
+                    STATS_ADD(0, edges_relaxed, 1);
+                    if (--dependencies_matrix[i] == 0) {
+                        topology_matrix[topology_matrix_index++] = i;
+                    }
+                }
+            }
+            // Skip the remaining frontier nodes of the block.
+            while (k < frontier_end && topology_matrix[k] / SPILL_INDEX_STRIDE == block) {
+                k++;
+            }
+        }
+        STATS_ADD(0, nodes_processed, frontier_end - frontier_start);
+        frontier_start = frontier_end;
+    }
+    ctx->topology_matrix_index = topology_matrix_index;
+}
+
+// This function releases the out-of-core mode spill files and buffers.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+void release_external(toposort_context *ctx)
+{
+    int r;
+    for (r = 0; ctx->spill_runs != NULL && r < ctx->spill_runs_count; r++) {
+        if (ctx->spill_runs[r] != NULL) {
+            fclose(ctx->spill_runs[r]);
+        }
+    }
+    if (ctx->adjacency_file != NULL) {
+        fclose(ctx->adjacency_file);
+    }
+    free(ctx->spill_runs);
+    free(ctx->adjacency_index);
+    free(ctx->spill_buffer);
+    ctx->spill_runs = NULL;
+    ctx->spill_runs_count = 0;
+    ctx->adjacency_file = NULL;
+    ctx->adjacency_index = NULL;
+    ctx->spill_buffer = NULL;
+    ctx->spill_capacity = 0;
+}
@@ -0,0 +1,1640 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort Graph loading: RandomGraph text files parsed in place, binary Graphs memory
+// mapped directly, synthetic Graphs generated in memory and in-memory edge arrays, built
+// into the CSR or bitset adjacency and the nodes dependencies count of a sort context.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "toposort_internal.h"
+
+// This function points the Graph CSR arrays into a memory mapped binary input file,
+// after validating its header against the file size.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Mapped successfully.
+//      0 --> Something went wrong.
+static int map_binary_graph(toposort_context *ctx)
+{
+    const graph_header *header = (const graph_header*)ctx->input_data;
+    size_t expected_size, offset_size;
+    long i;
+    if (header->version != GRAPH_VERSION && header->version != GRAPH_VERSION_OFFSETS32) {
+        set_error(ctx, "Unsupported binary Graph version %u.", header->version);
+        return 0;
+    }
+    if (header->nodes_count > 2147483647UL || header->edges_count > (uint64_t)LONG_MAX / sizeof(double)) {
+        set_error(ctx, "Binary Graph is too large, at most %ld nodes are supported.", 2147483647L);
+        return 0;
+    }
+
+    offset_size = header->version == GRAPH_VERSION ? sizeof(long) : sizeof(int);
+    expected_size = sizeof(graph_header) + offset_size * (header->nodes_count + 1)
+        + sizeof(int) * (header->nodes_count + header->edges_count);
+    if (ctx->input_size < expected_size) {
+        set_error(ctx, "Binary Graph is truncated.");
+        return 0;
+    }
+
+    ctx->nodes_count = (int)header->nodes_count;
+    ctx->edges_count = (long)header->edges_count;
+    ctx->targets = (int*)(ctx->input_data + sizeof(graph_header) + offset_size * (header->nodes_count + 1));
+    ctx->mapped_in_degrees = ctx->targets + ctx->edges_count;
+    if (header->version == GRAPH_VERSION) {
+        ctx->offsets = (long*)(ctx->input_data + sizeof(graph_header));
+    } else {
+        // Version 1 offsets are 32bit, they are widened to a CSR offsets buffer.
+        const int *offsets32 = (const int*)(ctx->input_data + sizeof(graph_header));
+        if (!reserve_buffer((void**)&ctx->csr_offsets, &ctx->csr_offsets_allocated, sizeof(long) * ((size_t)ctx->nodes_count + 1))) {
+            set_error(ctx, "Failed to allocate memory for the Graph.");
+            return 0;
+        }
+        for (i = 0; i <= ctx->nodes_count; i++) {
+            ctx->csr_offsets[i] = offsets32[i];
+        }
+        ctx->offsets = ctx->csr_offsets;
+    }
+    if (ctx->offsets[0] != 0 || ctx->offsets[ctx->nodes_count] != ctx->edges_count) {
+        set_error(ctx, "Binary Graph offsets are corrupted.");
+        return 0;
+    }
+    if (ctx->schedule && (header->flags & GRAPH_FLAG_WEIGHTS)) {
+        // Weights follow the in-degrees, aligned to 8 bytes.
+        expected_size = (expected_size + 7) & ~(size_t)7;
+        if (ctx->input_size < expected_size + sizeof(double) * header->edges_count) {
+            set_error(ctx, "Binary Graph is truncated.");
+            return 0;
+        }
+        ctx->weights = (double*)(ctx->input_data + expected_size);
+    }
+    ctx->graph_mapped = 1;
+
+    return 1;
+}
+
+// This function maps the input file to memory and retrieves the Graph nodes count.
+// A binary Graph, recognized by its magic number, is used in place by map_binary_graph().
+// Otherwise the nodes count is read from the first line, and the edges following it
+// are parsed in place by read_edges(). Only an empty or whitespace file loads an empty Graph.
+// The mapping is private and writable, so the incremental mode can mark removed edges in a
+// copy of the modified pages.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *filename: The input file name.
+// Output:
+//      1 --> Mapped successfully.
+//      0 --> Something went wrong.
+static int map_input_file(toposort_context *ctx, const char *filename)
+{
+    struct stat input_stat;
+    const char *p;
+    FILE *fin = fopen(filename, "r");
+    if (fin == NULL) {
+        set_error(ctx, "Cannot open input file %s.", filename);
+        return 0;
+    }
+    if (fstat(fileno(fin), &input_stat) != 0) {
+        set_error(ctx, "Cannot retrieve input file size.");
+        fclose(fin);
+        return 0;
+    }
+
+    ctx->input_size = (size_t)input_stat.st_size;
+    if (ctx->input_size == 0) {
+        fclose(fin);
+        return 1;
+    }
+
+    ctx->input_data = (char*)mmap(NULL, ctx->input_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fin), 0);
+    fclose(fin);
+    if (ctx->input_data == MAP_FAILED) {
+        ctx->input_data = NULL;
+        set_error(ctx, "Cannot map input file to memory.");
+        return 0;
+    }
+    if (ctx->input_size >= sizeof(graph_header) && memcmp(ctx->input_data, GRAPH_MAGIC, sizeof(GRAPH_MAGIC) - 1) == 0) {
+        return map_binary_graph(ctx);
+    }
+    madvise(ctx->input_data, ctx->input_size, MADV_SEQUENTIAL);
+
+    p = scan_int(ctx->input_data, ctx->input_data + ctx->input_size, &ctx->nodes_count);
+    if (p == NULL && skip_spaces(ctx->input_data, ctx->input_data + ctx->input_size) == ctx->input_data + ctx->input_size) {
+        // A file holding only whitespace is empty.
+        ctx->nodes_count = 0;
+        return 1;
+    }
+    if (p == NULL || ctx->nodes_count < 0) {
+        ctx->nodes_count = 0;
+        set_error(ctx, "Invalid nodes count in input file, expected an integer from 0 to 2147483647.");
+        return 0;
+    }
+    ctx->input_body = p;
+
+    return 1;
+}
+
+// This function appends an edge to a chunk edge list, growing it when full.
+// Inputs:
+//      edge_chunk *chunk: The chunk.
+//      int i: Edge source.
+//      int j: Edge target.
+//      double w: Edge weight.
+//      int keep_weights: The weight is appended to the chunk weights if set.
+// Output:
+//      1 --> Appended successfully.
+//      0 --> Something went wrong.
+static inline int append_edge(edge_chunk *chunk, int i, int j, double w, int keep_weights)
+{
+    if (chunk->count == chunk->capacity) {
+        long capacity = chunk->capacity > 0 ? chunk->capacity * 2 : 1024;
+        int *new_sources = (int*)realloc(chunk->sources, sizeof(int) * capacity);
+        if (new_sources == NULL) {
+            return 0;
+        }
+        chunk->sources = new_sources;
+        int *new_targets = (int*)realloc(chunk->targets, sizeof(int) * capacity);
+        if (new_targets == NULL) {
+            return 0;
+        }
+        chunk->targets = new_targets;
+        chunk->capacity = capacity;
+    }
+    if (keep_weights) {
+        if (chunk->count == chunk->weights_capacity) {
+            double *new_weights = (double*)realloc(chunk->weights, sizeof(double) * chunk->capacity);
+            if (new_weights == NULL) {
+                return 0;
+            }
+            chunk->weights = new_weights;
+            chunk->weights_capacity = chunk->capacity;
+        }
+        chunk->weights[chunk->count] = w;
+    }
+    chunk->sources[chunk->count] = i;
+    chunk->targets[chunk->count] = j;
+    chunk->count++;
+
+    return 1;
+}
+
+// This function parses the "<src> <dst> <weight>" edge lines of a chunk,
+// until the chunk end or the -1 terminator.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      edge_chunk *chunk: The chunk to parse.
+static void parse_chunk(const toposort_context *ctx, edge_chunk *chunk)
+{
+    int i, j, nodes_count = ctx->nodes_count;
+    double w;
+    const char *p = chunk->start;
+    const char *end = ctx->input_data + ctx->input_size;
+    chunk->count = 0;
+    chunk->terminated = 0;
+    chunk->error = NULL;
+    while (1) {
+        p = skip_spaces(p, chunk->stop);
+        if (p == chunk->stop) {
+            return;
+        }
+        chunk->error = p;
+        p = scan_int(p, end, &i);
+        if (p == NULL) {
+            return;
+        }
+        if (i == -1) {
+            chunk->terminated = 1;
+            chunk->error = NULL;
+            return;
+        }
+        p = scan_int(p, end, &j);
+        if (p == NULL || i < 0 || i >= nodes_count || j < 0 || j >= nodes_count) {
+            return;
+        }
+        p = scan_double(p, end, &w);
+        if (p == NULL) {
+            return;
+        }
+        if (!append_edge(chunk, i, j, w, ctx->schedule)) {
+            chunk->error = chunk->start;
+            chunk->capacity = -1;
+            return;
+        }
+        chunk->error = NULL;
+    }
+}
+
+// This Thread function parses the chunk of the mapped input file assigned to the Thread.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_parse_chunk(void *arg)
+{
+    worker *w = (worker*)arg;
+    if (w->id < w->ctx->chunks_count) {
+        parse_chunk(w->ctx, &w->ctx->chunks[w->id]);
+    }
+
+    return (NULL);
+}
+
+// This function reads the Graph edges from the mapped input file into per Thread edge lists.
+// The file is split into newline aligned chunks, each one parsed by a different Thread.
+// Chunks following the one containing the -1 terminator are discarded. The edge lists
+// are kept by the context, so the next Graphs reuse them.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Edges read successfully.
+//      0 --> Something went wrong.
+static int read_edges(toposort_context *ctx)
+{
+    long t;
+    edge_chunk *chunks = ctx->chunks;
+    const char *end = ctx->input_data + ctx->input_size;
+    size_t length = end - ctx->input_body;
+    ctx->chunks_count = ctx->threads_count;
+
+    // Split input in equal parts, moving each boundary after the next newline.
+    for (t = 0; t < ctx->chunks_count; t++) {
+        const char *stop = ctx->input_body + length * (t + 1) / ctx->chunks_count;
+        while (stop < end && stop[-1] != '\n') {
+            stop++;
+        }
+        chunks[t].start = t == 0 ? ctx->input_body : chunks[t - 1].stop;
+        chunks[t].stop = t == ctx->chunks_count - 1 ? end : stop;
+        if (chunks[t].stop < chunks[t].start) {
+            chunks[t].stop = chunks[t].start;
+        }
+        if (chunks[t].capacity == -1) {
+            // A previous Graph failed to grow this edge list, start it over.
+            free(chunks[t].sources);
+            free(chunks[t].targets);
+            free(chunks[t].weights);
+            chunks[t].sources = NULL;
+            chunks[t].targets = NULL;
+            chunks[t].weights = NULL;
+            chunks[t].capacity = 0;
+            chunks[t].weights_capacity = 0;
+        }
+    }
+    run_workers(ctx, thread_parse_chunk);
+
+    ctx->edges_count = 0;
+    for (t = 0; t < ctx->chunks_count; t++) {
+        if (chunks[t].error != NULL) {
+            if (chunks[t].capacity == -1) {
+                set_error(ctx, "Failed to allocate memory for the edge list.");
+            } else {
+                set_error(ctx, "Invalid edge in input file at byte %ld.", (long)(chunks[t].error - ctx->input_data));
+            }
+            return 0;
+        }
+        ctx->edges_count += chunks[t].count;
+        if (chunks[t].terminated) {
+            ctx->chunks_count = t + 1;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+// This function advances a random stream(splitmix64).
+// Inputs:
+//      uint64_t *state: The random stream state.
+// Output:
+//      The next 64bit random value.
+static inline uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+// This function draws a uniform random value in [0, 1) from a random stream.
+// Inputs:
+//      uint64_t *state: The random stream state.
+// Output:
+//      The random value.
+static inline double random_uniform(uint64_t *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// This function generates the out-edges of a synthetic DAG node. Edges always lead to
+// later nodes, so the Graph is acyclic. Structural edges of the shape(chain link, tree
+// children) are always present, while the candidate nodes of the shape are linked with
+// the generator density, skipping a geometric number of candidates between edges.
+// Each node uses its own random stream, seeded from the generator seed and the node,
+// so the Graph is reproducible and does not depend on the Threads generating it.
+// Only the first capacity edges are stored, while all of them are counted.
+// Inputs:
+//      const generator_spec *generator: The generator specification.
+//      int i: The node.
+//      int *row_targets: Edges targets output.
+//      double *row_weights: Edges weights output, NULL to skip them.
+//      int capacity: Edges the outputs can hold, 0 to only count them.
+// Output:
+//      The node out-edges count.
+static int generate_row(const generator_spec *generator, int i, int *row_targets, double *row_weights, int capacity)
+{
+    uint64_t state = generator->seed ^ (((uint64_t)i + 1) * 0xD1B54A32D192ED03ULL);
+    long j, first = i + 1, last = generator->nodes_count;
+    long child_first = 0, child_last = 0;
+    double weight, log_miss = log1p(-generator->density);
+    int count = 0;
+
+    if (generator->shape == SHAPE_CHAIN && first < last) {
+        weight = generator->min_weight + (generator->max_weight - generator->min_weight) * random_uniform(&state);
+        if (count < capacity) {
+            row_targets[count] = first;
+            if (row_weights != NULL) {
+                row_weights[count] = weight;
+            }
+        }
+        count++;
+        first++;
+    } else if (generator->shape == SHAPE_FANOUT) {
+        child_first = (long)generator->fanout * i + 1;
+        child_last = child_first + generator->fanout < last ? child_first + generator->fanout : last;
+        for (j = child_first; j < child_last; j++) {
+            weight = generator->min_weight + (generator->max_weight - generator->min_weight) * random_uniform(&state);
+            if (count < capacity) {
+                row_targets[count] = j;
+                if (row_weights != NULL) {
+                    row_weights[count] = weight;
+                }
+            }
+            count++;
+        }
+    } else if (generator->shape == SHAPE_LAYERED) {
+        long layer_size = ((long)generator->nodes_count + generator->layers - 1) / generator->layers;
+        first = (i / layer_size + 1) * layer_size;
+        last = first + layer_size < last ? first + layer_size : last;
+    }
+    if (generator->density <= 0) {
+        return count;
+    }
+
+    // Link candidate nodes, skipping a geometric number of them between edges.
+    for (j = first - 1; ; ) {
+        if (generator->density >= 1) {
+            j++;
+        } else {
+            double skip = log1p(-random_uniform(&state)) / log_miss;
+            if (skip >= (double)(last - j)) {
+                break;
+            }
+            j += 1 + (long)skip;
+        }
+        if (j >= last) {
+            break;
+        }
+        weight = generator->min_weight + (generator->max_weight - generator->min_weight) * random_uniform(&state);
+        if (j >= child_first && j < child_last) {
+            continue;
+        }
+        if (count < capacity) {
+            row_targets[count] = j;
+            if (row_weights != NULL) {
+                row_weights[count] = weight;
+            }
+        }
+        count++;
+    }
+
+    return count;
+}
+
+// This function reads a synthetic DAG generator specification, a comma separated list of
+// nodes=<N>, density=<p>, shape=random|layered|chain|fanout, layers=<L>, fanout=<F>,
+// seed=<S> and weights=<min>:<max> settings, optionally prefixed by "gen:".
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *spec: The generator specification.
+// Output:
+//      1 --> Specification read successfully.
+//      0 --> Something went wrong.
+static int read_generator_spec(toposort_context *ctx, const char *spec)
+{
+    generator_spec *generator = &ctx->generator;
+    char key[16];
+    const char *value;
+    int length;
+    generator->nodes_count = 0;
+    generator->density = 0.001;
+    generator->shape = SHAPE_RANDOM;
+    generator->layers = 0;
+    generator->fanout = 16;
+    generator->seed = 1;
+    generator->min_weight = 0;
+    generator->max_weight = 1;
+    if (strncmp(spec, "gen:", 4) == 0) {
+        spec += 4;
+    }
+
+    while (*spec != '\0') {
+        value = strchr(spec, '=');
+        length = value == NULL ? 0 : (int)(value - spec);
+        if (length == 0 || length >= (int)sizeof(key)) {
+            set_error(ctx, "Invalid generator setting %s.", spec);
+            return 0;
+        }
+        memcpy(key, spec, length);
+        key[length] = '\0';
+        value++;
+        if (strcmp(key, "nodes") == 0) {
+            generator->nodes_count = atoi(value);
+        } else if (strcmp(key, "density") == 0) {
+            generator->density = atof(value);
+        } else if (strcmp(key, "layers") == 0) {
+            generator->layers = atoi(value);
+        } else if (strcmp(key, "fanout") == 0) {
+            generator->fanout = atoi(value);
+        } else if (strcmp(key, "seed") == 0) {
+            generator->seed = strtoull(value, NULL, 10);
+        } else if (strcmp(key, "weights") == 0) {
+            if (sscanf(value, "%lf:%lf", &generator->min_weight, &generator->max_weight) != 2) {
+                set_error(ctx, "Invalid generator weights range %s.", value);
+                return 0;
+            }
+        } else if (strcmp(key, "shape") == 0) {
+            if (strncmp(value, "random", 6) == 0) {
+                generator->shape = SHAPE_RANDOM;
+            } else if (strncmp(value, "layered", 7) == 0) {
+                generator->shape = SHAPE_LAYERED;
+            } else if (strncmp(value, "chain", 5) == 0) {
+                generator->shape = SHAPE_CHAIN;
+            } else if (strncmp(value, "fanout", 6) == 0) {
+                generator->shape = SHAPE_FANOUT;
+            } else {
+                set_error(ctx, "Unknown generator shape %s.", value);
+                return 0;
+            }
+        } else {
+            set_error(ctx, "Unknown generator setting %s.", key);
+            return 0;
+        }
+        spec = strchr(value, ',');
+        if (spec == NULL) {
+            break;
+        }
+        spec++;
+    }
+
+    if (generator->nodes_count <= 0 || generator->density < 0 || generator->fanout <= 0) {
+        set_error(ctx, "Generator requires a positive nodes count and fanout, and a non-negative density.");
+        return 0;
+    }
+    if (generator->layers <= 0) {
+        generator->layers = (int)sqrt((double)generator->nodes_count);
+        generator->layers = generator->layers > 0 ? generator->layers : 1;
+    }
+
+    return 1;
+}
+
+// This Thread function runs a pass of the synthetic Graph generation over blocks of nodes.
+// The first pass counts the out-edges of each node, the second pass fills the CSR
+// out-edges and counts the nodes dependencies.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_generate_graph(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    int i, first, last, nodes_count = ctx->nodes_count;
+    long c, *offsets = ctx->offsets;
+    int *targets = ctx->targets;
+
+    while ((first = __atomic_fetch_add(&ctx->next_block, GENERATOR_BLOCK, __ATOMIC_RELAXED)) < nodes_count) {
+        last = first + GENERATOR_BLOCK < nodes_count ? first + GENERATOR_BLOCK : nodes_count;
+        for (i = first; i < last; i++) {
+            if (ctx->generator_pass == 0) {
+                offsets[i + 1] = generate_row(&ctx->generator, i, NULL, NULL, 0);
+                continue;
+            }
+            generate_row(&ctx->generator, i, targets + offsets[i], ctx->weights != NULL ? ctx->weights + offsets[i] : NULL,
+                (int)(offsets[i + 1] - offsets[i]));
+            for (c = offsets[i]; c < offsets[i + 1]; c++) {
+                __atomic_fetch_add(&ctx->in_degrees[targets[c]], 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+// This Thread function first touches the Thread range of the nodes buffers and CSR arrays,
+// so their pages are placed on the Thread NUMA node.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_touch_buffers(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    long id = ((worker*)arg)->id, start, finish;
+    thread_range(ctx, id, ctx->nodes_count, &start, &finish);
+    if (finish > start) {
+        memset(ctx->in_degrees + start, 0, sizeof(int) * (finish - start));
+        memset(ctx->dependencies_matrix + start, 0, sizeof(int) * (finish - start));
+        memset(ctx->topology_matrix + start, 0, sizeof(int) * (finish - start));
+        memset(ctx->queue + start, 0, sizeof(int) * (finish - start));
+        memset(ctx->csr_offsets + start + 1, 0, sizeof(long) * (finish - start));
+    }
+
+    thread_range(ctx, id, ctx->edges_count, &start, &finish);
+    if (finish > start) {
+        memset(ctx->csr_targets + start, 0, sizeof(int) * (finish - start));
+    }
+
+    return (NULL);
+}
+
+// This function spreads the pages of the freshly reserved Graph buffers over the NUMA
+// nodes of the pinned Threads, each Thread first touching its own nodes and edges ranges.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+static void touch_buffers(toposort_context *ctx)
+{
+    if (ctx->affinity != TOPOSORT_AFFINITY_NONE && ctx->threads_count > 1) {
+        run_workers(ctx, thread_touch_buffers);
+    }
+}
+
+// This function generates the synthetic Graph CSR arrays and the nodes dependencies count
+// in two parallel passes, the first one sizing the out-edges of each node into the CSR offsets.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Generated successfully.
+//      0 --> Something went wrong.
+static int generate_graph(toposort_context *ctx)
+{
+    int i;
+    if (!reserve_buffer((void**)&ctx->csr_offsets, &ctx->csr_offsets_allocated, sizeof(long) * ((size_t)ctx->nodes_count + 1))) {
+        set_error(ctx, "Failed to allocate memory for the generated Graph.");
+        return 0;
+    }
+    ctx->offsets = ctx->csr_offsets;
+    // The CSR targets are first touched by the generating Threads, filling their own rows.
+    ctx->edges_count = 0;
+    touch_buffers(ctx);
+
+    ctx->generator_pass = 0;
+    ctx->next_block = 0;
+    run_workers(ctx, thread_generate_graph);
+    ctx->offsets[0] = 0;
+    for (i = 0; i < ctx->nodes_count; i++) {
+        ctx->offsets[i + 1] += ctx->offsets[i];
+    }
+    ctx->edges_count = ctx->offsets[ctx->nodes_count];
+
+    if (!reserve_buffer((void**)&ctx->csr_targets, &ctx->csr_targets_allocated, sizeof(int) * (size_t)ctx->edges_count)) {
+        set_error(ctx, "Failed to allocate memory for the generated Graph.");
+        return 0;
+    }
+    ctx->targets = ctx->csr_targets;
+    if (ctx->schedule) {
+        if (!reserve_buffer((void**)&ctx->csr_weights, &ctx->csr_weights_allocated, sizeof(double) * (size_t)ctx->edges_count)) {
+            set_error(ctx, "Failed to allocate memory for the generated Graph.");
+            return 0;
+        }
+        ctx->weights = ctx->csr_weights;
+    }
+    memset(ctx->in_degrees, 0, sizeof(int) * ctx->nodes_count);
+    ctx->generator_pass = 1;
+    ctx->next_block = 0;
+    run_workers(ctx, thread_generate_graph);
+
+    return 1;
+}
+
+// This Thread function runs a pass of the parallel CSR build. Edge passes walk the Thread
+// range of the edges, the edge lists taken as a single sequence, and node passes the Thread
+// range of the nodes. Each Thread owns a nodes histogram, at its position in NUMA nodes order:
+// pass 0 counts the dependencies of the edges range, pass 1 sums them into each node
+// dependencies count, pass 2 counts the out-edges of the edges range, pass 3 turns the
+// histograms into per Thread positions within each node row and sums the nodes range
+// out-edges, pass 4 adds the rows offsets, making the histograms scatter cursors, and
+// pass 5 scatters the edges range, each Thread writing only its own row slices.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_build_graph(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    long id = ((worker*)arg)->id;
+    const edge_chunk *chunks = ctx->build_chunks;
+    int c = 0, u, t, nodes_count = ctx->nodes_count, rank = ctx->thread_ranks[id];
+    long i, last, remaining, start, finish, sum = 0;
+    long *histogram = ctx->build_counts + (size_t)rank * nodes_count, *offsets = ctx->offsets;
+    if (ctx->build_pass == 0 || ctx->build_pass == 2 || ctx->build_pass == 5) {
+        if (ctx->build_pass != 5) {
+            memset(histogram, 0, sizeof(long) * nodes_count);
+        }
+        // Find the edge list holding the first edge of the range.
+        thread_range(ctx, id, ctx->edges_count, &start, &finish);
+        remaining = finish - start;
+        while (c < ctx->build_chunks_count && start >= chunks[c].count) {
+            start -= chunks[c++].count;
+        }
+        for (; remaining > 0; c++, start = 0) {
+            const int *sources = chunks[c].sources, *targets = chunks[c].targets;
+            last = chunks[c].count - start < remaining ? chunks[c].count : start + remaining;
+            remaining -= last - start;
+            if (ctx->build_pass == 0) {
+                for (i = start; i < last; i++) {
+                    histogram[targets[i]]++;
+                }
+            } else if (ctx->build_pass == 2) {
+                for (i = start; i < last; i++) {
+                    histogram[sources[i]]++;
+                }
+            } else if (ctx->weights != NULL) {
+                for (i = start; i < last; i++) {
+                    ctx->weights[histogram[sources[i]]] = chunks[c].weights != NULL ? chunks[c].weights[i] : 1;
+                    ctx->targets[histogram[sources[i]]++] = targets[i];
+                }
+            } else {
+                for (i = start; i < last; i++) {
+                    ctx->targets[histogram[sources[i]]++] = targets[i];
+                }
+            }
+        }
+        return (NULL);
+    }
+
+    thread_range(ctx, id, nodes_count, &start, &finish);
+    if (ctx->build_pass == 1) {
+        memset(ctx->in_degrees + start, 0, sizeof(int) * (finish - start));
+        for (t = 0; t < ctx->threads_count; t++) {
+            const long *counts = ctx->build_counts + (size_t)t * nodes_count;
+            for (u = start; u < finish; u++) {
+                ctx->in_degrees[u] += (int)counts[u];
+            }
+        }
+    } else if (ctx->build_pass == 3) {
+        // Node rows out-edges are accumulated in the offsets, shifted by one node.
+        memset(offsets + start + 1, 0, sizeof(long) * (finish - start));
+        for (t = 0; t < ctx->threads_count; t++) {
+            long *counts = ctx->build_counts + (size_t)t * nodes_count;
+            for (u = start; u < finish; u++) {
+                long count = counts[u];
+                counts[u] = offsets[u + 1];
+                offsets[u + 1] += count;
+            }
+        }
+        for (u = start; u < finish; u++) {
+            sum += offsets[u + 1];
+        }
+        ctx->build_sums[rank] = sum;
+    } else {
+        // The nodes range starts after the out-edges of the previous ranges.
+        sum = ctx->build_sums[rank];
+        for (u = start; u < finish; u++) {
+            sum += offsets[u + 1];
+            offsets[u + 1] = sum;
+        }
+        for (t = 0; t < ctx->threads_count; t++) {
+            long *counts = ctx->build_counts + (size_t)t * nodes_count;
+            for (u = start; u < finish; u++) {
+                counts[u] += u == start ? ctx->build_sums[rank] : offsets[u];
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+// This function builds the Graph CSR arrays and the nodes dependencies count from edge
+// lists with all the context Threads, in the passes of thread_build_graph. The nodes
+// ranges sums are turned into their starting offsets between the passes 3 and 4.
+// Edges are scattered in the same order as a serial build, without atomic operations.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const edge_chunk *chunks: The edge lists.
+//      int chunks_count: The edge lists count.
+static void build_graph_parallel(toposort_context *ctx, const edge_chunk *chunks, int chunks_count)
+{
+    int t;
+    long sum = 0;
+    ctx->build_chunks = chunks;
+    ctx->build_chunks_count = chunks_count;
+    ctx->offsets[0] = 0;
+    for (ctx->build_pass = 0; ctx->build_pass <= 5; ctx->build_pass++) {
+        if (ctx->build_pass == 4) {
+            for (t = 0; t < ctx->threads_count; t++) {
+                long count = ctx->build_sums[t];
+                ctx->build_sums[t] = sum;
+                sum += count;
+            }
+        }
+        run_workers(ctx, thread_build_graph);
+    }
+}
+
+// This function builds the Graph CSR(compressed sparse row) adjacency and the
+// nodes dependencies count from edge lists, using O(nodes + edges) memory.
+// With several Threads the build runs in parallel, as long as the per Thread nodes
+// histograms stay within BUILD_HISTOGRAMS_RATIO times the Graph size.
+// In schedule mode the edges weights are scattered along with their targets,
+// unit weights being used for edge lists without weights.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const edge_chunk *chunks: The edge lists.
+//      int chunks_count: The edge lists count.
+// Output:
+//      1 --> Built successfully.
+//      0 --> Something went wrong.
+static int build_graph(toposort_context *ctx, const edge_chunk *chunks, int chunks_count)
+{
+    int c, nodes_count = ctx->nodes_count;
+    long i, total, *offsets;
+    int *targets;
+    if (!reserve_buffer((void**)&ctx->csr_offsets, &ctx->csr_offsets_allocated, sizeof(long) * ((size_t)nodes_count + 1))
+        || !reserve_buffer((void**)&ctx->csr_targets, &ctx->csr_targets_allocated, sizeof(int) * (size_t)ctx->edges_count)) {
+        return 0;
+    }
+    offsets = ctx->offsets = ctx->csr_offsets;
+    targets = ctx->targets = ctx->csr_targets;
+    if (ctx->schedule) {
+        if (!reserve_buffer((void**)&ctx->csr_weights, &ctx->csr_weights_allocated, sizeof(double) * (size_t)ctx->edges_count)) {
+            return 0;
+        }
+        ctx->weights = ctx->csr_weights;
+    }
+    touch_buffers(ctx);
+    if (ctx->threads_count > 1
+        && (size_t)ctx->threads_count * nodes_count <= BUILD_HISTOGRAMS_RATIO * ((size_t)nodes_count + ctx->edges_count)
+        && reserve_buffer((void**)&ctx->build_counts, &ctx->build_counts_allocated, sizeof(long) * (size_t)ctx->threads_count * nodes_count)) {
+        build_graph_parallel(ctx, chunks, chunks_count);
+        return 1;
+    }
+
+    // Count each node out-edges and dependencies.
+    for (i = 0; i <= nodes_count; i++) {
+        offsets[i] = 0;
+    }
+    memset(ctx->in_degrees, 0, sizeof(int) * nodes_count);
+    for (c = 0; c < chunks_count; c++) {
+        for (i = 0; i < chunks[c].count; i++) {
+            offsets[chunks[c].sources[i] + 1]++;
+            ctx->in_degrees[chunks[c].targets[i]]++;
+        }
+    }
+
+    // Exclusive prefix sum of out-edges counts gives each node starting offset, held by the next node.
+    for (i = 0, total = 0; i < nodes_count; i++) {
+        long count = offsets[i + 1];
+        offsets[i + 1] = total;
+        total += count;
+    }
+
+    // Scatter edges to their rows, the offsets of the next nodes serving as row cursors,
+    // so each of them ends at the next node starting offset.
+    for (c = 0; c < chunks_count; c++) {
+        if (ctx->weights != NULL) {
+            for (i = 0; i < chunks[c].count; i++) {
+                ctx->weights[offsets[chunks[c].sources[i] + 1]] = chunks[c].weights != NULL ? chunks[c].weights[i] : 1;
+                targets[offsets[chunks[c].sources[i] + 1]++] = chunks[c].targets[i];
+            }
+            continue;
+        }
+        for (i = 0; i < chunks[c].count; i++) {
+            targets[offsets[chunks[c].sources[i] + 1]++] = chunks[c].targets[i];
+        }
+    }
+
+    return 1;
+}
+
+// This function sets an edge in the Graph bitset adjacency, counting it
+// as a dependency of its target only the first time it is set.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int i: Edge source.
+//      int j: Edge target.
+static inline void set_bitset_edge(toposort_context *ctx, int i, int j)
+{
+    uint64_t *word = ctx->bitset + (size_t)i * ctx->row_words + (j >> 6);
+    uint64_t bit = (uint64_t)1 << (j & 63);
+    if ((*word & bit) == 0) {
+        *word |= bit;
+        ctx->in_degrees[j]++;
+    }
+}
+
+// This function builds the Graph bitset adjacency and the nodes dependencies count from
+// edge lists, or from the Graph CSR arrays when no edge lists are given.
+// Rows are padded to 256bit boundaries, so they can be scanned with vector instructions.
+// Duplicate edges are counted once, as a bitset cannot hold them.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const edge_chunk *chunks: The edge lists, NULL to use the CSR arrays.
+//      int chunks_count: The edge lists count.
+// Output:
+//      1 --> Built successfully.
+//      0 --> Something went wrong.
+static int build_bitset(toposort_context *ctx, const edge_chunk *chunks, int chunks_count)
+{
+    int i, c;
+    long edge;
+    size_t size;
+    ctx->row_words = ((ctx->nodes_count + 255) / 256) * 4;
+    size = sizeof(uint64_t) * ctx->row_words * (size_t)ctx->nodes_count;
+    if (!reserve_buffer((void**)&ctx->bitset, &ctx->bitset_allocated, size)) {
+        return 0;
+    }
+
+    memset(ctx->bitset, 0, size);
+    memset(ctx->in_degrees, 0, sizeof(int) * ctx->nodes_count);
+    if (chunks == NULL) {
+        for (i = 0; i < ctx->nodes_count; i++) {
+            for (edge = ctx->offsets[i]; edge < ctx->offsets[i + 1]; edge++) {
+                set_bitset_edge(ctx, i, ctx->targets[edge]);
+            }
+        }
+        return 1;
+    }
+    for (c = 0; c < chunks_count; c++) {
+        for (edge = 0; edge < chunks[c].count; edge++) {
+            set_bitset_edge(ctx, chunks[c].sources[edge], chunks[c].targets[edge]);
+        }
+    }
+
+    return 1;
+}
+
+// This function allocates the nodes buffers of the loaded Graph: its dependencies count,
+// the Dependencies and Topology matrices, the Queue, the engine buffers and in schedule
+// mode the earliest start times, levels and critical path buffers.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Allocated successfully.
+//      0 --> Something went wrong.
+static int reserve_nodes_buffers(toposort_context *ctx)
+{
+    size_t size = sizeof(int) * (size_t)ctx->nodes_count;
+    if (!reserve_buffer((void**)&ctx->in_degrees, &ctx->in_degrees_allocated, size)
+        || !reserve_buffer((void**)&ctx->dependencies_matrix, &ctx->dependencies_allocated, size)
+        || !reserve_buffer((void**)&ctx->topology_matrix, &ctx->topology_allocated, size)
+        || !reserve_buffer((void**)&ctx->queue, &ctx->queue_allocated, size)
+        || !reserve_engine_buffers(ctx)) {
+        set_error(ctx, "Failed to allocate memory during initialization.");
+        return 0;
+    }
+    if (ctx->schedule && (!reserve_buffer((void**)&ctx->start_times, &ctx->start_times_allocated, sizeof(double) * (size_t)ctx->nodes_count)
+        || !reserve_buffer((void**)&ctx->levels, &ctx->levels_allocated, size)
+        || !reserve_buffer((void**)&ctx->critical_parents, &ctx->critical_parents_allocated, size)
+        || !reserve_buffer((void**)&ctx->critical_path, &ctx->critical_path_allocated, size)
+        || !reserve_buffer((void**)&ctx->schedule_locks, &ctx->schedule_locks_allocated, (size_t)ctx->nodes_count))) {
+        set_error(ctx, "Failed to allocate memory for the schedule.");
+        return 0;
+    }
+
+    return 1;
+}
+
+// This function sorts an edge list in place by source, then by target, with a quicksort
+// recursing on the smaller partition, so each node targets form a sorted run.
+// Inputs:
+//      int *sources: The edges sources.
+//      int *targets: The edges targets.
+//      long count: The edges count.
+static void sort_edge_list(int *sources, int *targets, long count)
+{
+#define EDGE_KEY(e) ((uint64_t)(unsigned int)sources[e] << 32 | (unsigned int)targets[e])
+    while (count > 16) {
+        uint64_t pivot = EDGE_KEY(count / 2);
+        long i = -1, j = count;
+        int swap;
+        while (1) {
+            do {
+                i++;
+            } while (EDGE_KEY(i) < pivot);
+            do {
+                j--;
+            } while (EDGE_KEY(j) > pivot);
+            if (i >= j) {
+                break;
+            }
+            swap = sources[i];
+            sources[i] = sources[j];
+            sources[j] = swap;
+            swap = targets[i];
+            targets[i] = targets[j];
+            targets[j] = swap;
+        }
+        if (j + 1 < count - j - 1) {
+            sort_edge_list(sources, targets, j + 1);
+            sources += j + 1;
+            targets += j + 1;
+            count -= j + 1;
+        } else {
+            sort_edge_list(sources + j + 1, targets + j + 1, count - j - 1);
+            count = j + 1;
+        }
+    }
+    for (long i = 1; i < count; i++) {
+        uint64_t edge = EDGE_KEY(i);
+        int source = sources[i], target = targets[i];
+        long j = i;
+        for (; j > 0 && EDGE_KEY(j - 1) > edge; j--) {
+            sources[j] = sources[j - 1];
+            targets[j] = targets[j - 1];
+        }
+        sources[j] = source;
+        targets[j] = target;
+    }
+#undef EDGE_KEY
+}
+
+// This function returns the merge key of the current edge of a sorted edge list,
+// its source then its target.
+// Inputs:
+//      const edge_chunk *chunk: The sorted edge list.
+//      long cursor: The edge list position.
+// Output:
+//      The merge key.
+static inline uint64_t merge_key(const edge_chunk *chunk, long cursor)
+{
+    return (uint64_t)(unsigned int)chunk->sources[cursor] << 32 | (unsigned int)chunk->targets[cursor];
+}
+
+// This function moves an edge list of the merge heap down to its place, the heap holding
+// the edge lists not yet exhausted, smallest current edge first.
+// Inputs:
+//      const edge_chunk *chunks: The sorted edge lists.
+//      const long *cursors: The position of each edge list.
+//      int *heap: The merge heap.
+//      int heap_count: The merge heap edge lists count.
+//      int position: The heap position of the edge list.
+static inline void sift_merge_heap(const edge_chunk *chunks, const long *cursors, int *heap, int heap_count, int position)
+{
+    int c = heap[position], child;
+    uint64_t key = merge_key(&chunks[c], cursors[c]);
+    while ((child = 2 * position + 1) < heap_count) {
+        if (child + 1 < heap_count
+            && merge_key(&chunks[heap[child + 1]], cursors[heap[child + 1]]) < merge_key(&chunks[heap[child]], cursors[heap[child]])) {
+            child++;
+        }
+        if (merge_key(&chunks[heap[child]], cursors[heap[child]]) >= key) {
+            break;
+        }
+        heap[position] = heap[child];
+        position = child;
+    }
+    heap[position] = c;
+}
+
+// This function returns the next target of a node row merged from sorted edge lists,
+// advancing the cursor of the edge list at the top of the merge heap, so each edge costs
+// a heap update instead of a scan of every edge list.
+// Inputs:
+//      const edge_chunk *chunks: The sorted edge lists.
+//      long *cursors: The position of each edge list.
+//      int *heap: The merge heap.
+//      int *heap_count: The merge heap edge lists count.
+//      int u: The node.
+// Output:
+//      target --> Next smallest target of the node.
+//      -1     --> No more targets.
+static inline int next_row_target(const edge_chunk *chunks, long *cursors, int *heap, int *heap_count, int u)
+{
+    int c, target;
+    if (*heap_count == 0 || chunks[heap[0]].sources[cursors[heap[0]]] != u) {
+        return -1;
+    }
+
+    c = heap[0];
+    target = chunks[c].targets[cursors[c]++];
+    if (cursors[c] == chunks[c].count) {
+        heap[0] = heap[--*heap_count];
+    }
+    if (*heap_count > 0) {
+        sift_merge_heap(chunks, cursors, heap, *heap_count, 0);
+    }
+
+    return target;
+}
+
+// This function returns the varint encoded length of a value.
+// Inputs:
+//      unsigned int value: The value.
+// Output:
+//      The encoded bytes count.
+static inline int varint_length(unsigned int value)
+{
+    int length = 1;
+    for (; value >= 0x80; value >>= 7) {
+        length++;
+    }
+
+    return length;
+}
+
+// This Thread function runs a pass of the adjacency compression. Rows are read either from
+// the CSR arrays or, when compression edge lists are set, merged from the edge lists through
+// a heap of their current edges. Pass 0 sorts the Thread edge lists by source and target and
+// counts their dependencies, pass 1 sizes the encoding of each node row of the Thread nodes
+// range into the next node compressed offset, sorting the CSR rows unless already sorted,
+// and pass 2 encodes each row as the gaps between its targets, the first one from node 0.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_compress_graph(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    long id = ((worker*)arg)->id;
+    const edge_chunk *chunks = ctx->build_chunks;
+    int u, c, v, previous, heap_count = 0, *heap = ctx->bucket_counts + (size_t)id * ctx->threads_count;
+    long edge, start, finish, *cursors = ctx->bucket_cursors + (size_t)id * ctx->threads_count;
+    if (ctx->build_pass == 0) {
+        for (c = id; c < ctx->build_chunks_count; c += ctx->threads_count) {
+            sort_edge_list(chunks[c].sources, chunks[c].targets, chunks[c].count);
+            for (edge = 0; edge < chunks[c].count; edge++) {
+                __atomic_fetch_add(&ctx->in_degrees[chunks[c].targets[edge]], 1, __ATOMIC_RELAXED);
+            }
+        }
+        return (NULL);
+    }
+
+    thread_range(ctx, id, ctx->nodes_count, &start, &finish);
+    for (c = 0; c < ctx->build_chunks_count; c++) {
+        // Find the first edge of the nodes range in each sorted edge list.
+        long low = 0, high = chunks[c].count;
+        while (low < high) {
+            long middle = low + (high - low) / 2;
+            if (chunks[c].sources[middle] < start) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        cursors[c] = low;
+        if (low < chunks[c].count) {
+            heap[heap_count++] = c;
+        }
+    }
+    for (c = heap_count / 2 - 1; c >= 0; c--) {
+        sift_merge_heap(chunks, cursors, heap, heap_count, c);
+    }
+    for (u = start; u < finish; u++) {
+        int *row = NULL;
+        long count = 0;
+        uint32_t length = 0;
+        uint8_t *p = ctx->build_pass == 2 ? (uint8_t*)compressed_row(ctx, u) : NULL;
+        if (chunks == NULL) {
+            row = ctx->targets + ctx->offsets[u];
+            count = ctx->offsets[u + 1] - ctx->offsets[u];
+            if (ctx->build_pass == 1) {
+                for (edge = 1; edge < count && row[edge - 1] <= row[edge]; edge++);
+                if (edge < count) {
+                    sort_nodes(row, count);
+                }
+            }
+        }
+        for (edge = 0, previous = 0; ; previous = v) {
+            unsigned int gap;
+            v = chunks == NULL ? (edge < count ? row[edge++] : -1) : next_row_target(chunks, cursors, heap, &heap_count, u);
+            if (v == -1) {
+                break;
+            }
+            gap = v - previous;
+            if (ctx->build_pass == 1) {
+                length += varint_length(gap);
+                continue;
+            }
+            for (; gap >= 0x80; gap >>= 7) {
+                *p++ = (uint8_t)(gap | 0x80);
+            }
+            *p++ = (uint8_t)gap;
+        }
+        if (ctx->build_pass == 1) {
+            ctx->compressed_offsets[u + 1] = length;
+        }
+    }
+
+    return (NULL);
+}
+
+// This function turns the rows lengths, held in the next node compressed offsets, into
+// rows offsets within their rows block and the rows blocks first bytes, then reserves the
+// compressed rows buffer.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Placed successfully.
+//      0 --> Something went wrong.
+static int place_compressed_rows(toposort_context *ctx)
+{
+    long total = 0, block_start = 0;
+    int u;
+    for (u = 0; u <= ctx->nodes_count; u++) {
+        long length = u < ctx->nodes_count ? ctx->compressed_offsets[u + 1] : 0;
+        if ((u & ((1 << COMPRESSED_BLOCK_SHIFT) - 1)) == 0) {
+            block_start = total;
+            ctx->compressed_bases[u >> COMPRESSED_BLOCK_SHIFT] = total;
+        }
+        if (total - block_start > 0xFFFFFFFFL) {
+            set_error(ctx, "Compressed Graph rows block exceeds 4GB.");
+            return 0;
+        }
+        ctx->compressed_offsets[u] = (uint32_t)(total - block_start);
+        total += length;
+    }
+    if (!reserve_buffer((void**)&ctx->compressed, &ctx->compressed_allocated, (size_t)total)) {
+        set_error(ctx, "Failed to allocate memory for the compressed Graph.");
+        return 0;
+    }
+
+    return 1;
+}
+
+// This function replaces the Graph adjacency with the compressed layout rows, sized and
+// encoded in parallel. Rows are encoded from the CSR arrays, whose targets buffer, or the
+// binary Graph mapping, is released afterwards, or directly from the parsed edge lists,
+// sorted in place, so the CSR targets are never built. The nodes dependencies count is
+// then counted from the edge lists.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const edge_chunk *chunks: The edge lists, NULL to encode the CSR arrays.
+//      int chunks_count: The edge lists count.
+// Output:
+//      1 --> Compressed successfully, or the compressed layout was not requested.
+//      0 --> Something went wrong.
+static int compress_graph(toposort_context *ctx, const edge_chunk *chunks, int chunks_count)
+{
+    long total;
+    // Graphs encoded from their edge lists have no CSR arrays left.
+    if (ctx->graph_layout != TOPOSORT_LAYOUT_COMPRESSED || ctx->nodes_count == 0 || (chunks == NULL && ctx->offsets == NULL)) {
+        return 1;
+    }
+    if (!reserve_buffer((void**)&ctx->compressed_offsets, &ctx->compressed_offsets_allocated, sizeof(uint32_t) * ((size_t)ctx->nodes_count + 1))
+        || !reserve_buffer((void**)&ctx->compressed_bases, &ctx->compressed_bases_allocated,
+        sizeof(long) * (((size_t)ctx->nodes_count >> COMPRESSED_BLOCK_SHIFT) + 1))) {
+        set_error(ctx, "Failed to allocate memory for the compressed Graph.");
+        return 0;
+    }
+
+    ctx->build_chunks = chunks;
+    ctx->build_chunks_count = chunks != NULL ? chunks_count : 0;
+    if (chunks != NULL) {
+        memset(ctx->in_degrees, 0, sizeof(int) * ctx->nodes_count);
+        ctx->build_pass = 0;
+        run_workers(ctx, thread_compress_graph);
+    }
+    ctx->build_pass = 1;
+    run_workers(ctx, thread_compress_graph);
+    if (!place_compressed_rows(ctx)) {
+        return 0;
+    }
+    ctx->build_pass = 2;
+    run_workers(ctx, thread_compress_graph);
+    ctx->build_chunks = NULL;
+    ctx->build_chunks_count = 0;
+
+    if (ctx->graph_mapped) {
+        munmap(ctx->input_data, ctx->input_size);
+        ctx->input_data = NULL;
+        ctx->graph_mapped = 0;
+    }
+    free(ctx->csr_targets);
+    ctx->csr_targets = NULL;
+    ctx->csr_targets_allocated = 0;
+    ctx->offsets = NULL;
+    ctx->targets = NULL;
+    total = compressed_row(ctx, ctx->nodes_count) - ctx->compressed;
+    log_message(ctx, "Graph adjacency compressed: %ld bytes, %.2f bytes per edge\n", total,
+        ctx->edges_count > 0 ? (double)total / ctx->edges_count : 0);
+
+    return 1;
+}
+
+// This function builds the Graph adjacency in the selected layout, from edge lists,
+// from the generated CSR arrays or from the memory mapped binary Graph CSR arrays.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const edge_chunk *chunks: The edge lists, NULL if the Graph CSR arrays are already set.
+//      int chunks_count: The edge lists count.
+// Output:
+//      1 --> Built successfully.
+//      0 --> Something went wrong.
+static int build_adjacency(toposort_context *ctx, const edge_chunk *chunks, int chunks_count)
+{
+    int built;
+    // Select the adjacency layout from the edge density, unless one was requested.
+    ctx->graph_layout = ctx->requested_layout;
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_AUTO) {
+        double density = ctx->nodes_count > 1
+            ? (double)ctx->edges_count / ((double)ctx->nodes_count * (ctx->nodes_count - 1)) : 0;
+        ctx->graph_layout = density > BITSET_DENSITY && !ctx->schedule && ctx->relabel == TOPOSORT_RELABEL_NONE
+            && ctx->engine != TOPOSORT_ENGINE_HYBRID ? TOPOSORT_LAYOUT_BITSET : TOPOSORT_LAYOUT_CSR;
+    }
+    if (ctx->schedule && ctx->graph_layout != TOPOSORT_LAYOUT_CSR) {
+        set_error(ctx, "Schedule mode requires the csr layout.");
+        return 0;
+    }
+
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_BITSET) {
+        built = build_bitset(ctx, chunks, chunks_count);
+    } else if (ctx->graph_layout == TOPOSORT_LAYOUT_COMPRESSED && chunks == ctx->chunks && ctx->relabel == TOPOSORT_RELABEL_NONE) {
+        // Parsed edge lists are encoded directly, the relabeling pass needing the CSR arrays.
+        return compress_graph(ctx, chunks, chunks_count);
+    } else if (chunks != NULL) {
+        built = build_graph(ctx, chunks, chunks_count);
+    } else {
+        if (ctx->graph_mapped) {
+            // The binary Graph CSR arrays are used in place, only dependencies are copied.
+            memcpy(ctx->in_degrees, ctx->mapped_in_degrees, sizeof(int) * ctx->nodes_count);
+        }
+        if (ctx->schedule && ctx->weights == NULL) {
+            // The binary Graph holds no weights, unit weights are used.
+            if (!reserve_buffer((void**)&ctx->csr_weights, &ctx->csr_weights_allocated, sizeof(double) * (size_t)ctx->edges_count)) {
+                set_error(ctx, "Failed to allocate memory during initialization.");
+                return 0;
+            }
+            ctx->weights = ctx->csr_weights;
+            for (long e = 0; e < ctx->edges_count; e++) {
+                ctx->weights[e] = 1;
+            }
+        }
+        // The generated CSR arrays are used in place.
+        return 1;
+    }
+    if (!built) {
+        set_error(ctx, "Failed to allocate memory during initialization.");
+        return 0;
+    }
+
+    if (ctx->graph_mapped) {
+        // All the data now lives in the bitset, release the binary Graph mapping.
+        munmap(ctx->input_data, ctx->input_size);
+        ctx->input_data = NULL;
+        ctx->graph_mapped = 0;
+    }
+    return 1;
+}
+
+// This Thread function copies the Thread range of the CSR targets to their 16bit indexes.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_narrow_targets(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    long edge, start, finish;
+    thread_range(ctx, ((worker*)arg)->id, ctx->edges_count, &start, &finish);
+    for (edge = start; edge < finish; edge++) {
+        ctx->targets16[edge] = (uint16_t)ctx->targets[edge];
+    }
+
+    return (NULL);
+}
+
+// This function selects the CSR target node indexes width from the Graph nodes count.
+// Graphs of up to NARROW_NODES_MAX nodes get 16bit targets, halving the edges memory
+// traffic of the sorts, and their 32bit targets, or the binary Graph mapping, are released.
+// Larger Graphs, or narrow ones whose 16bit targets cannot be allocated, keep 32bit targets.
+// The offsets and edges weights of a binary Graph are copied out of its mapping first.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Width selected successfully.
+//      0 --> Something went wrong.
+static int narrow_graph(toposort_context *ctx)
+{
+    if (ctx->graph_layout != TOPOSORT_LAYOUT_CSR || ctx->nodes_count > NARROW_NODES_MAX || ctx->edges_count == 0
+        || !reserve_buffer((void**)&ctx->targets16, &ctx->targets16_allocated, sizeof(uint16_t) * (size_t)ctx->edges_count)) {
+        return 1;
+    }
+    if (ctx->graph_mapped) {
+        // The binary Graph offsets and weights are copied, so its mapping can be released.
+        if ((ctx->offsets != ctx->csr_offsets
+            && !reserve_buffer((void**)&ctx->csr_offsets, &ctx->csr_offsets_allocated, sizeof(long) * ((size_t)ctx->nodes_count + 1)))
+            || (ctx->weights != NULL && ctx->weights != ctx->csr_weights
+            && !reserve_buffer((void**)&ctx->csr_weights, &ctx->csr_weights_allocated, sizeof(double) * (size_t)ctx->edges_count))) {
+            return 1;
+        }
+        if (ctx->offsets != ctx->csr_offsets) {
+            memcpy(ctx->csr_offsets, ctx->offsets, sizeof(long) * ((size_t)ctx->nodes_count + 1));
+            ctx->offsets = ctx->csr_offsets;
+        }
+        if (ctx->weights != NULL && ctx->weights != ctx->csr_weights) {
+            memcpy(ctx->csr_weights, ctx->weights, sizeof(double) * (size_t)ctx->edges_count);
+            ctx->weights = ctx->csr_weights;
+        }
+    }
+
+    run_workers(ctx, thread_narrow_targets);
+    if (ctx->graph_mapped) {
+        munmap(ctx->input_data, ctx->input_size);
+        ctx->input_data = NULL;
+        ctx->graph_mapped = 0;
+    }
+    free(ctx->csr_targets);
+    ctx->csr_targets = NULL;
+    ctx->csr_targets_allocated = 0;
+    ctx->targets = NULL;
+    ctx->index_width = 16;
+
+    return 1;
+}
+
+// This function restores the 32bit CSR targets of a Graph with 16bit target indexes,
+// as the incremental mode searches and removed edges marks use them.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Restored successfully, or the targets are already 32bit.
+//      0 --> Something went wrong.
+int widen_graph(toposort_context *ctx)
+{
+    long edge;
+    if (ctx->index_width != 16) {
+        return 1;
+    }
+    if (!reserve_buffer((void**)&ctx->csr_targets, &ctx->csr_targets_allocated, sizeof(int) * (size_t)ctx->edges_count)) {
+        set_error(ctx, "Failed to allocate memory for the Graph targets.");
+        return 0;
+    }
+
+    for (edge = 0; edge < ctx->edges_count; edge++) {
+        ctx->csr_targets[edge] = ctx->targets16[edge];
+    }
+    ctx->targets = ctx->csr_targets;
+    ctx->index_width = 32;
+
+    return 1;
+}
+
+// This Thread function runs a pass of the parallel reverse CSR build, as the parallel CSR
+// build does with edge lists: each Thread walks the out-edges of its nodes range, so the
+// sources of each reverse row stay in increasing order. Pass 0 counts the dependencies of the
+// nodes range out-edges in the Thread nodes histogram, pass 1 turns the histograms into
+// per Thread scatter cursors within each reverse row, for the Thread nodes range, and pass 2
+// scatters the nodes range out-edges, each Thread writing only its own row slices.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_reverse_graph(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    long id = ((worker*)arg)->id;
+    int u, t, nodes_count = ctx->nodes_count;
+    long edge, start, finish, *histogram = ctx->build_counts + (size_t)ctx->thread_ranks[id] * nodes_count;
+    thread_range(ctx, id, nodes_count, &start, &finish);
+    if (ctx->build_pass == 0) {
+        memset(histogram, 0, sizeof(long) * nodes_count);
+        for (u = start; u < finish; u++) {
+            FOR_EACH_CSR_EDGE(ctx, u, edge, target,
+                histogram[target]++;
+            )
+        }
+    } else if (ctx->build_pass == 1) {
+        for (u = start; u < finish; u++) {
+            long cursor = ctx->reverse_offsets[u];
+            for (t = 0; t < ctx->threads_count; t++) {
+                long *counts = ctx->build_counts + (size_t)t * nodes_count;
+                long count = counts[u];
+                counts[u] = cursor;
+                cursor += count;
+            }
+        }
+    } else {
+        for (u = start; u < finish; u++) {
+            FOR_EACH_CSR_EDGE(ctx, u, edge, target,
+                ctx->reverse_sources[histogram[target]++] = u;
+            )
+        }
+    }
+
+    return (NULL);
+}
+
+// This function builds the reverse CSR index of the Graph dependencies, used by the hybrid
+// engine to pull each unsorted node dependencies. Rows are sized from the nodes dependencies
+// count, and filled following the out-edges, in parallel with per Thread nodes histograms
+// as long as they stay within BUILD_HISTOGRAMS_RATIO times the Graph size, otherwise using
+// the offsets of the next nodes as row cursors. Its time is added to the build time.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Built successfully, or already built for the loaded Graph.
+//      0 --> Something went wrong.
+int reverse_graph(toposort_context *ctx)
+{
+    double start = wall_time();
+    int i;
+    long edge, *reverse_offsets;
+    if (ctx->reverse_ready) {
+        return 1;
+    }
+    if (!reserve_buffer((void**)&ctx->reverse_offsets, &ctx->reverse_offsets_allocated, sizeof(long) * ((size_t)ctx->nodes_count + 1))
+        || !reserve_buffer((void**)&ctx->reverse_sources, &ctx->reverse_sources_allocated, sizeof(int) * (size_t)ctx->edges_count)) {
+        set_error(ctx, "Failed to allocate memory for the reverse Graph.");
+        return 0;
+    }
+
+    reverse_offsets = ctx->reverse_offsets;
+    reverse_offsets[0] = 0;
+    if (ctx->threads_count > 1
+        && (size_t)ctx->threads_count * ctx->nodes_count <= BUILD_HISTOGRAMS_RATIO * ((size_t)ctx->nodes_count + ctx->edges_count)
+        && reserve_buffer((void**)&ctx->build_counts, &ctx->build_counts_allocated, sizeof(long) * (size_t)ctx->threads_count * ctx->nodes_count)) {
+        for (i = 0; i < ctx->nodes_count; i++) {
+            reverse_offsets[i + 1] = reverse_offsets[i] + ctx->in_degrees[i];
+        }
+        for (ctx->build_pass = 0; ctx->build_pass <= 2; ctx->build_pass++) {
+            run_workers(ctx, thread_reverse_graph);
+        }
+    } else {
+        // Each node starting offset is held by the next node, which ends at it once filled.
+        reverse_offsets[1] = 0;
+        for (i = 1; i < ctx->nodes_count; i++) {
+            reverse_offsets[i + 1] = reverse_offsets[i] + ctx->in_degrees[i - 1];
+        }
+        for (i = 0; i < ctx->nodes_count; i++) {
+            FOR_EACH_CSR_EDGE(ctx, i, edge, target,
+                ctx->reverse_sources[reverse_offsets[target + 1]++] = i;
+            )
+        }
+    }
+    ctx->reverse_ready = 1;
+    ctx->build_time += wall_time() - start;
+
+    return 1;
+}
+
+// This function releases the context Graph: the input file mapping and the out-of-core
+// and incremental mode resources. The context buffers are kept for the next Graph.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+void release_graph(toposort_context *ctx)
+{
+    if (ctx->input_data != NULL) {
+        munmap(ctx->input_data, ctx->input_size);
+    }
+    release_external(ctx);
+    release_incremental(ctx);
+    ctx->input_data = NULL;
+    ctx->input_size = 0;
+    ctx->input_body = NULL;
+    ctx->graph_mapped = 0;
+    ctx->graph_generated = 0;
+    ctx->graph_modified = 0;
+    ctx->offsets = NULL;
+    ctx->targets = NULL;
+    ctx->weights = NULL;
+    ctx->critical_path_count = -1;
+    ctx->nodes_count = 0;
+    ctx->edges_count = 0;
+    ctx->chunks_count = 0;
+    ctx->topology_matrix_index = -1;
+    ctx->parse_time = 0;
+    ctx->build_time = 0;
+    ctx->sort_time = 0;
+    ctx->write_time = 0;
+    ctx->relabel_time = 0;
+    ctx->relabeled = 0;
+    ctx->index_width = 32;
+    ctx->reverse_ready = 0;
+    ctx->push_levels = 0;
+    ctx->pull_levels = 0;
+}
+
+int toposort_load_file(toposort_context *ctx, const char *filename)
+{
+    double start = wall_time(), parse_end;
+    release_graph(ctx);
+    ctx->graph_layout = ctx->mem_limit > 0 ? TOPOSORT_LAYOUT_EXTERNAL : TOPOSORT_LAYOUT_CSR;
+    if (ctx->mem_limit == 0 && ctx->requested_layout == TOPOSORT_LAYOUT_EXTERNAL) {
+        set_error(ctx, "Out-of-core mode requires a memory limit.");
+        return 0;
+    }
+
+    // Map the input file and retrieve Graph nodes count, or read the generator specification.
+    ctx->graph_generated = strncmp(filename, "gen:", 4) == 0;
+    if (ctx->graph_generated) {
+        if (!read_generator_spec(ctx, filename)) {
+            return 0;
+        }
+        ctx->nodes_count = ctx->generator.nodes_count;
+    } else if (!map_input_file(ctx, filename)) {
+        return 0;
+    }
+    if (ctx->nodes_count == 0) {
+        return 1;
+    }
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_EXTERNAL) {
+        if (ctx->schedule) {
+            set_error(ctx, "Schedule mode is not available in out-of-core mode.");
+            return 0;
+        }
+        if (ctx->relabel != TOPOSORT_RELABEL_NONE) {
+            set_error(ctx, "Relabeling is not available in out-of-core mode.");
+            return 0;
+        }
+        if (ctx->graph_mapped || ctx->graph_generated) {
+            set_error(ctx, "Out-of-core mode requires a text input file.");
+            return 0;
+        }
+        return initialize_external(ctx, start);
+    }
+    if (!reserve_nodes_buffers(ctx)) {
+        return 0;
+    }
+
+    // Parse or generate the edges, then build the Graph adjacency from them.
+    if (ctx->graph_generated) {
+        if (!generate_graph(ctx)) {
+            return 0;
+        }
+    } else if (!ctx->graph_mapped && !read_edges(ctx)) {
+        return 0;
+    }
+    parse_end = wall_time();
+    if (!build_adjacency(ctx, ctx->graph_mapped || ctx->graph_generated ? NULL : ctx->chunks, ctx->chunks_count)) {
+        return 0;
+    }
+    if (!ctx->graph_mapped) {
+        // The parsed text input is no longer needed, all the data now lives in the Graph.
+        munmap(ctx->input_data, ctx->input_size);
+        ctx->input_data = NULL;
+    }
+    ctx->parse_time = parse_end - start;
+    ctx->build_time = wall_time() - parse_end;
+
+    if (!relabel_graph(ctx) || !compress_graph(ctx, NULL, 0) || !narrow_graph(ctx)) {
+        return 0;
+    }
+
+    return ctx->engine != TOPOSORT_ENGINE_HYBRID || ctx->graph_layout != TOPOSORT_LAYOUT_CSR || reverse_graph(ctx);
+}
+
+int toposort_load_edges(toposort_context *ctx, int nodes_count, long edges_count, const int *sources, const int *targets,
+    const double *weights)
+{
+    double start = wall_time();
+    edge_chunk list;
+    long i;
+    release_graph(ctx);
+    ctx->graph_layout = TOPOSORT_LAYOUT_CSR;
+    if (ctx->mem_limit > 0 || ctx->requested_layout == TOPOSORT_LAYOUT_EXTERNAL) {
+        set_error(ctx, "Out-of-core mode requires a text input file.");
+        return 0;
+    }
+    if (nodes_count < 0 || edges_count < 0) {
+        set_error(ctx, "Invalid Graph size, %d nodes and %ld edges.", nodes_count, edges_count);
+        return 0;
+    }
+    for (i = 0; i < edges_count; i++) {
+        if (sources[i] < 0 || sources[i] >= nodes_count || targets[i] < 0 || targets[i] >= nodes_count) {
+            set_error(ctx, "Invalid edge %ld: %d -> %d.", i, sources[i], targets[i]);
+            return 0;
+        }
+    }
+
+    ctx->nodes_count = nodes_count;
+    ctx->edges_count = edges_count;
+    if (nodes_count == 0) {
+        return 1;
+    }
+    if (!reserve_nodes_buffers(ctx)) {
+        return 0;
+    }
+
+    // The caller arrays form a single edge list, only read while building.
+    memset(&list, 0, sizeof(list));
+    list.sources = (int*)sources;
+    list.targets = (int*)targets;
+    list.weights = (double*)weights;
+    list.count = edges_count;
+    if (!build_adjacency(ctx, &list, 1)) {
+        return 0;
+    }
+    ctx->build_time = wall_time() - start;
+
+    if (!relabel_graph(ctx) || !compress_graph(ctx, NULL, 0) || !narrow_graph(ctx)) {
+        return 0;
+    }
+
+    return ctx->engine != TOPOSORT_ENGINE_HYBRID || ctx->graph_layout != TOPOSORT_LAYOUT_CSR || reverse_graph(ctx);
+}
+
+int toposort_read_generator(toposort_context *ctx, const char *spec, int *nodes_count)
+{
+    if (!read_generator_spec(ctx, spec)) {
+        return 0;
+    }
+    *nodes_count = ctx->generator.nodes_count;
+
+    return 1;
+}
+
+int toposort_generate_row(const toposort_context *ctx, int node, int *targets, double *weights, int capacity)
+{
+    return generate_row(&ctx->generator, node, targets, weights, capacity);
+}
@@ -0,0 +1,538 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort incremental mode, repairing a previous Topology order of a Graph after an
+// edges delta with the Pearce-Kelly algorithm, instead of sorting the whole Graph again.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "toposort_internal.h"
+
+// This function maps a whole file to memory, read only.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *filename: The file name.
+//      size_t *size: The mapped file size, 0 only if the file is empty.
+// Output:
+//      The mapped file, NULL if it could not be mapped or is empty.
+static char *map_file(toposort_context *ctx, const char *filename, size_t *size)
+{
+    struct stat file_stat;
+    char *data;
+    FILE *file = fopen(filename, "r");
+    *size = 1;
+    if (file == NULL) {
+        set_error(ctx, "Cannot open file %s.", filename);
+        return NULL;
+    }
+    if (fstat(fileno(file), &file_stat) != 0) {
+        set_error(ctx, "Cannot retrieve file %s size.", filename);
+        fclose(file);
+        return NULL;
+    }
+    *size = (size_t)file_stat.st_size;
+    if (*size == 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    data = (char*)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (data == MAP_FAILED) {
+        set_error(ctx, "Cannot map file %s to memory.", filename);
+        return NULL;
+    }
+
+    return data;
+}
+
+// This function loads the previous Topology matrix of the incremental mode, written
+// in text or binary format, and checks it is a permutation of the loaded Graph nodes,
+// and also a Topology order of the Graph when the order check is enabled.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *filename: The previous Topology matrix file.
+// Output:
+//      1 --> Loaded successfully.
+//      0 --> Something went wrong.
+static int load_previous_order(toposort_context *ctx, const char *filename)
+{
+    size_t size;
+    const char *p, *end;
+    const order_header *header;
+    int i, count, nodes_count = ctx->nodes_count;
+    long edge;
+    int *topology_matrix = ctx->topology_matrix, *node_position = ctx->node_position;
+    char *data = map_file(ctx, filename, &size);
+    if (data == NULL) {
+        if (size == 0) {
+            set_error(ctx, "Previous Topology matrix file is empty.");
+        }
+        return 0;
+    }
+
+    end = data + size;
+    header = (const order_header*)data;
+    if (size >= sizeof(order_header) && memcmp(header->magic, ORDER_MAGIC, sizeof(header->magic)) == 0) {
+        if (header->version != ORDER_VERSION || header->nodes_count != (uint64_t)nodes_count
+            || (header->width != sizeof(int) && header->width != sizeof(int64_t))
+            || size < sizeof(order_header) + header->width * (size_t)nodes_count) {
+            set_error(ctx, "Previous Topology matrix does not match the Graph.");
+            munmap(data, size);
+            return 0;
+        }
+        for (i = 0; i < nodes_count; i++) {
+            topology_matrix[i] = header->width == sizeof(int)
+                ? ((const int*)(header + 1))[i] : (int)((const int64_t*)(header + 1))[i];
+        }
+    } else {
+        p = scan_int(data, end, &count);
+        if (p == NULL || count != nodes_count) {
+            set_error(ctx, "Previous Topology matrix does not match the Graph.");
+            munmap(data, size);
+            return 0;
+        }
+        for (i = 0; i < nodes_count && p != NULL; i++) {
+            p = scan_int(p, end, &topology_matrix[i]);
+        }
+        if (p == NULL) {
+            set_error(ctx, "Previous Topology matrix is truncated.");
+            munmap(data, size);
+            return 0;
+        }
+    }
+    munmap(data, size);
+
+    // The previous order must be a permutation of the nodes.
+    for (i = 0; i < nodes_count; i++) {
+        node_position[i] = -1;
+    }
+    for (i = 0; i < nodes_count; i++) {
+        if (topology_matrix[i] < 0 || topology_matrix[i] >= nodes_count || node_position[topology_matrix[i]] != -1) {
+            set_error(ctx, "Previous Topology matrix is not a permutation of the Graph nodes.");
+            return 0;
+        }
+        node_position[topology_matrix[i]] = i;
+    }
+    // Checking every edge costs a pass over the whole Graph, so it is only done on request.
+    for (i = 0; i < nodes_count && ctx->check_order; i++) {
+        for (edge = ctx->offsets[i]; edge < ctx->offsets[i + 1]; edge++) {
+            if (node_position[ctx->targets[edge]] <= node_position[i]) {
+                set_error(ctx, "Previous Topology matrix is not a Topology order of the Graph, edge %d -> %d leads backwards.",
+                    i, ctx->targets[edge]);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+// This function loads the edges delta of the incremental mode, one "+ <src> <dst>"
+// inserted edge or "- <src> <dst>" removed edge per line, until the file end or a lone -1.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *filename: The edges delta file.
+// Output:
+//      1 --> Loaded successfully.
+//      0 --> Something went wrong.
+static int load_delta(toposort_context *ctx, const char *filename)
+{
+    size_t size;
+    const char *p, *end, *line;
+    int value, capacity = 1024, nodes_count = ctx->nodes_count;
+    char *data = map_file(ctx, filename, &size);
+    delta_edge *delta = (delta_edge*)malloc(sizeof(delta_edge) * capacity);
+    ctx->delta = delta;
+    ctx->delta_count = 0;
+    if (delta == NULL) {
+        set_error(ctx, "Failed to allocate memory for the edges delta.");
+        if (data != NULL) {
+            munmap(data, size);
+        }
+        return 0;
+    }
+    if (data == NULL) {
+        // An empty delta leaves the Topology matrix unchanged.
+        return size == 0;
+    }
+
+    end = data + size;
+    for (p = skip_spaces(data, end); p < end; p = skip_spaces(p, end)) {
+        line = p;
+        // A lone -1 ends the delta, while -1 followed by a target removes an out-edge of node 1.
+        if (end - p >= 2 && p[0] == '-' && p[1] == '1' && (p + 2 == end || skip_spaces(p + 2, end) != p + 2)
+            && scan_int(p + 2, end, &value) == NULL) {
+            break;
+        }
+        if (ctx->delta_count == capacity) {
+            delta_edge *grown = (delta_edge*)realloc(delta, sizeof(delta_edge) * capacity * 2);
+            if (grown == NULL) {
+                set_error(ctx, "Failed to allocate memory for the edges delta.");
+                munmap(data, size);
+                return 0;
+            }
+            delta = ctx->delta = grown;
+            capacity *= 2;
+        }
+        delta_edge *d = &delta[ctx->delta_count];
+        d->inserted = *p == '+';
+        p = (*p == '+' || *p == '-') ? scan_int(p + 1, end, &d->source) : NULL;
+        if (p != NULL) {
+            p = scan_int(p, end, &d->target);
+        }
+        if (p == NULL || d->source < 0 || d->source >= nodes_count || d->target < 0 || d->target >= nodes_count) {
+            set_error(ctx, "Invalid edge in delta file at byte %ld.", (long)(line - data));
+            munmap(data, size);
+            return 0;
+        }
+        ctx->delta_count++;
+    }
+    munmap(data, size);
+
+    return 1;
+}
+
+// This function initializes the incremental mode: it loads the previous Topology matrix
+// and the edges delta. Inserted edges are kept in per node linked lists.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const char *order_filename: The previous Topology matrix file.
+//      const char *delta_filename: The edges delta file.
+// Output:
+//      1 --> Initialized successfully.
+//      0 --> Something went wrong.
+static int initialize_incremental(toposort_context *ctx, const char *order_filename, const char *delta_filename)
+{
+    int i, nodes_count = ctx->nodes_count;
+    ctx->node_position = (int*)malloc(sizeof(int) * nodes_count);
+    ctx->visit_mark = (int*)calloc(nodes_count, sizeof(int));
+    ctx->search_stack = (int*)malloc(sizeof(int) * nodes_count);
+    ctx->search_position = (long*)malloc(sizeof(long) * nodes_count);
+    ctx->affected = (int*)malloc(sizeof(int) * nodes_count);
+    ctx->reordered = (int*)malloc(sizeof(int) * nodes_count);
+    ctx->inserted_out = (int*)malloc(sizeof(int) * nodes_count);
+    if ((ctx->node_position == NULL) || (ctx->visit_mark == NULL) || (ctx->search_stack == NULL)
+        || (ctx->search_position == NULL) || (ctx->affected == NULL) || (ctx->reordered == NULL)
+        || (ctx->inserted_out == NULL)) {
+        set_error(ctx, "Failed to allocate memory for the incremental mode.");
+        return 0;
+    }
+    if (!load_previous_order(ctx, order_filename) || !load_delta(ctx, delta_filename)) {
+        return 0;
+    }
+
+    ctx->inserted_edges = (inserted_edge*)malloc(sizeof(inserted_edge) * (ctx->delta_count > 0 ? ctx->delta_count : 1));
+    if (ctx->inserted_edges == NULL) {
+        set_error(ctx, "Failed to allocate memory for the incremental mode.");
+        return 0;
+    }
+    ctx->inserted_count = 0;
+    ctx->visit_epoch = 0;
+    for (i = 0; i < nodes_count; i++) {
+        ctx->inserted_out[i] = -1;
+    }
+
+    return 1;
+}
+
+// This function finds the next live out-edge of a node in incremental mode, scanning
+// the CSR edges first and the inserted edges after them. Removed edges are marked with -1
+// and skipped.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      int u: The node whose edges are scanned.
+//      long *position: The scan position, a CSR edge index, or -2 - k for inserted edge k, -1 when done.
+// Output:
+//      node --> Next adjacent node.
+//      -1   --> No more edges.
+static inline int next_incremental_edge(const toposort_context *ctx, int u, long *position)
+{
+    const int *targets = ctx->targets;
+    long csr_end = ctx->offsets[u + 1];
+    const inserted_edge *inserted_edges = ctx->inserted_edges;
+    int v, k;
+    while (*position >= 0 && *position < csr_end) {
+        v = targets[(*position)++];
+        if (v != -1) {
+            return v;
+        }
+    }
+    if (*position == csr_end) {
+        *position = -2 - ctx->inserted_out[u];
+    }
+    while (*position <= -2) {
+        k = -2 - *position;
+        *position = -2 - inserted_edges[k].next_out;
+        if (inserted_edges[k].target != -1) {
+            return inserted_edges[k].target;
+        }
+    }
+
+    return -1;
+}
+
+// This function searches the nodes reachable from the target of an inserted edge(Pearce-Kelly
+// forward search), with an iterative depth first search following out-edges to nodes positioned
+// up to the bound. Visited nodes are appended to the affected nodes list.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int start: The search start node.
+//      int bound: The Topology matrix position bound.
+//      int cycle_node: Node closing a cycle when reached.
+//      int *count: The affected nodes list count.
+// Output:
+//      1 --> Search completed.
+//      0 --> The search reached the cycle node, the stack holds the cycle path.
+static int search_forward(toposort_context *ctx, int start, int bound, int cycle_node, int *count)
+{
+    int u, v, depth = 0;
+    int *search_stack = ctx->search_stack, *visit_mark = ctx->visit_mark, *node_position = ctx->node_position;
+    long *search_position = ctx->search_position;
+    search_stack[0] = start;
+    search_position[0] = ctx->offsets[start];
+    visit_mark[start] = ctx->visit_epoch;
+    ctx->affected[(*count)++] = start;
+    while (depth >= 0) {
+        u = search_stack[depth];
+        v = next_incremental_edge(ctx, u, &search_position[depth]);
+        if (v == -1) {
+            depth--;
+            continue;
+        }
+        if (v == cycle_node) {
+            search_stack[++depth] = v;
+            return 0;
+        }
+        if (visit_mark[v] == ctx->visit_epoch || node_position[v] > bound) {
+            continue;
+        }
+        visit_mark[v] = ctx->visit_epoch;
+        ctx->affected[(*count)++] = v;
+        search_stack[++depth] = v;
+        search_position[depth] = ctx->offsets[v];
+    }
+
+    return 1;
+}
+
+// This function searches the nodes reaching the source of an inserted edge(Pearce-Kelly
+// backward search) positioned after the bound. Instead of a reverse Graph, the nodes between
+// the bound and the source are swept backwards in the Topology matrix, as only they may reach
+// the source: each of them reaches it if one of its out-edges leads to a node found before.
+// Found nodes are appended to the affected nodes list.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int start: The search start node.
+//      int bound: The Topology matrix position bound.
+//      int *count: The affected nodes list count.
+static void search_backward(toposort_context *ctx, int start, int bound, int *count)
+{
+    int position, u, v;
+    int *visit_mark = ctx->visit_mark;
+    long scan;
+    visit_mark[start] = ctx->visit_epoch;
+    ctx->affected[(*count)++] = start;
+    for (position = ctx->node_position[start] - 1; position > bound; position--) {
+        u = ctx->topology_matrix[position];
+        scan = ctx->offsets[u];
+        while ((v = next_incremental_edge(ctx, u, &scan)) != -1) {
+            if (visit_mark[v] == ctx->visit_epoch) {
+                visit_mark[u] = ctx->visit_epoch;
+                ctx->affected[(*count)++] = u;
+                break;
+            }
+        }
+    }
+}
+
+// This function inserts an edge in incremental mode, repairing the Topology matrix with
+// the Pearce-Kelly algorithm. If the edge leads backwards, the nodes reachable from its
+// target and the nodes reaching its source are searched within the affected region, and
+// reassigned the same set of positions, source side first, each side keeping its order.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int x: The edge source.
+//      int y: The edge target.
+// Output:
+//      1 --> Edge inserted.
+//      0 --> Edge rejected, it creates a cycle.
+static int insert_edge(toposort_context *ctx, int x, int y)
+{
+    int i, j, k, forward_count = 0, count = 0, length;
+    int *node_position = ctx->node_position, *affected = ctx->affected, *reordered = ctx->reordered;
+    int *topology_matrix = ctx->topology_matrix;
+    inserted_edge *edge;
+    if (x != y && node_position[x] > node_position[y]) {
+        // Search the nodes reachable from y and the nodes reaching x, within the affected region.
+        ctx->visit_epoch++;
+        if (!search_forward(ctx, y, node_position[x], x, &forward_count)) {
+            log_message(ctx, "Rejected edge %d -> %d, it creates the cycle: %d", x, y, x);
+            for (i = 0, length = 0; ctx->search_stack[i] != x; i++) {
+                if (++length <= CYCLE_PRINT_LIMIT) {
+                    log_message(ctx, " -> %d", ctx->search_stack[i]);
+                } else if (length == CYCLE_PRINT_LIMIT + 1) {
+                    log_message(ctx, " -> ...");
+                }
+            }
+            log_message(ctx, " -> %d\n", x);
+            return 0;
+        }
+        count = forward_count;
+        ctx->visit_epoch++;
+        search_backward(ctx, x, node_position[y], &count);
+
+        // Reassign the union of the affected positions, backward nodes first.
+        for (i = 0; i < count; i++) {
+            affected[i] = node_position[affected[i]];
+        }
+        sort_nodes(affected, forward_count);
+        sort_nodes(affected + forward_count, count - forward_count);
+        for (i = 0, k = 0; i < count - forward_count; i++) {
+            reordered[k++] = topology_matrix[affected[forward_count + i]];
+        }
+        for (i = 0; i < forward_count; i++) {
+            reordered[k++] = topology_matrix[affected[i]];
+        }
+        for (i = 0, j = forward_count, k = 0; k < count; k++) {
+            int position = (j == count || (i < forward_count && affected[i] < affected[j])) ? affected[i++] : affected[j++];
+            topology_matrix[position] = reordered[k];
+            node_position[reordered[k]] = position;
+        }
+        ctx->reordered_count += count;
+    } else if (x == y) {
+        log_message(ctx, "Rejected edge %d -> %d, it creates a self loop.\n", x, y);
+        return 0;
+    }
+
+    edge = &ctx->inserted_edges[ctx->inserted_count];
+    edge->source = x;
+    edge->target = y;
+    edge->next_out = ctx->inserted_out[x];
+    ctx->inserted_out[x] = ctx->inserted_count;
+    ctx->inserted_count++;
+    return 1;
+}
+
+// This function removes an edge in incremental mode. Removing an edge never
+// invalidates a Topology order, the edge is only marked as removed.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int x: The edge source.
+//      int y: The edge target.
+// Output:
+//      1 --> Edge removed.
+//      0 --> Edge not found.
+static int remove_edge(toposort_context *ctx, int x, int y)
+{
+    long edge;
+    int k;
+    for (edge = ctx->offsets[x]; edge < ctx->offsets[x + 1]; edge++) {
+        if (ctx->targets[edge] == y) {
+            ctx->targets[edge] = -1;
+            return 1;
+        }
+    }
+    for (k = ctx->inserted_out[x]; k != -1; k = ctx->inserted_edges[k].next_out) {
+        if (ctx->inserted_edges[k].target == y) {
+            ctx->inserted_edges[k].target = -1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// This function applies the edges delta to the previous Topology matrix, in the delta order.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+static void update_topology(toposort_context *ctx)
+{
+    int d;
+    const delta_edge *delta = ctx->delta;
+    for (d = 0; d < ctx->delta_count; d++) {
+        if (!delta[d].inserted) {
+            if (remove_edge(ctx, delta[d].source, delta[d].target)) {
+                ctx->removed++;
+            } else {
+                log_message(ctx, "Removed edge %d -> %d is not in the Graph.\n", delta[d].source, delta[d].target);
+                ctx->missing++;
+            }
+        } else if (insert_edge(ctx, delta[d].source, delta[d].target)) {
+            ctx->inserted++;
+        } else {
+            ctx->rejected++;
+        }
+    }
+    ctx->topology_matrix_index = ctx->nodes_count;
+}
+
+int toposort_repair(toposort_context *ctx, const char *order_filename, const char *delta_filename)
+{
+    double start = wall_time();
+    // Searches follow the edges of single nodes, the CSR layout is required.
+    if (ctx->graph_layout != TOPOSORT_LAYOUT_CSR) {
+        set_error(ctx, "Incremental mode requires the csr layout.");
+        return 0;
+    }
+    if (ctx->relabeled) {
+        set_error(ctx, "Incremental mode cannot repair the order of a relabeled Graph.");
+        return 0;
+    }
+    if (ctx->graph_modified) {
+        set_error(ctx, "Graph already holds an incremental delta, load it again before repairing.");
+        return 0;
+    }
+    if (!widen_graph(ctx)) {
+        return 0;
+    }
+
+    release_incremental(ctx);
+    ctx->topology_matrix_index = -1;
+    // The repaired order does not come with a schedule.
+    ctx->critical_path_count = -1;
+    if (!initialize_incremental(ctx, order_filename, delta_filename)) {
+        return 0;
+    }
+    // Removed edges are marked in the Graph itself, so it no longer matches its dependencies count.
+    ctx->graph_modified = 1;
+    update_topology(ctx);
+    ctx->sort_time = wall_time() - start;
+
+    return 1;
+}
+
+// This function releases the incremental mode buffers and resets its counters.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+void release_incremental(toposort_context *ctx)
+{
+    free(ctx->delta);
+    free(ctx->node_position);
+    free(ctx->inserted_edges);
+    free(ctx->inserted_out);
+    free(ctx->visit_mark);
+    free(ctx->search_stack);
+    free(ctx->search_position);
+    free(ctx->affected);
+    free(ctx->reordered);
+    ctx->delta = NULL;
+    ctx->delta_count = 0;
+    ctx->node_position = NULL;
+    ctx->inserted_edges = NULL;
+    ctx->inserted_count = 0;
+    ctx->inserted_out = NULL;
+    ctx->visit_mark = NULL;
+    ctx->search_stack = NULL;
+    ctx->search_position = NULL;
+    ctx->affected = NULL;
+    ctx->reordered = NULL;
+    ctx->inserted = 0;
+    ctx->removed = 0;
+    ctx->rejected = 0;
+    ctx->missing = 0;
+    ctx->reordered_count = 0;
+}
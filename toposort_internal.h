@@ -0,0 +1,572 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort internal interface, shared by the library source files.
+// It defines the sort context structure, the file formats structures and the
+// input scanning and adjacency helpers used on the hot paths.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#ifndef TOPOSORT_INTERNAL_H
+#define TOPOSORT_INTERNAL_H
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "toposort.h"
+
+#define BITSET_DENSITY 0.05 // Edge density above which the bitset layout is selected.
+#define LEVEL_CHUNK 64      // Frontier nodes claimed at once by a Thread in the level engine.
+#define LEVEL_BUFFER 4096   // Level engine per Thread next frontier buffer and work-stealing engine deque capacity.
+#define LEVEL_SORT_SERIAL 4096 // Level order frontiers up to this nodes count are sorted by a single Thread.
+#define DEQUE_EMPTY -1      // Deque had no nodes.
+#define DEQUE_ABORT -2      // Deque steal lost a race with another Thread.
+#define STEAL_ROUNDS 64     // Failed steal rounds before an idle Thread parks.
+#define GENERATOR_BLOCK 4096 // Nodes generated by a Thread at a time.
+#define BUILD_HISTOGRAMS_RATIO 8 // Parallel build maximum per Thread histograms size, relative to the nodes and edges count.
+#define SPILL_WINDOW (1L << 20)  // Out-of-core mode input bytes parsed before their pages are dropped.
+#define SPILL_INDEX_STRIDE 64    // Out-of-core mode nodes per sparse adjacency index block.
+#define SPILL_MIN_BUFFER 4096    // Out-of-core mode minimum edges held by an I/O buffer.
+#define CYCLE_PRINT_LIMIT 32 // Maximum witness cycle nodes printed.
+#define NUMA_NODES_MAX 64   // Maximum NUMA nodes read from sysfs.
+#define HYBRID_PULL_RATIO 2  // Hybrid engine pulls frontiers whose out-edges times it exceed the unsorted nodes dependencies.
+#define NARROW_NODES_MAX 65536 // Maximum nodes count of the CSR layout with 16bit target indexes.
+#define COMPRESSED_BLOCK_SHIFT 12 // Compressed layout nodes per rows block, whose rows offsets are 32bit, as a power of 2.
+#define ERROR_LENGTH 256    // Maximum failure description length.
+#define GRAPH_MAGIC "TOPOGRPH"  // Binary Graph format magic number.
+#define GRAPH_VERSION 2         // Binary Graph format version, with 64bit CSR offsets.
+#define GRAPH_VERSION_OFFSETS32 1 // Binary Graph format version with 32bit CSR offsets, still read.
+#define GRAPH_FLAG_WEIGHTS 1    // Binary Graph contains the edges weights.
+#define SHAPE_RANDOM  0     // Synthetic DAG where each node links to any later node.
+#define SHAPE_LAYERED 1     // Synthetic DAG where each node links to nodes of the next layer.
+#define SHAPE_CHAIN   2     // Synthetic DAG forming a chain, plus links to any later node.
+#define SHAPE_FANOUT  3     // Synthetic DAG forming a tree of the given fan-out, plus links to any later node.
+#define OUTPUT_DIGITS 11    // Maximum formatted node length, newline included.
+#define WRITE_VECTORS 1024  // Maximum buffers written by a single writev call.
+#define ORDER_MAGIC "TOPOORDR"  // Binary Topology matrix format magic number.
+#define ORDER_VERSION 1         // Binary Topology matrix format version.
+
+// Instrumentation counters are only compiled in with TOPOLOGY_STATS(make STATS=1),
+// otherwise the counting macros expand to nothing and cost nothing on the hot path.
+// They expect the sort context to be in scope as ctx.
+#ifdef TOPOLOGY_STATS
+#define STATS_ADD(id, field, value) (ctx->thread_statistics[id].field += (value))
+#define STATS_MAX(id, field, value) \
+    (ctx->thread_statistics[id].field = (value) > ctx->thread_statistics[id].field ? (value) : ctx->thread_statistics[id].field)
+#define STATS_CLOCK(name) double name = wall_time()
+#define STATS_IDLE(id, start) (ctx->thread_statistics[id].idle_time += wall_time() - (start))
+#else
+#define STATS_ADD(id, field, value) ((void)0)
+#define STATS_MAX(id, field, value) ((void)0)
+#define STATS_CLOCK(name)
+#define STATS_IDLE(id, start) ((void)0)
+#endif
+
+// Binary Graph format header structure, written by graph_converter.
+// It is followed by the int64 CSR offsets[nodes_count + 1](int32 in version 1), the int32
+// targets[edges_count] and in-degrees[nodes_count] arrays, then optionally by the double
+// weights[edges_count], aligned to 8 bytes.
+typedef struct graph_header {
+    char magic[8];         // Format magic number.
+    uint32_t version;      // Format version.
+    uint32_t flags;        // Format flags.
+    uint64_t nodes_count;  // Graph nodes count.
+    uint64_t edges_count;  // Graph edges count.
+} graph_header;
+
+// Binary Topology matrix format header structure.
+// It is followed by the nodes in Topology order, as little endian integers of the given width.
+typedef struct order_header {
+    char magic[8];         // Format magic number.
+    uint32_t version;      // Format version.
+    uint32_t width;        // Node integers width in bytes, 4 or 8.
+    uint64_t nodes_count;  // Graph nodes count.
+} order_header;
+
+// Synthetic DAG generator parameters structure.
+typedef struct generator_spec {
+    int nodes_count;       // Graph nodes count.
+    double density;        // Probability of linking a node to each of its candidate nodes.
+    int shape;             // Graph shape.
+    int layers;            // Layers count of the layered shape.
+    int fanout;            // Children count of each node of the fanout shape.
+    uint64_t seed;         // Random streams seed.
+    double min_weight;     // Edges weights lower bound.
+    double max_weight;     // Edges weights upper bound.
+} generator_spec;
+
+// Parsed edge list chunk structure.
+typedef struct edge_chunk {
+    const char *start;     // Chunk first input byte.
+    const char *stop;      // Chunk last input byte, exclusive.
+    const char *error;     // Position of the first invalid edge, NULL if none.
+    int *sources;          // Chunk edges sources.
+    int *targets;          // Chunk edges targets.
+    double *weights;       // Chunk edges weights, only kept in schedule mode.
+    long count;            // Chunk edges count.
+    long capacity;         // Chunk edge lists capacity, -1 if allocation failed.
+    long weights_capacity; // Chunk edges weights capacity.
+    int terminated;        // Chunk contains the -1 terminator.
+} edge_chunk;
+
+// Formatted Topology matrix chunk structure.
+typedef struct output_chunk {
+    int start;             // Chunk first Topology matrix position.
+    int finish;            // Chunk last Topology matrix position, exclusive.
+    char *data;            // Chunk formatted text.
+    size_t size;           // Chunk formatted text size.
+} output_chunk;
+
+// Work-stealing deque structure(Chase-Lev).
+// The owner Thread pushes and takes nodes at the bottom, while other
+// Threads steal from the top. Indexes are kept in separate cache lines.
+typedef struct deque {
+    long top __attribute__((aligned(64)));    // Steal end index.
+    long bottom __attribute__((aligned(64))); // Owner end index.
+    int *buffer;                              // Circular nodes buffer.
+    long mask;                                // Buffer capacity - 1, capacity is a power of two.
+} deque;
+
+// Incremental mode delta edge structure.
+typedef struct delta_edge {
+    int inserted;          // Edge is inserted if set, removed otherwise.
+    int source;            // Edge source.
+    int target;            // Edge target.
+} delta_edge;
+
+// Incremental mode inserted edge structure, linked in the out-edges list of its source.
+typedef struct inserted_edge {
+    int source;            // Edge source.
+    int target;            // Edge target, -1 if the edge was removed.
+    int next_out;          // Next inserted out-edge of the source, -1 if none.
+} inserted_edge;
+
+// Library Thread argument structure.
+typedef struct worker {
+    toposort_context *ctx; // The sort context.
+    long id;               // The Thread ID.
+} worker;
+
+// Sort context structure. Buffers are kept between Graphs, along with their allocated
+// sizes, and only reallocated when a larger Graph needs them to grow.
+struct toposort_context {
+    int threads_count;         // Threads used by the parallel engines, parsing and writing.
+    int engine;                // Engine used for the calculation.
+    int requested_layout;      // Graph adjacency layout requested for the loads.
+    long mem_limit;            // Out-of-core mode memory limit in bytes, 0 for the in-memory mode.
+    FILE *log;                 // Progress and diagnostics file, NULL to print nothing.
+    int schedule;              // Schedule mode is enabled.
+    int order;                 // Topology order requested for the sorts.
+    int relabel;               // Nodes relabeling requested for the loads.
+    int check_order;           // Repairs check every edge leads forward in the previous Topology matrix.
+    int affinity;              // Threads placement requested.
+    int numa_nodes;            // NUMA nodes the Threads are placed on.
+    int *thread_cpus;          // CPU each Thread is pinned to, -1 if unpinned.
+    int *thread_ranks;         // Position of each Thread in NUMA nodes order, selecting its nodes range.
+    char error[ERROR_LENGTH];  // Last failure description.
+
+    char *input_data;          // Memory mapped input file.
+    size_t input_size;         // Memory mapped input file size.
+    const char *input_body;    // Memory mapped input file edges, following the nodes count.
+    edge_chunk *chunks;        // Parsed edge list chunks, one per Thread.
+    int chunks_count;          // Parsed edge list chunks count.
+    int graph_mapped;          // Graph CSR arrays point into a memory mapped binary input file.
+    int *mapped_in_degrees;    // Graph nodes dependencies count, from the memory mapped binary input file.
+    generator_spec generator;  // Synthetic Graph generator specification.
+    int graph_generated;       // Graph CSR arrays are generated in memory instead of read from a file.
+    int graph_modified;        // Graph holds an incremental mode edges delta.
+    int nodes_count;           // Graph nodes count.
+    long edges_count;          // Graph edges count.
+    int graph_layout;          // Graph adjacency layout in use.
+    long *offsets;             // Graph CSR offsets, node i out-edges are targets[offsets[i]..offsets[i + 1]).
+    int *targets;              // Graph CSR out-edges targets.
+    long *csr_offsets;         // Graph CSR offsets buffer, unused when the offsets are mapped.
+    size_t csr_offsets_allocated; // Graph CSR offsets buffer size.
+    int *csr_targets;          // Graph CSR targets buffer, unused when the targets are mapped.
+    size_t csr_targets_allocated; // Graph CSR targets buffer size.
+    double *weights;           // Graph CSR out-edges weights, only kept in schedule mode.
+    double *csr_weights;       // Graph CSR weights buffer, unused when the weights are mapped.
+    size_t csr_weights_allocated; // Graph CSR weights buffer size.
+    uint64_t *bitset;          // Graph bitset adjacency, bit j of row i is set for edge i -> j.
+    size_t bitset_allocated;   // Graph bitset adjacency size.
+    int row_words;             // Graph bitset row length in 64bit words.
+    int *in_degrees;           // Graph nodes dependencies count, copied to the Dependencies matrix by each sort.
+    size_t in_degrees_allocated; // Graph nodes dependencies count size.
+
+    int *dependencies_matrix;  // Graph nodes dependencies matrix.
+    size_t dependencies_allocated; // Graph nodes dependencies matrix size.
+    int *topology_matrix;      // Graph nodes topology matrix.
+    size_t topology_allocated; // Graph nodes topology matrix size.
+    int topology_matrix_index; // Graph nodes topology matrix index, -1 before the first sort.
+    int *queue;                // Queue ring buffer, sized to hold every Graph node, or work-stealing engine spill segment.
+    size_t queue_allocated;    // Queue ring buffer size.
+    int queue_capacity;        // Queue ring buffer capacity.
+    int queue_head;            // Queue head index.
+    int queue_count;           // Queue nodes count.
+    double parse_time;         // Input parsing or Graph generation wall-clock time.
+    double build_time;         // Graph adjacency building wall-clock time.
+    double sort_time;          // Topology calculation wall-clock time.
+    double write_time;         // Topology matrix writing wall-clock time.
+    double relabel_time;       // Relabeling pass wall-clock time.
+    double *start_times;       // Schedule mode earliest start time of each node.
+    size_t start_times_allocated; // Schedule mode earliest start times size.
+    int *levels;               // Schedule mode level of each node.
+    size_t levels_allocated;   // Schedule mode levels size.
+    int *critical_parents;     // Schedule mode predecessor of each node on its longest path, -1 if none.
+    size_t critical_parents_allocated; // Schedule mode predecessors size.
+    char *schedule_locks;      // Schedule mode per node spin locks of the parallel engines.
+    size_t schedule_locks_allocated; // Schedule mode spin locks size.
+    int *critical_path;        // Schedule mode critical path nodes.
+    size_t critical_path_allocated; // Schedule mode critical path size.
+    int critical_path_count;   // Schedule mode critical path nodes count, -1 before a schedule mode sort.
+    double critical_path_length; // Schedule mode critical path length.
+    int levels_count;          // Schedule mode levels count.
+
+    pthread_t *tid;            // Library Threads.
+    worker *workers;           // Library Threads arguments.
+    pthread_barrier_t barrier; // Engine Threads barrier.
+    int generator_pass;        // Current Graph generation pass: 0 counts edges, 1 fills them.
+    int next_block;            // Next block of nodes to generate.
+    int build_pass;            // Current parallel CSR build or compression pass.
+    const edge_chunk *build_chunks; // Parallel CSR build or compression edge lists.
+    int build_chunks_count;    // Parallel CSR build or compression edge lists count.
+    long *build_counts;        // Parallel CSR build per Thread nodes histograms, then scatter cursors.
+    size_t build_counts_allocated; // Parallel CSR build histograms size.
+    long *build_sums;          // Parallel CSR build out-edges count of each Thread nodes range.
+    uint16_t *targets16;       // CSR layout 16bit target node indexes, replacing the targets of narrow Graphs.
+    size_t targets16_allocated; // CSR layout 16bit target node indexes size.
+    int index_width;           // CSR layout target node indexes width in bits.
+    uint8_t *compressed;       // Compressed layout rows, the varint encoded gaps between sorted targets.
+    size_t compressed_allocated; // Compressed layout rows size.
+    uint32_t *compressed_offsets; // Compressed layout first byte of each node row within its rows block, plus the rows end.
+    size_t compressed_offsets_allocated; // Compressed layout rows offsets size.
+    long *compressed_bases;    // Compressed layout first byte of each rows block, plus the rows end.
+    size_t compressed_bases_allocated; // Compressed layout rows blocks size.
+    int *thread_arena;         // Engine per Thread buffers.
+    size_t arena_allocated;    // Engine per Thread buffers size.
+    int *level_counts;         // Level engine per Thread buffered next frontier nodes count.
+    long *level_edges;         // Hybrid engine per Thread buffered next frontier out-edges count.
+    long *level_in_edges;      // Hybrid engine per Thread buffered next frontier dependencies count.
+    uint64_t *frontier_bits;   // Hybrid engine pulled frontier bitmap.
+    size_t frontier_bits_allocated; // Hybrid engine pulled frontier bitmap size.
+    long *reverse_offsets;     // Hybrid engine reverse CSR first dependency of each node, plus the dependencies end.
+    size_t reverse_offsets_allocated; // Hybrid engine reverse CSR offsets size.
+    int *reverse_sources;      // Hybrid engine reverse CSR dependencies, the sources of each node in-edges.
+    size_t reverse_sources_allocated; // Hybrid engine reverse CSR dependencies size.
+    int reverse_ready;         // Hybrid engine reverse CSR matches the loaded Graph.
+    int push_levels;           // Hybrid engine frontiers pushed in the last sort.
+    int pull_levels;           // Hybrid engine frontiers pulled in the last sort.
+    int frontier_tails[2];     // Level engine end of the flushed next frontier nodes, alternating per level.
+    int frontier_cursor;       // Level engine next unclaimed frontier node.
+    int *bucket_counts;        // Level order per Thread frontier slice nodes count in each Thread nodes range, or compression merge heaps.
+    long *bucket_cursors;      // Level order per Thread scatter position of each Thread nodes range, or compression edge lists cursors.
+    deque *deques;             // Work-stealing engine per Thread deques.
+    long pending;              // Work-stealing engine nodes pushed but not yet processed.
+    long spill_head;           // Work-stealing engine next spilled node to take.
+    long spill_tail;           // Work-stealing engine spilled nodes count.
+    int sleepers;              // Work-stealing engine parked Threads count.
+    pthread_mutex_t park_mutex; // Work-stealing engine parking mutex.
+    pthread_cond_t park_cond;  // Work-stealing engine parking condition.
+    toposort_counters *thread_statistics; // Per Thread instrumentation counters.
+
+    int relabeled;             // Graph nodes are relabeled, the sorted nodes are mapped back after each sort.
+    int *relabel_old;          // Relabeling original node of each label.
+    size_t relabel_old_allocated; // Relabeling original nodes size.
+    uint64_t *relabel_keys;    // Relabeling degree sort keys, each packed as degree << 31 | node.
+    size_t relabel_keys_allocated; // Relabeling degree sort keys size.
+    long *relabel_offsets;     // Relabeling CSR offsets buffer, swapped with the Graph one.
+    size_t relabel_offsets_allocated; // Relabeling CSR offsets buffer size.
+    int *relabel_targets;      // Relabeling CSR targets buffer, swapped with the Graph one.
+    size_t relabel_targets_allocated; // Relabeling CSR targets buffer size.
+    long *relabel_reverse;     // Relabeling reverse CSR offsets, reverse Cuthill-McKee only.
+    size_t relabel_reverse_allocated; // Relabeling reverse CSR offsets size.
+    int *relabel_sources;      // Relabeling reverse CSR dependencies sources, reverse Cuthill-McKee only.
+    size_t relabel_sources_allocated; // Relabeling reverse CSR dependencies sources size.
+
+    char *output_buffer;       // Formatted Topology matrix buffer.
+    size_t output_allocated;   // Formatted Topology matrix buffer size.
+    output_chunk *output_chunks; // Formatted Topology matrix per Thread chunks.
+    struct iovec *output_vectors; // Formatted Topology matrix chunks, between the nodes count and the terminator.
+    int output_fd;             // Output file descriptor of the current write.
+
+    uint64_t *spill_buffer;    // Out-of-core mode edges buffer, each edge packed as source << 32 | target.
+    long spill_capacity;       // Out-of-core mode edges buffer capacity.
+    FILE **spill_runs;         // Out-of-core mode sorted edge runs files.
+    int spill_runs_count;      // Out-of-core mode sorted edge runs count.
+    FILE *adjacency_file;      // Out-of-core mode merged adjacency file, edges sorted by source.
+    long *adjacency_index;     // Out-of-core mode sparse index, first edge of each nodes block in the adjacency file.
+
+    delta_edge *delta;         // Incremental mode edges delta.
+    int delta_count;           // Incremental mode edges delta count.
+    int *node_position;        // Incremental mode position of each node in the Topology matrix.
+    inserted_edge *inserted_edges; // Incremental mode inserted edges.
+    int inserted_count;        // Incremental mode inserted edges count.
+    int *inserted_out;         // Incremental mode first inserted out-edge of each node, -1 if none.
+    int *visit_mark;           // Incremental mode search epoch that last visited each node.
+    int visit_epoch;           // Incremental mode current search epoch.
+    int *search_stack;         // Incremental mode search stack nodes.
+    long *search_position;     // Incremental mode search stack nodes scan position.
+    int *affected;             // Incremental mode nodes affected by an insertion.
+    int *reordered;            // Incremental mode affected nodes in their new order.
+    int inserted;              // Incremental mode edges inserted.
+    int removed;               // Incremental mode edges removed.
+    int rejected;              // Incremental mode edges rejected.
+    int missing;               // Incremental mode removed edges not found.
+    long reordered_count;      // Incremental mode total nodes reordered.
+};
+
+// This function decodes a varint of the compressed layout rows: 7 bits per byte, least
+// significant first, the high bit set on every byte but the last.
+// Inputs:
+//      const uint8_t *p: The varint first byte.
+//      unsigned int *value: The decoded value.
+// Output:
+//      The byte following the varint.
+static inline const uint8_t *decode_varint(const uint8_t *p, unsigned int *value)
+{
+    unsigned int v = *p++, shift = 7;
+    if (v < 0x80) {
+        *value = v;
+        return p;
+    }
+
+    v &= 0x7F;
+    do {
+        v |= (unsigned int)(*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    *value = v;
+
+    return p;
+}
+
+// This function returns the first byte of a node row in the compressed layout,
+// the row ending at the first byte of the next node row.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      int u: The node, or the nodes count for the rows end.
+// Output:
+//      The node row first byte.
+static inline const uint8_t *compressed_row(const toposort_context *ctx, int u)
+{
+    return ctx->compressed + ctx->compressed_bases[u >> COMPRESSED_BLOCK_SHIFT] + ctx->compressed_offsets[u];
+}
+
+// This macro runs a statement for each CSR out-edge of a node, with the edge index and its
+// target node, instantiated for each target node indexes width, so narrow Graphs are scanned
+// with 16bit loads while the others keep their 32bit targets.
+// Inputs:
+//      ctx: The sort context.
+//      u: The node whose out-edges are scanned.
+//      edge: The edge index variable.
+//      v: The target node variable, declared by the macro.
+//      ...: The statement.
+#define FOR_EACH_CSR_EDGE(ctx, u, edge, v, ...) \
+    if ((ctx)->index_width == 16) { \
+        const uint16_t *edge_targets = (ctx)->targets16; \
+        for (edge = (ctx)->offsets[u]; edge < (ctx)->offsets[(u) + 1]; edge++) { \
+            int v = edge_targets[edge]; \
+            __VA_ARGS__ \
+        } \
+    } else { \
+        const int *edge_targets = (ctx)->targets; \
+        for (edge = (ctx)->offsets[u]; edge < (ctx)->offsets[(u) + 1]; edge++) { \
+            int v = edge_targets[edge]; \
+            __VA_ARGS__ \
+        } \
+    }
+
+// This function finds the range of a Thread, when a count of nodes or edges is split
+// between the Threads in NUMA nodes order.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      long id: The Thread ID.
+//      long count: The nodes or edges count.
+//      long *start: The range start.
+//      long *finish: The range end.
+static inline void thread_range(const toposort_context *ctx, long id, long count, long *start, long *finish)
+{
+    *start = count * ctx->thread_ranks[id] / ctx->threads_count;
+    *finish = count * (ctx->thread_ranks[id] + 1) / ctx->threads_count;
+}
+
+// This function skips whitespace characters.
+// Inputs:
+//      const char *p: Current input position.
+//      const char *end: Input end.
+// Output:
+//      Position of the next non-whitespace character, or end.
+static inline const char *skip_spaces(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        p++;
+    }
+
+    return p;
+}
+
+// This function scans a decimal integer, skipping leading whitespace.
+// Inputs:
+//      const char *p: Current input position.
+//      const char *end: Input end.
+//      int *value: The scanned value.
+// Output:
+//      Position after the integer, or NULL if no integer was found.
+static inline const char *scan_int(const char *p, const char *end, int *value)
+{
+    int negative = 0;
+    long result = 0;
+    p = skip_spaces(p, end);
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p == end || (unsigned)(*p - '0') > 9) {
+        return NULL;
+    }
+    while (p < end && (unsigned)(*p - '0') <= 9) {
+        result = result * 10 + (*p - '0');
+        if (result > 2147483647L) {
+            return NULL;
+        }
+        p++;
+    }
+    *value = (int)(negative ? -result : result);
+
+    return p;
+}
+
+// This function scans a floating point number(sign, digits, fraction and exponent),
+// skipping leading whitespace.
+// Inputs:
+//      const char *p: Current input position.
+//      const char *end: Input end.
+//      double *value: The scanned value.
+// Output:
+//      Position after the number, or NULL if no number was found.
+static inline const char *scan_double(const char *p, const char *end, double *value)
+{
+    int negative = 0, digits = 0, exponent = 0, exponent_negative = 0;
+    double result = 0, scale = 1;
+    p = skip_spaces(p, end);
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    for (; p < end && (unsigned)(*p - '0') <= 9; p++, digits++) {
+        result = result * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned)(*p - '0') <= 9; p++, digits++) {
+            scale *= 0.1;
+            result += (*p - '0') * scale;
+        }
+    }
+    if (digits == 0) {
+        return NULL;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exponent_negative = *p == '-';
+            p++;
+        }
+        for (; p < end && (unsigned)(*p - '0') <= 9; p++) {
+            exponent = exponent * 10 + (*p - '0');
+        }
+        for (; exponent > 0; exponent--) {
+            result = exponent_negative ? result / 10 : result * 10;
+        }
+    }
+    *value = negative ? -result : result;
+
+    return p;
+}
+
+// This function finds the next out-edge of a node in the Graph bitset adjacency.
+// Set bits are located a word at a time, while empty 256bit lanes are skipped
+// with a single vector test when AVX2 is available.
+// Inputs:
+//      const toposort_context *ctx: The sort context.
+//      int row: The node whose out-edges are scanned.
+//      int from: The first target node to check.
+// Output:
+//      target --> Next target node, greater than or equal to from.
+//      -1     --> No more out-edges.
+static inline int next_bitset_edge(const toposort_context *ctx, int row, int from)
+{
+    const uint64_t *words = ctx->bitset + (size_t)row * ctx->row_words;
+    int w = from >> 6, row_words = ctx->row_words;
+    uint64_t word;
+    if (from >= ctx->nodes_count) {
+        return -1;
+    }
+
+    word = words[w] & (~(uint64_t)0 << (from & 63));
+    if (word != 0) {
+        return (w << 6) + __builtin_ctzll(word);
+    }
+    w++;
+
+#ifdef __AVX2__
+    // Reach the next 256bit lane boundary, then skip empty lanes.
+    for (; (w & 3) != 0 && w < row_words; w++) {
+        if (words[w] != 0) {
+            return (w << 6) + __builtin_ctzll(words[w]);
+        }
+    }
+    for (; w < row_words; w += 4) {
+        __m256i lane = _mm256_load_si256((const __m256i*)(words + w));
+        if (!_mm256_testz_si256(lane, lane)) {
+            break;
+        }
+    }
+#endif
+    for (; w < row_words; w++) {
+        if (words[w] != 0) {
+            return (w << 6) + __builtin_ctzll(words[w]);
+        }
+    }
+
+    return -1;
+}
+
+// toposort_context.c
+double wall_time();
+void set_error(toposort_context *ctx, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_message(toposort_context *ctx, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int reserve_buffer(void **buffer, size_t *allocated, size_t size);
+void run_workers(toposort_context *ctx, void *(*function)(void*));
+
+// toposort_graph.c
+void release_graph(toposort_context *ctx);
+int widen_graph(toposort_context *ctx);
+int reverse_graph(toposort_context *ctx);
+
+// toposort_engine.c
+int sort_engine(const toposort_context *ctx);
+int reserve_engine_buffers(toposort_context *ctx);
+
+// toposort_external.c
+void sort_edges(uint64_t *edges, long count);
+void sort_nodes(int *nodes, long count);
+int initialize_external(toposort_context *ctx, double start);
+void calculate_external_topology(toposort_context *ctx);
+void release_external(toposort_context *ctx);
+
+// toposort_incremental.c
+void release_incremental(toposort_context *ctx);
+
+// toposort_relabel.c
+int relabel_graph(toposort_context *ctx);
+void restore_labels(toposort_context *ctx);
+
+#endif
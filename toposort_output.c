@@ -0,0 +1,300 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort output: the Topology matrix written as text, formatted by the context Threads
+// into a buffer kept between writes, or as a binary array, with writev calls, the
+// schedule mode start times, levels and critical path written as text, and the loaded
+// Graph saved in the binary Graph format.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <unistd.h>
+#include "toposort_internal.h"
+
+// Two digit decimal strings, used to format integers two digits at a time.
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// This function formats a non-negative integer in decimal.
+// Inputs:
+//      char *p: Current buffer position.
+//      unsigned int value: The integer.
+// Output:
+//      Position after the integer.
+static inline char *format_int(char *p, unsigned int value)
+{
+    char digits[10];
+    int length = 10;
+    while (value >= 100) {
+        unsigned int pair = (value % 100) * 2;
+        value /= 100;
+        digits[--length] = digit_pairs[pair + 1];
+        digits[--length] = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        digits[--length] = digit_pairs[value * 2 + 1];
+        digits[--length] = digit_pairs[value * 2];
+    } else {
+        digits[--length] = (char)('0' + value);
+    }
+    memcpy(p, digits + length, 10 - length);
+
+    return p + 10 - length;
+}
+
+// This function writes a list of buffers to the output file with writev,
+// resuming after partial writes.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      struct iovec *iov: The buffers.
+//      int count: The buffers count.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+static int write_buffers(toposort_context *ctx, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(ctx->output_fd, iov, count < WRITE_VECTORS ? count : WRITE_VECTORS);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            set_error(ctx, "Failed to write the output file.");
+            return 0;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 1;
+}
+
+// This function writes the Topology matrix to the output file in binary format,
+// an order_header followed by the nodes as int32 or int64 values.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int format: The output format.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+static int write_binary_topology(toposort_context *ctx, int format)
+{
+    order_header header;
+    struct iovec iov[2];
+    int i, nodes_count = ctx->nodes_count;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ORDER_MAGIC, sizeof(header.magic));
+    header.version = ORDER_VERSION;
+    header.width = format == TOPOSORT_OUTPUT_BINARY64 ? sizeof(int64_t) : sizeof(int);
+    header.nodes_count = nodes_count;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = ctx->topology_matrix;
+    iov[1].iov_len = sizeof(int) * (size_t)nodes_count;
+
+    if (format == TOPOSORT_OUTPUT_BINARY64) {
+        // Nodes are widened in the output buffer.
+        int64_t *wide;
+        if (!reserve_buffer((void**)&ctx->output_buffer, &ctx->output_allocated, sizeof(int64_t) * (size_t)nodes_count)) {
+            set_error(ctx, "Failed to allocate memory for the output buffer.");
+            return 0;
+        }
+        wide = (int64_t*)ctx->output_buffer;
+        for (i = 0; i < nodes_count; i++) {
+            wide[i] = ctx->topology_matrix[i];
+        }
+        iov[1].iov_base = wide;
+        iov[1].iov_len = sizeof(int64_t) * (size_t)nodes_count;
+    }
+
+    return write_buffers(ctx, iov, 2);
+}
+
+// This Thread function formats the chunk of the Topology matrix assigned to the Thread,
+// one node per line.
+// Inputs:
+//      void *arg: The Thread worker.
+static void *thread_format_topology(void *arg)
+{
+    toposort_context *ctx = ((worker*)arg)->ctx;
+    output_chunk *c = &ctx->output_chunks[((worker*)arg)->id];
+    char *p = c->data;
+    for (int i = c->start; i < c->finish; i++) {
+        p = format_int(p, ctx->topology_matrix[i]);
+        *p++ = '\n';
+    }
+    c->size = p - c->data;
+
+    return (NULL);
+}
+
+// This function writes the Topology matrix to the output file in text format.
+// Each Thread formats a slice of the matrix into its own part of the output buffer,
+// then all parts are written with writev, between the nodes count line and the -1 terminator.
+// In out-of-core mode the buffer is bounded by the edges buffer size, and formatted
+// by a single Thread and written once per batch of nodes.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+static int write_text_topology(toposort_context *ctx)
+{
+    struct iovec *iov = ctx->output_vectors;
+    int i = 0, written = 1, nodes_count = ctx->nodes_count;
+    long t, batch = nodes_count;
+    char *p, *data;
+    if (ctx->graph_layout == TOPOSORT_LAYOUT_EXTERNAL && ctx->spill_capacity * (long)sizeof(uint64_t) / OUTPUT_DIGITS < batch) {
+        batch = ctx->spill_capacity * sizeof(uint64_t) / OUTPUT_DIGITS;
+    }
+    if (!reserve_buffer((void**)&ctx->output_buffer, &ctx->output_allocated, (size_t)OUTPUT_DIGITS * (batch + 1) + 2)) {
+        set_error(ctx, "Failed to allocate memory for the output buffer.");
+        return 0;
+    }
+    data = ctx->output_buffer;
+
+    // First line contains the nodes count, last line contains -1 as EOF char.
+    p = format_int(data, nodes_count);
+    *p++ = '\n';
+    if (batch == nodes_count && ctx->threads_count > 1) {
+        iov[0].iov_base = data;
+        iov[0].iov_len = p - data;
+        for (t = 0; t < ctx->threads_count; t++) {
+            ctx->output_chunks[t].start = (long)nodes_count * t / ctx->threads_count;
+            ctx->output_chunks[t].finish = (long)nodes_count * (t + 1) / ctx->threads_count;
+            ctx->output_chunks[t].data = data + OUTPUT_DIGITS * (size_t)(ctx->output_chunks[t].start + 1);
+        }
+        run_workers(ctx, thread_format_topology);
+        for (t = 0; t < ctx->threads_count; t++) {
+            iov[t + 1].iov_base = ctx->output_chunks[t].data;
+            iov[t + 1].iov_len = ctx->output_chunks[t].size;
+        }
+        iov[ctx->threads_count + 1].iov_base = "-1";
+        iov[ctx->threads_count + 1].iov_len = 2;
+        return write_buffers(ctx, iov, ctx->threads_count + 2);
+    }
+
+    do {
+        for (long stop = i + batch < nodes_count ? i + batch : nodes_count; i < stop; i++) {
+            p = format_int(p, ctx->topology_matrix[i]);
+            *p++ = '\n';
+        }
+        if (i == nodes_count) {
+            *p++ = '-';
+            *p++ = '1';
+        }
+        iov[0].iov_base = data;
+        iov[0].iov_len = p - data;
+        written = write_buffers(ctx, iov, 1);
+        p = data;
+    } while (written && i < nodes_count);
+
+    return written;
+}
+
+int toposort_write(toposort_context *ctx, FILE *output, int format)
+{
+    double start = wall_time();
+    int written;
+    if (ctx->topology_matrix_index != ctx->nodes_count) {
+        set_error(ctx, "Topology matrix is incomplete, the Graph was not sorted.");
+        return 0;
+    }
+
+    // Buffered data of the stream goes first, the matrix bypasses the stream buffer.
+    if (fflush(output) != 0) {
+        set_error(ctx, "Failed to write the output file.");
+        return 0;
+    }
+    ctx->output_fd = fileno(output);
+    written = format == TOPOSORT_OUTPUT_TEXT ? write_text_topology(ctx) : write_binary_topology(ctx, format);
+    ctx->write_time = wall_time() - start;
+
+    return written;
+}
+
+int toposort_write_schedule(toposort_context *ctx, FILE *output)
+{
+    int i, node;
+    if (ctx->critical_path_count < 0) {
+        set_error(ctx, "Schedule was not calculated, sort the Graph in schedule mode first.");
+        return 0;
+    }
+
+    // First line contains the counts and the critical path length, last line contains -1 as EOF char.
+    fprintf(output, "%d %d %.9g %d\n", ctx->nodes_count, ctx->levels_count, ctx->critical_path_length, ctx->critical_path_count);
+    for (i = 0; i < ctx->nodes_count; i++) {
+        node = ctx->topology_matrix[i];
+        fprintf(output, "%d %d %.9g\n", node, ctx->levels[node], ctx->start_times[node]);
+    }
+    for (i = 0; i < ctx->critical_path_count; i++) {
+        fprintf(output, i > 0 ? " %d" : "%d", ctx->critical_path[i]);
+    }
+    fprintf(output, "\n-1");
+    if (ferror(output)) {
+        set_error(ctx, "Failed to write the schedule file.");
+        return 0;
+    }
+
+    return 1;
+}
+
+int toposort_save_graph(toposort_context *ctx, FILE *output, int with_weights)
+{
+    static const char padding[8] = { 0 };
+    static const long empty_offsets[1] = { 0 };
+    const long *offsets = ctx->nodes_count > 0 ? ctx->offsets : empty_offsets;
+    graph_header header;
+    size_t nodes_count = ctx->nodes_count, edges_count = ctx->edges_count, position;
+    if (ctx->graph_layout != TOPOSORT_LAYOUT_CSR || ctx->relabel != TOPOSORT_RELABEL_NONE) {
+        set_error(ctx, "Saving a Graph requires the CSR layout without relabeling.");
+        return 0;
+    }
+    if (with_weights && nodes_count > 0 && ctx->weights == NULL) {
+        set_error(ctx, "Graph weights were not loaded, load the Graph in schedule mode first.");
+        return 0;
+    }
+    // Narrow Graphs are saved with their 32bit targets.
+    if (!widen_graph(ctx)) {
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAPH_MAGIC, sizeof(header.magic));
+    header.version = GRAPH_VERSION;
+    header.flags = with_weights ? GRAPH_FLAG_WEIGHTS : 0;
+    header.nodes_count = nodes_count;
+    header.edges_count = edges_count;
+    // An empty Graph still has its single CSR offset.
+    if (fwrite(&header, sizeof(header), 1, output) != 1
+        || fwrite(offsets, sizeof(long), nodes_count + 1, output) != nodes_count + 1
+        || fwrite(ctx->targets, sizeof(int), edges_count, output) != edges_count
+        || fwrite(ctx->in_degrees, sizeof(int), nodes_count, output) != nodes_count) {
+        set_error(ctx, "Failed to write the Graph file.");
+        return 0;
+    }
+    if (with_weights) {
+        // Weights are aligned to 8 bytes, so they can be mapped in place.
+        position = sizeof(header) + sizeof(long) * (nodes_count + 1) + sizeof(int) * (nodes_count + edges_count);
+        if ((position % 8 != 0 && fwrite(padding, 8 - position % 8, 1, output) != 1)
+            || fwrite(ctx->weights, sizeof(double), edges_count, output) != edges_count) {
+            set_error(ctx, "Failed to write the Graph file.");
+            return 0;
+        }
+    }
+
+    return 1;
+}
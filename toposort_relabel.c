@@ -0,0 +1,280 @@
+// -------------------------------------------------------------------------------------
+//
+// libtoposort relabeling pass, renumbering the nodes of a loaded Graph for locality,
+// in breadth-first, reverse Cuthill-McKee or decreasing degree order, so the sort walks
+// the dependencies and adjacency rows of nearby nodes. The sort runs on the relabeled
+// Graph, and its Topology matrix is mapped back to the original nodes.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <sys/mman.h>
+#include "toposort_internal.h"
+
+// This function appends a node to the relabeling order, giving it the next label.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int *labels: The label of each node, -1 while unlabeled.
+//      int *count: The labeled nodes count.
+//      int i: The node.
+static inline void label_node(toposort_context *ctx, int *labels, int *count, int i)
+{
+    labels[i] = *count;
+    ctx->relabel_old[(*count)++] = i;
+}
+
+// This function orders the nodes breadth-first, from all the nodes without dependencies
+// at once, so nodes of the same frontier get consecutive labels. Nodes unreachable from
+// them(only found on or after a cycle) start further searches, in increasing order.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int *labels: The label of each node, -1 while unlabeled.
+static void order_bfs(toposort_context *ctx, int *labels)
+{
+    int i, head = 0, count = 0;
+    long edge;
+    for (i = 0; i < ctx->nodes_count; i++) {
+        if (ctx->in_degrees[i] == 0) {
+            label_node(ctx, labels, &count, i);
+        }
+    }
+    for (i = 0; i <= ctx->nodes_count; i++) {
+        while (head < count) {
+            int u = ctx->relabel_old[head++];
+            for (edge = ctx->offsets[u]; edge < ctx->offsets[u + 1]; edge++) {
+                if (labels[ctx->targets[edge]] == -1) {
+                    label_node(ctx, labels, &count, ctx->targets[edge]);
+                }
+            }
+        }
+        if (i < ctx->nodes_count && labels[i] == -1) {
+            label_node(ctx, labels, &count, i);
+        }
+    }
+}
+
+// This function sorts nodes by their degree in the undirected Graph, out-edges and
+// dependencies together, with ties in increasing node order.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const int *nodes: The nodes.
+//      int *sorted: The sorted nodes, may be the same array.
+//      int count: The nodes count.
+//      int decreasing: Nodes are sorted by decreasing degree if set.
+static void sort_by_degree(toposort_context *ctx, const int *nodes, int *sorted, int count, int decreasing)
+{
+    int k;
+    for (k = 0; k < count; k++) {
+        uint64_t degree = ctx->offsets[nodes[k] + 1] - ctx->offsets[nodes[k]] + (uint64_t)ctx->in_degrees[nodes[k]];
+        // Degrees are capped to 33 bits and nodes fit in 31 bits, packed in a single sort key.
+        degree = degree < 0x1FFFFFFFFULL ? degree : 0x1FFFFFFFFULL;
+        ctx->relabel_keys[k] = (decreasing ? 0x1FFFFFFFFULL - degree : degree) << 31 | (uint64_t)nodes[k];
+    }
+    sort_edges(ctx->relabel_keys, count);
+    for (k = 0; k < count; k++) {
+        sorted[k] = (int)(ctx->relabel_keys[k] & 0x7FFFFFFF);
+    }
+}
+
+// This function orders the nodes in reverse Cuthill-McKee order, on the undirected Graph:
+// each search starts from the unlabeled node of smallest degree, and labels the unlabeled
+// neighbors of each node by increasing degree. The order is then reversed. Neighbors
+// reached through dependencies are found on a reverse CSR built for the pass.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int *labels: The label of each node, -1 while unlabeled.
+// Output:
+//      1 --> Ordered successfully.
+//      0 --> Something went wrong.
+static int order_rcm(toposort_context *ctx, int *labels)
+{
+    int i, k, head = 0, count = 0, nodes_count = ctx->nodes_count;
+    int *in_sources, *roots = (int*)ctx->relabel_offsets;
+    long edge, *in_offsets;
+    if (!reserve_buffer((void**)&ctx->relabel_reverse, &ctx->relabel_reverse_allocated, sizeof(long) * ((size_t)nodes_count + 1))
+        || !reserve_buffer((void**)&ctx->relabel_sources, &ctx->relabel_sources_allocated, sizeof(int) * (size_t)ctx->edges_count)) {
+        return 0;
+    }
+    in_offsets = ctx->relabel_reverse;
+    in_sources = ctx->relabel_sources;
+    // Each node starting offset is held by the next node, which ends at it once filled.
+    in_offsets[0] = 0;
+    in_offsets[1] = 0;
+    for (i = 1; i < nodes_count; i++) {
+        in_offsets[i + 1] = in_offsets[i] + ctx->in_degrees[i - 1];
+    }
+    for (i = 0; i < nodes_count; i++) {
+        for (edge = ctx->offsets[i]; edge < ctx->offsets[i + 1]; edge++) {
+            in_sources[in_offsets[ctx->targets[edge] + 1]++] = i;
+        }
+    }
+
+    // Searches start from the nodes in increasing degree order, skipping the labeled ones.
+    // The roots are held by the relabeling CSR offsets buffer, not filled yet.
+    for (i = 0; i < nodes_count; i++) {
+        roots[i] = i;
+    }
+    sort_by_degree(ctx, roots, roots, nodes_count, 0);
+    for (k = 0; k < nodes_count; k++) {
+        if (labels[roots[k]] != -1) {
+            continue;
+        }
+        label_node(ctx, labels, &count, roots[k]);
+        while (head < count) {
+            int u = ctx->relabel_old[head++], first = count;
+            for (edge = ctx->offsets[u]; edge < ctx->offsets[u + 1]; edge++) {
+                if (labels[ctx->targets[edge]] == -1) {
+                    label_node(ctx, labels, &count, ctx->targets[edge]);
+                }
+            }
+            for (edge = in_offsets[u]; edge < in_offsets[u + 1]; edge++) {
+                if (labels[in_sources[edge]] == -1) {
+                    label_node(ctx, labels, &count, in_sources[edge]);
+                }
+            }
+            sort_by_degree(ctx, ctx->relabel_old + first, ctx->relabel_old + first, count - first, 0);
+        }
+    }
+
+    for (i = 0; i < nodes_count / 2; i++) {
+        int node = ctx->relabel_old[i];
+        ctx->relabel_old[i] = ctx->relabel_old[nodes_count - 1 - i];
+        ctx->relabel_old[nodes_count - 1 - i] = node;
+    }
+    for (i = 0; i < nodes_count; i++) {
+        labels[ctx->relabel_old[i]] = i;
+    }
+
+    return 1;
+}
+
+// This function orders the nodes by decreasing degree, so the nodes with the most
+// out-edges and dependencies share the first cache lines of the nodes arrays.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      int *labels: The label of each node.
+static void order_degree(toposort_context *ctx, int *labels)
+{
+    int i;
+    for (i = 0; i < ctx->nodes_count; i++) {
+        ctx->relabel_old[i] = i;
+    }
+    sort_by_degree(ctx, ctx->relabel_old, ctx->relabel_old, ctx->nodes_count, 1);
+    for (i = 0; i < ctx->nodes_count; i++) {
+        labels[ctx->relabel_old[i]] = i;
+    }
+}
+
+// This function rebuilds the Graph CSR arrays and dependencies count with the new labels.
+// The CSR arrays are built in the relabeling buffers, which are then swapped with the
+// context CSR buffers; a memory mapped binary Graph is no longer needed afterwards.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+//      const int *labels: The label of each node.
+static void rebuild_graph(toposort_context *ctx, const int *labels)
+{
+    int u, nodes_count = ctx->nodes_count;
+    long edge, position, *offsets = ctx->relabel_offsets;
+    int *targets = ctx->relabel_targets;
+    size_t allocated;
+    offsets[0] = 0;
+    for (u = 0; u < nodes_count; u++) {
+        int old = ctx->relabel_old[u];
+        position = offsets[u];
+        for (edge = ctx->offsets[old]; edge < ctx->offsets[old + 1]; edge++) {
+            targets[position++] = labels[ctx->targets[edge]];
+        }
+        offsets[u + 1] = position;
+    }
+    // The Dependencies matrix is only filled by the sorts, it holds the relabeled count meanwhile.
+    for (u = 0; u < nodes_count; u++) {
+        ctx->dependencies_matrix[u] = ctx->in_degrees[ctx->relabel_old[u]];
+    }
+    memcpy(ctx->in_degrees, ctx->dependencies_matrix, sizeof(int) * nodes_count);
+
+    ctx->relabel_offsets = ctx->csr_offsets;
+    ctx->csr_offsets = offsets;
+    allocated = ctx->relabel_offsets_allocated;
+    ctx->relabel_offsets_allocated = ctx->csr_offsets_allocated;
+    ctx->csr_offsets_allocated = allocated;
+    ctx->relabel_targets = ctx->csr_targets;
+    ctx->csr_targets = targets;
+    allocated = ctx->relabel_targets_allocated;
+    ctx->relabel_targets_allocated = ctx->csr_targets_allocated;
+    ctx->csr_targets_allocated = allocated;
+    ctx->offsets = ctx->csr_offsets;
+    ctx->targets = ctx->csr_targets;
+    if (ctx->graph_mapped) {
+        munmap(ctx->input_data, ctx->input_size);
+        ctx->input_data = NULL;
+        ctx->graph_mapped = 0;
+    }
+}
+
+// This function relabels the nodes of the loaded Graph in the requested order, recording
+// the original node of each label so the Topology matrix can be mapped back after each sort.
+// The Topology matrix buffer holds the labels during the pass, as it is only filled by the sorts.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+// Output:
+//      1 --> Relabeled successfully, or no relabeling was requested.
+//      0 --> Something went wrong.
+int relabel_graph(toposort_context *ctx)
+{
+    double start = wall_time();
+    int ordered = 1, *labels = ctx->topology_matrix;
+    size_t size = sizeof(int) * (size_t)ctx->nodes_count;
+    if (ctx->relabel == TOPOSORT_RELABEL_NONE || ctx->nodes_count == 0) {
+        return 1;
+    }
+    if (ctx->graph_layout != TOPOSORT_LAYOUT_CSR && ctx->graph_layout != TOPOSORT_LAYOUT_COMPRESSED) {
+        set_error(ctx, "Relabeling requires the csr or compressed layout.");
+        return 0;
+    }
+    if (ctx->schedule) {
+        set_error(ctx, "Relabeling cannot be combined with the schedule mode.");
+        return 0;
+    }
+    if (ctx->order != TOPOSORT_ORDER_ANY) {
+        set_error(ctx, "Relabeling cannot be combined with a deterministic order.");
+        return 0;
+    }
+    if (!reserve_buffer((void**)&ctx->relabel_old, &ctx->relabel_old_allocated, size)
+        || !reserve_buffer((void**)&ctx->relabel_keys, &ctx->relabel_keys_allocated, sizeof(uint64_t) * (size_t)ctx->nodes_count)
+        || !reserve_buffer((void**)&ctx->relabel_offsets, &ctx->relabel_offsets_allocated, sizeof(long) * ((size_t)ctx->nodes_count + 1))
+        || !reserve_buffer((void**)&ctx->relabel_targets, &ctx->relabel_targets_allocated, sizeof(int) * (size_t)ctx->edges_count)) {
+        set_error(ctx, "Failed to allocate memory for the relabeling.");
+        return 0;
+    }
+
+    memset(labels, 0xFF, size);
+    if (ctx->relabel == TOPOSORT_RELABEL_BFS) {
+        order_bfs(ctx, labels);
+    } else if (ctx->relabel == TOPOSORT_RELABEL_RCM) {
+        ordered = order_rcm(ctx, labels);
+    } else {
+        order_degree(ctx, labels);
+    }
+    if (!ordered) {
+        set_error(ctx, "Failed to allocate memory for the relabeling.");
+        return 0;
+    }
+    rebuild_graph(ctx, labels);
+    ctx->relabeled = 1;
+    ctx->relabel_time = wall_time() - start;
+    log_message(ctx, "Graph relabeled in %s order: %f secs\n", toposort_relabel_name(ctx->relabel), ctx->relabel_time);
+
+    return 1;
+}
+
+// This function maps the sorted nodes of the Topology matrix back to their original nodes.
+// Inputs:
+//      toposort_context *ctx: The sort context.
+void restore_labels(toposort_context *ctx)
+{
+    int i;
+    for (i = 0; i < ctx->topology_matrix_index; i++) {
+        ctx->topology_matrix[i] = ctx->relabel_old[ctx->topology_matrix[i]];
+    }
+}
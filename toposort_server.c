@@ -0,0 +1,612 @@
+// -------------------------------------------------------------------------------------
+//
+// This program runs the Topology sorting algorithm as a long-running server, listening
+// on a Unix domain socket. Loaded Graphs are kept in a LRU cache of libtoposort sort
+// contexts, keyed by the Graph file name, device, inode, size and modification time,
+// so repeated requests for an unchanged Graph skip the process startup, the parsing
+// and the sort itself. Requests are served by a pool of worker Threads.
+//
+// Protocol:
+//      request : a single text line "SORT <input-file>\n", where the input file is any
+//                Graph accepted by topology_shorting(text, binary or gen:<spec>),
+//                resolved relative to the server working directory.
+//      reply   : magic "TOPORPLY", uint32 status(0 sorted, 1 failed), uint32 cache
+//                (0 Graph loaded, 1 Graph cached, 2 Topology matrix cached), uint64 length,
+//                followed by length bytes: the binary Topology matrix(magic "TOPOORDR",
+//                uint32 version, uint32 integer width, uint64 nodes count, int32 nodes)
+//                when sorted, the failure description otherwise.
+//
+// Author: Angelos Stamatiou, March 2020
+//
+// -------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "toposort.h"
+
+#define REPLY_MAGIC "TOPORPLY"  // Server reply magic number.
+#define REPLY_SORTED 0          // Graph was sorted, the Topology matrix follows.
+#define REPLY_FAILED 1          // Graph could not be sorted, the failure description follows.
+#define CACHE_MISS  0           // Graph was loaded for the request.
+#define CACHE_GRAPH 1           // Graph was found in the cache and sorted.
+#define CACHE_ORDER 2           // Graph Topology matrix was found in the cache.
+#define ORDER_HEADER_SIZE 24    // Binary Topology matrix header size.
+#define REQUEST_LENGTH (PATH_MAX + 8) // Maximum request line length.
+#define REQUEST_TIMEOUT 10      // Seconds a client may take to send its request.
+#define CONNECTIONS_CAPACITY 256 // Accepted connections waiting for a worker Thread.
+
+// Server reply header structure.
+typedef struct reply_header {
+    char magic[8];              // Reply magic number.
+    uint32_t status;            // Reply status.
+    uint32_t cache;             // Reply cache outcome.
+    uint64_t length;            // Bytes following the header.
+} reply_header;
+
+// Graph cache entry structure. An entry is used by a single worker Thread at a time,
+// others requesting the same Graph wait for its lock.
+typedef struct cache_entry {
+    char path[PATH_MAX];        // Graph file name, empty if the entry is free.
+    dev_t device;               // Loaded Graph file device.
+    ino_t inode;                // Loaded Graph file inode.
+    off_t size;                 // Loaded Graph file size.
+    struct timespec mtime;      // Loaded Graph file modification time.
+    int loaded;                 // Context holds the Graph of the file key above.
+    int sorted;                 // Context holds the Topology matrix of the Graph.
+    long last_used;             // Cache clock value of the entry last request.
+    int users;                  // Worker Threads using or waiting for the entry.
+    pthread_mutex_t lock;       // Entry context lock.
+    toposort_context *ctx;      // Entry sort context, kept when the entry is evicted.
+} cache_entry;
+
+char *socket_path;              // Unix domain socket file name.
+int listen_fd;                  // Listening socket.
+int workers_count;              // Worker Threads count.
+int threads_count;              // Threads of each sort context.
+int engine;                     // Parallel engine of the sort contexts.
+int graph_layout;               // Graph adjacency layout of the sort contexts.
+pthread_t *tid;                 // Worker Threads.
+
+cache_entry *cache;             // Graph cache entries.
+int cache_capacity;             // Graph cache entries count.
+long cache_clock;               // Graph cache requests count, orders the entries by last use.
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER; // Graph cache lookup and eviction lock.
+pthread_cond_t cache_cond = PTHREAD_COND_INITIALIZER;    // Signaled when an entry has no more users.
+
+int connections[CONNECTIONS_CAPACITY]; // Accepted connections ring buffer.
+int connections_head;           // Accepted connections ring buffer head index.
+int connections_count;          // Accepted connections waiting.
+int stopping;                   // Workers must terminate once the connections are served.
+pthread_mutex_t connections_mutex = PTHREAD_MUTEX_INITIALIZER; // Accepted connections lock.
+pthread_cond_t connections_cond = PTHREAD_COND_INITIALIZER;    // Signaled when a connection is queued, or on termination.
+
+volatile sig_atomic_t terminated; // Termination signal was received.
+
+// This function returns the monotonic wall-clock time.
+// Output:
+//      Seconds elapsed since an arbitrary fixed point.
+double wall_clock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// This function handles the termination signals, stopping the accept loop.
+// Inputs:
+//      int signal_number: The signal.
+void handle_signal(int signal_number)
+{
+    (void)signal_number;
+    terminated = 1;
+}
+
+// This function writes a buffer to a socket, resuming after partial writes.
+// Inputs:
+//      int fd: The socket.
+//      const void *data: The buffer.
+//      size_t size: The buffer size.
+// Output:
+//      1 --> Written successfully.
+//      0 --> Something went wrong.
+int send_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char*)data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += written;
+        size -= written;
+    }
+
+    return 1;
+}
+
+// This function reads the request line of a client.
+// Inputs:
+//      int fd: The client socket.
+//      char *request: The request line buffer, REQUEST_LENGTH bytes long.
+// Output:
+//      1 --> Request line read, without its newline.
+//      0 --> Something went wrong.
+int read_request(int fd, char *request)
+{
+    size_t length = 0;
+    while (length < REQUEST_LENGTH - 1) {
+        ssize_t received = read(fd, request + length, REQUEST_LENGTH - 1 - length);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return 0;
+        }
+        length += received;
+        request[length] = '\0';
+        char *newline = memchr(request, '\n', length);
+        if (newline != NULL) {
+            *newline = '\0';
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// This function sends a failure reply to a client.
+// Inputs:
+//      int fd: The client socket.
+//      int cache_outcome: The reply cache outcome.
+//      const char *message: The failure description.
+void send_failure(int fd, int cache_outcome, const char *message)
+{
+    reply_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLY_MAGIC, sizeof(header.magic));
+    header.status = REPLY_FAILED;
+    header.cache = cache_outcome;
+    header.length = strlen(message);
+    if (send_all(fd, &header, sizeof(header))) {
+        send_all(fd, message, header.length);
+    }
+}
+
+// This function sends the Topology matrix of a cache entry to a client.
+// Inputs:
+//      int fd: The client socket.
+//      cache_entry *entry: The cache entry, holding the sorted Graph.
+//      int cache_outcome: The reply cache outcome.
+// Output:
+//      1 --> Sent successfully.
+//      0 --> Something went wrong.
+int send_topology(int fd, cache_entry *entry, int cache_outcome)
+{
+    reply_header header;
+    FILE *stream;
+    int sent;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLY_MAGIC, sizeof(header.magic));
+    header.status = REPLY_SORTED;
+    header.cache = cache_outcome;
+    header.length = ORDER_HEADER_SIZE + sizeof(int) * (uint64_t)toposort_nodes_count(entry->ctx);
+
+    // The library writes the matrix straight to the stream descriptor, following the header.
+    stream = fdopen(dup(fd), "w");
+    if (stream == NULL) {
+        return 0;
+    }
+    sent = fwrite(&header, sizeof(header), 1, stream) == 1 && toposort_write(entry->ctx, stream, TOPOSORT_OUTPUT_BINARY);
+    fclose(stream);
+
+    return sent;
+}
+
+// This function finds the cache entry of a Graph, or assigns it the free or least recently
+// used entry, waiting for one when every entry is in use. The entry users count is
+// incremented, so it cannot be evicted until the request releases it.
+// Inputs:
+//      const char *path: The Graph file name.
+// Output:
+//      The cache entry.
+cache_entry *acquire_entry(const char *path)
+{
+    cache_entry *entry = NULL;
+    int i;
+    pthread_mutex_lock(&cache_mutex);
+    for (i = 0; i < cache_capacity; i++) {
+        if (strcmp(cache[i].path, path) == 0) {
+            entry = &cache[i];
+            break;
+        }
+    }
+    while (entry == NULL) {
+        for (i = 0; i < cache_capacity; i++) {
+            if (cache[i].users == 0 && (entry == NULL || cache[i].last_used < entry->last_used)) {
+                entry = &cache[i];
+            }
+        }
+        if (entry != NULL) {
+            // The evicted Graph context is kept, so the new Graph reuses its buffers.
+            strcpy(entry->path, path);
+            entry->loaded = 0;
+            entry->sorted = 0;
+            break;
+        }
+        pthread_cond_wait(&cache_cond, &cache_mutex);
+        // The Graph may have been cached while waiting.
+        for (i = 0; i < cache_capacity; i++) {
+            if (strcmp(cache[i].path, path) == 0) {
+                entry = &cache[i];
+                break;
+            }
+        }
+    }
+    entry->users++;
+    entry->last_used = ++cache_clock;
+    pthread_mutex_unlock(&cache_mutex);
+
+    return entry;
+}
+
+// This function releases a cache entry acquired by a request.
+// Inputs:
+//      cache_entry *entry: The cache entry.
+void release_entry(cache_entry *entry)
+{
+    pthread_mutex_lock(&cache_mutex);
+    if (--entry->users == 0) {
+        pthread_cond_broadcast(&cache_cond);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// This function serves the request of a client: it loads the requested Graph unless its
+// cache entry holds the same version of the file, sorts it unless its Topology matrix
+// is cached too, and replies with the matrix or the failure description.
+// Inputs:
+//      int fd: The client socket.
+void serve_client(int fd)
+{
+    char request[REQUEST_LENGTH];
+    struct stat status;
+    cache_entry *entry;
+    int cache_outcome = CACHE_ORDER, sorted = 1, generated;
+    double start = wall_clock();
+    if (!read_request(fd, request)) {
+        return;
+    }
+    if (strncmp(request, "SORT ", 5) != 0 || request[5] == '\0') {
+        send_failure(fd, CACHE_MISS, "Unknown request, expected SORT <input-file>.");
+        return;
+    }
+    char *path = request + 5;
+    // Cache entries hold the path, a longer one could not be keyed.
+    if (strlen(path) >= sizeof(cache->path)) {
+        send_failure(fd, CACHE_MISS, "Input file name is too long.");
+        return;
+    }
+
+    // Generated Graphs have no file, their specification is the whole key.
+    generated = strncmp(path, "gen:", 4) == 0;
+    memset(&status, 0, sizeof(status));
+    if (!generated && stat(path, &status) != 0) {
+        send_failure(fd, CACHE_MISS, "Cannot open input file.");
+        return;
+    }
+
+    entry = acquire_entry(path);
+    pthread_mutex_lock(&entry->lock);
+    if (!entry->loaded || entry->device != status.st_dev || entry->inode != status.st_ino || entry->size != status.st_size
+        || entry->mtime.tv_sec != status.st_mtim.tv_sec || entry->mtime.tv_nsec != status.st_mtim.tv_nsec) {
+        cache_outcome = CACHE_MISS;
+        entry->sorted = 0;
+        entry->loaded = toposort_load_file(entry->ctx, path);
+        entry->device = status.st_dev;
+        entry->inode = status.st_ino;
+        entry->size = status.st_size;
+        entry->mtime = status.st_mtim;
+        if (!entry->loaded) {
+            sorted = 0;
+        }
+    }
+    if (sorted && !entry->sorted) {
+        if (cache_outcome == CACHE_ORDER) {
+            cache_outcome = CACHE_GRAPH;
+        }
+        sorted = entry->sorted = toposort_sort(entry->ctx);
+    }
+    if (sorted) {
+        sorted = send_topology(fd, entry, cache_outcome);
+        if (!sorted) {
+            printf("%s: failed to send the Topology Matrix.\n", path);
+        }
+    } else {
+        send_failure(fd, cache_outcome, toposort_error(entry->ctx));
+    }
+    if (sorted) {
+        printf("%s: %d nodes sorted(%s), %f secs\n", path, toposort_nodes_count(entry->ctx),
+            cache_outcome == CACHE_ORDER ? "order cached" : cache_outcome == CACHE_GRAPH ? "graph cached" : "loaded", wall_clock() - start);
+    } else {
+        printf("%s: %s\n", path, toposort_error(entry->ctx));
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&entry->lock);
+    release_entry(entry);
+}
+
+// This Thread function serves the accepted connections, until the server terminates
+// and no connections are left waiting.
+// Inputs:
+//      void *arg: Unused.
+void *thread_serve_connections(void *arg)
+{
+    (void)arg;
+    while (1) {
+        int fd;
+        pthread_mutex_lock(&connections_mutex);
+        while (connections_count == 0 && !stopping) {
+            pthread_cond_wait(&connections_cond, &connections_mutex);
+        }
+        if (connections_count == 0) {
+            pthread_mutex_unlock(&connections_mutex);
+            break;
+        }
+        fd = connections[connections_head];
+        connections_head = (connections_head + 1) % CONNECTIONS_CAPACITY;
+        connections_count--;
+        pthread_mutex_unlock(&connections_mutex);
+
+        serve_client(fd);
+        close(fd);
+    }
+
+    return (NULL);
+}
+
+// This function queues an accepted connection for the worker Threads.
+// The connection is refused when too many are waiting.
+// Inputs:
+//      int fd: The client socket.
+void queue_connection(int fd)
+{
+    pthread_mutex_lock(&connections_mutex);
+    if (connections_count == CONNECTIONS_CAPACITY) {
+        pthread_mutex_unlock(&connections_mutex);
+        send_failure(fd, CACHE_MISS, "Server is busy.");
+        close(fd);
+        return;
+    }
+    connections[(connections_head + connections_count) % CONNECTIONS_CAPACITY] = fd;
+    connections_count++;
+    pthread_cond_signal(&connections_cond);
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// This function creates the Graph cache entries, each one with its own sort context.
+// Output:
+//      1 --> Created successfully.
+//      0 --> Something went wrong.
+int create_cache()
+{
+    cache = (cache_entry*)calloc(cache_capacity, sizeof(cache_entry));
+    if (cache == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < cache_capacity; i++) {
+        pthread_mutex_init(&cache[i].lock, NULL);
+        cache[i].ctx = toposort_create(threads_count);
+        if (cache[i].ctx == NULL) {
+            return 0;
+        }
+        toposort_set_engine(cache[i].ctx, threads_count == 1 ? TOPOSORT_ENGINE_SERIAL : engine);
+        toposort_set_layout(cache[i].ctx, graph_layout);
+    }
+
+    return 1;
+}
+
+// This function destroys the Graph cache entries and their sort contexts.
+void destroy_cache()
+{
+    for (int i = 0; cache != NULL && i < cache_capacity; i++) {
+        toposort_destroy(cache[i].ctx);
+        pthread_mutex_destroy(&cache[i].lock);
+    }
+    free(cache);
+}
+
+// This function creates the listening Unix domain socket, replacing a stale socket file.
+// Output:
+//      1 --> Created successfully.
+//      0 --> Something went wrong.
+int create_socket()
+{
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long.\n", socket_path);
+        return 0;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        printf("Cannot create socket.\n");
+        return 0;
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        printf("Cannot listen on socket %s.\n", socket_path);
+        close(listen_fd);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Auxiliary function that displays a message in case of wrong input parameters.
+// Inputs:
+//      char *compiled_name: Programs compiled name.
+void syntax_message(char *compiled_name)
+{
+    printf("Correct syntax:\n");
+    printf("%s <socket-file> [options]\n", compiled_name);
+    printf("where: \n");
+    printf("<socket-file> is the Unix domain socket the server listens on.\n");
+    printf("options:\n");
+    printf("--workers=<count> sets the worker Threads serving requests concurrently(default 4).\n");
+    printf("--cache=<count> sets the Graphs kept in the cache(default 8).\n");
+    printf("--threads=<count> sets the Threads sorting each Graph(default 1).\n");
+    printf("--engine=level|steal|hybrid selects the parallel engine, when sorting with more than one Thread.\n");
+    printf("--layout=auto|csr|bitset|compressed selects the Graph adjacency layout, auto picks bitset for edge density above 5%%,\n");
+    printf("             compressed stores each node sorted targets as varint encoded gaps.\n");
+}
+
+// This function checks run-time parameters validity and retrieves the server settings.
+// Inputs:
+//      int argc: The run-time parameters count.
+//      char **argv: The run-time parameters.
+// Output:
+//      1 --> Parameters read successfully.
+//      0 --> Something went wrong.
+int read_parameters(int argc, char **argv)
+{
+    socket_path = argv[1];
+    if (socket_path == NULL) {
+        printf("Socket file parameter missing.\n");
+        syntax_message(argv[0]);
+        return 0;
+    }
+
+    workers_count = 4;
+    cache_capacity = 8;
+    threads_count = 1;
+    engine = TOPOSORT_ENGINE_LEVEL;
+    graph_layout = TOPOSORT_LAYOUT_AUTO;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--workers=", 10) == 0) {
+            workers_count = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cache_capacity = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads_count = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--engine=level") == 0) {
+            engine = TOPOSORT_ENGINE_LEVEL;
+        } else if (strcmp(argv[i], "--engine=steal") == 0) {
+            engine = TOPOSORT_ENGINE_STEAL;
+        } else if (strcmp(argv[i], "--engine=hybrid") == 0) {
+            engine = TOPOSORT_ENGINE_HYBRID;
+        } else if (strcmp(argv[i], "--layout=auto") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_AUTO;
+        } else if (strcmp(argv[i], "--layout=csr") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_CSR;
+        } else if (strcmp(argv[i], "--layout=bitset") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_BITSET;
+        } else if (strcmp(argv[i], "--layout=compressed") == 0) {
+            graph_layout = TOPOSORT_LAYOUT_COMPRESSED;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            syntax_message(argv[0]);
+            return 0;
+        }
+    }
+    if (workers_count <= 0 || cache_capacity <= 0 || threads_count <= 0) {
+        printf("Workers, cache and Threads counts must be positive.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction action;
+    sigset_t signals, previous_signals;
+    int t;
+
+    // Run-time parameters check.
+    if (!read_parameters(argc, argv)) {
+        printf("Program terminates.\n");
+        return -1;
+    }
+    tid = (pthread_t*)malloc(sizeof(pthread_t) * workers_count);
+    if (tid == NULL || !create_cache()) {
+        printf("Failed to allocate memory for the Graph cache.\n");
+        destroy_cache();
+        printf("Program terminates.\n");
+        return -1;
+    }
+    if (!create_socket()) {
+        destroy_cache();
+        printf("Program terminates.\n");
+        return -1;
+    }
+
+    // Clients closing their socket early must not terminate the server, while termination
+    // signals interrupt the accept loop. Worker Threads block them, so they reach this Thread.
+    signal(SIGPIPE, SIG_IGN);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous_signals);
+    for (t = 0; t < workers_count; t++) {
+        pthread_create(&tid[t], NULL, thread_serve_connections, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    printf("Server listening on socket: %s\n", socket_path);
+    printf("Worker Threads: %d, cached Graphs: %d, Threads per Graph: %d\n", workers_count, cache_capacity, threads_count);
+    fflush(stdout);
+    while (!terminated) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                printf("Failed to accept connection.\n");
+                break;
+            }
+            continue;
+        }
+        struct timeval timeout = {REQUEST_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        queue_connection(fd);
+    }
+
+    // Serve the waiting connections, then release everything.
+    printf("Server is shutting down.\n");
+    close(listen_fd);
+    unlink(socket_path);
+    pthread_mutex_lock(&connections_mutex);
+    stopping = 1;
+    pthread_cond_broadcast(&connections_cond);
+    pthread_mutex_unlock(&connections_mutex);
+    for (t = 0; t < workers_count; t++) {
+        pthread_join(tid[t], NULL);
+    }
+    destroy_cache();
+    free(tid);
+    printf("Program terminates.\n");
+
+    return 0;
+}